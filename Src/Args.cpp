@@ -35,6 +35,38 @@ static bool parse_arg_bool(StringView str) {
 	}
 };
 
+static BVHBuilderType parse_arg_bvh_builder(StringView str) {
+	if (str == "sah") {
+		return BVHBuilderType::SAH;
+	} else if (str == "binned") {
+		return BVHBuilderType::BINNED;
+	} else if (str == "lbvh") {
+		return BVHBuilderType::LBVH;
+	} else if (str == "ploc") {
+		return BVHBuilderType::PLOC;
+	} else {
+		IO::print("'{}' is not a recognized BVH builder! Supported options: sah, binned, lbvh, ploc\n"_sv, str);
+		IO::exit(1);
+		return BVHBuilderType::SAH;
+	}
+}
+
+static BVHNodeOrder parse_arg_bvh_node_order(StringView str) {
+	if (str == "none") {
+		return BVHNodeOrder::NONE;
+	} else if (str == "dfs") {
+		return BVHNodeOrder::DFS;
+	} else if (str == "bfs") {
+		return BVHNodeOrder::BFS_TREELET;
+	} else if (str == "veb") {
+		return BVHNodeOrder::VEB;
+	} else {
+		IO::print("'{}' is not a recognized BVH node order! Supported options: none, dfs, bfs, veb\n"_sv, str);
+		IO::exit(1);
+		return BVHNodeOrder::NONE;
+	}
+}
+
 struct Option {
 	StringView name_short;
 	StringView name_full;
@@ -84,18 +116,35 @@ static void parse_args(const Array<StringView> & args, Allocator * allocator) {
 		}
 	});
 
+	options.emplace_back(StringView { }, "bvh-builder"_sv,  "Sets the algorithm used to build the BLAS. Supported options: sah, binned, lbvh, ploc"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_builder  = parse_arg_bvh_builder(args[i + 1]); });
+	options.emplace_back(StringView { }, "tlas-builder"_sv, "Sets the algorithm used to build the TLAS. Supported options: sah, binned, lbvh, ploc"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.tlas_builder = parse_arg_bvh_builder(args[i + 1]); });
+	options.emplace_back(StringView { }, "bvh-order"_sv,    "Sets the memory layout of the BLAS nodes. Supported options: none, dfs, bfs, veb"_sv,   1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_node_order = parse_arg_bvh_node_order(args[i + 1]); });
+	options.emplace_back(StringView { }, "bvh-leaf-size"_sv, "Sets the maximum number of primitives in a BLAS leaf, leaves are formed based on the SAH. Ignored for bvh8"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_max_primitives_in_leaf = parse_arg_int(args[i + 1]); });
+	options.emplace_back(StringView { }, "bvh-presplit"_sv, "Sets the pre-splitting budget as a fraction of the triangle count, 0 disables. Only used by the sah and binned builders"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_presplit_budget = parse_arg_float(args[i + 1]); });
+	options.emplace_back(StringView { }, "bvh-bins"_sv,     "Sets the number of bins used by the binned SAH BVH builder"_sv,                       1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_bin_count = parse_arg_int(args[i + 1]); });
+
 	options.emplace_back(StringView { }, "nee"_sv, "Enables or disables Next Event Estimation"_sv,        1, [](const Array<StringView> & args, size_t i) { gpu_config.enable_next_event_estimation        = parse_arg_bool(args[i + 1]); });
 	options.emplace_back(StringView { }, "mis"_sv, "Enables or disables Multiple Importance Sampling"_sv, 1, [](const Array<StringView> & args, size_t i) { gpu_config.enable_multiple_importance_sampling = parse_arg_bool(args[i + 1]); });
 
 	options.emplace_back(StringView { }, "force-rebuild"_sv, "BVH will not be loaded from disk but rebuild from scratch"_sv, 0, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_force_rebuild = true; });
+	options.emplace_back(StringView { }, "bvh-compress"_sv,  "Enables or disables compression of cached BVH files. Uncompressed files are larger but are memory mapped when loading"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_cache_compression = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "bvh-cache-dir"_sv, "Sets the directory in which BVH files are stored, which can be shared between machines. By default BVH files are stored next to their source file"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_cache_directory = args[i + 1]; });
+	options.emplace_back(StringView { }, "bvh-parallel"_sv,  "Enables or disables multithreaded BVH construction"_sv,       1, [](const Array<StringView> & args, size_t i) { cpu_config.enable_parallel_bvh_build = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "mesh-parallel"_sv, "Enables or disables multithreaded parsing of OBJ and binary PLY files"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.enable_parallel_mesh_parsing = parse_arg_bool(args[i + 1]); });
+	options.emplace_back(StringView { }, "tlas-update"_sv,   "Enables or disables incremental TLAS updates (refit or partial rebuild) when Meshes move"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.enable_tlas_update = parse_arg_bool(args[i + 1]); });
 
 	options.emplace_back("O"_sv,  "optimize"_sv,    "Enables or disables BVH optimzation post-processing step"_sv,               1, [](const Array<StringView> & args, size_t i) { cpu_config.enable_bvh_optimization       = parse_arg_bool(args[i + 1]); });
 	options.emplace_back("Ot"_sv, "opt-time"_sv,    "Sets time limit (in seconds) for BVH optimization"_sv,                      1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_optimizer_max_time        = parse_arg_int (args[i + 1]); });
 	options.emplace_back("Ob"_sv, "opt-batches"_sv, "Sets a limit on the maximum number of batches used in BVH optimization"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_optimizer_max_num_batches = parse_arg_int (args[i + 1]); });
 
+	options.emplace_back(StringView { }, "bvh-stats"_sv, "Writes quality statistics of all BVHs to the given file. Supported formats: json, csv"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_stats_filename = args[i + 1]; });
+
+	options.emplace_back(StringView { }, "refit-threshold"_sv, "Sets the factor by which the SAH cost of a refitted BVH or the TLAS may degrade before it is rebuilt, 0 disables rebuilding"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.bvh_refit_rebuild_threshold = parse_arg_float(args[i + 1]); });
+
 	options.emplace_back(StringView { }, "sah-node"_sv,   "Sets the SAH cost of an internal BVH node"_sv,                                                             1, [](const Array<StringView> & args, size_t i) { cpu_config.sah_cost_node = parse_arg_float(args[i + 1]); });
 	options.emplace_back(StringView { }, "sah-leaf"_sv,   "Sets the SAH cost of a leaf BVH node"_sv,                                                                  1, [](const Array<StringView> & args, size_t i) { cpu_config.sah_cost_leaf = parse_arg_float(args[i + 1]); });
 	options.emplace_back(StringView { }, "sbvh-alpha"_sv, "Sets the SBVH alpha constant. An alpha of 1 results in a regular BVH, alpha of 0 results in full SBVH"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.sbvh_alpha    = parse_arg_float(args[i + 1]); });
+	options.emplace_back(StringView { }, "sbvh-max-dup"_sv, "Sets the maximum number of duplicate references created by SBVH spatial splits, as a fraction of the triangle count"_sv, 1, [](const Array<StringView> & args, size_t i) { cpu_config.sbvh_max_duplication = parse_arg_float(args[i + 1]); });
 
 	options.emplace_back(StringView { }, "mipmap"_sv,     "Enables or disables texture mipmapping"_sv,                                                     1, [](const Array<StringView> & args, size_t i) { gpu_config.enable_mipmapping = parse_arg_bool(args[i + 1]); });
 	options.emplace_back(StringView { }, "mip-filter"_sv, "Sets the downsampling filter for creating mipmaps: Supported options: box, lanczos, kaiser"_sv, 1, [](const Array<StringView> & args, size_t i) {
@@ -42,73 +42,144 @@ Handle<Texture> AssetManager::new_texture() {
 	return texture_handle;
 }
 
+// Loads the BLAS from the BVH cache. If only the binary BVH it is converted from is cached, that is converted instead
+static bool try_to_load_bvh(const BVHLoader::CacheEntry & cache_entry, const BVHLoader::CacheEntry & bvh2_cache_entry, MeshData & mesh_data) {
+	if (BVHLoader::try_to_load(cache_entry, &mesh_data)) return true;
+
+	bool is_converted = cache_entry.bvh_type != bvh2_cache_entry.bvh_type;
+	if (!is_converted || !BVHLoader::try_to_load(bvh2_cache_entry, &mesh_data)) return false;
+
+	mesh_data.bvh = BVH::create_from_bvh2(std::move(static_cast<BVH2 &>(*mesh_data.bvh.get())));
+	BVHLoader::save(cache_entry, mesh_data, *mesh_data.bvh.get());
+
+	return true;
+}
+
+// Converts the binary BVH into the BLAS, both are written to the BVH cache
+static void init_bvh(const BVHLoader::CacheEntry & cache_entry, const BVHLoader::CacheEntry & bvh2_cache_entry, MeshData & mesh_data, BVH2 bvh) {
+	bool is_converted = cache_entry.bvh_type != bvh2_cache_entry.bvh_type;
+	if (is_converted) {
+		BVHLoader::save(bvh2_cache_entry, mesh_data, bvh);
+	}
+
+	mesh_data.bvh = BVH::create_from_bvh2(std::move(bvh));
+	BVHLoader::save(cache_entry, mesh_data, *mesh_data.bvh.get());
+}
+
 Handle<MeshData> AssetManager::add_mesh_data(String filename, FallbackLoader fallback_loader) {
-	String bvh_filename = BVHLoader::get_bvh_filename(filename.view(), nullptr);
-	return add_mesh_data(std::move(filename), std::move(bvh_filename), std::move(fallback_loader));
+	return add_mesh_data(std::move(filename), StringView { }, std::move(fallback_loader));
 }
 
-Handle<MeshData> AssetManager::add_mesh_data(String filename, String bvh_filename, FallbackLoader fallback_loader) {
-	Handle<MeshData> & mesh_data_handle = mesh_data_cache[filename];
+Handle<MeshData> AssetManager::add_mesh_data(String filename, StringView name, FallbackLoader fallback_loader) {
+	String cache_name = name.size() > 0 ? Format().format("{}.{}"_sv, filename, name) : filename;
+	Handle<MeshData> & mesh_data_handle = mesh_data_cache[cache_name];
 
 	if (mesh_data_handle.handle != INVALID) return mesh_data_handle;
 
 	mesh_data_handle = new_mesh_data();
 
-	// Removed threadworker pool, so now construction is not done on parallell threads -Herdi
-	BVH2     bvh       = { };
-	MeshData mesh_data = { };
-
-	bool bvh_loaded = BVHLoader::try_to_load(filename, bvh_filename, &mesh_data, &bvh);
-	if (!bvh_loaded) {
-		mesh_data.triangles = fallback_loader(filename, nullptr);
-
-		if (mesh_data.triangles.size() == 0) {
-			// FIXME: Right now empty MeshData is handled by inserting a dummy Triangle
-			Triangle triangle = Triangle(
-				Vector3(-1.0f, -1.0f, 0.0f),
-				Vector3( 0.0f, +1.0f, 0.0f),
-				Vector3(+1.0f, -1.0f, 0.0f),
-				Vector3(0.0f, 0.0f, 1.0f),
-				Vector3(0.0f, 0.0f, 1.0f),
-				Vector3(0.0f, 0.0f, 1.0f),
-				Vector2(0.0f, 1.0f),
-				Vector2(0.5f, 0.0f),
-				Vector2(1.0f, 1.0f)
-			);
-			mesh_data.triangles = { triangle };
+	// Loading, BVH construction, conversion, and writing the BVH file happen on a worker thread.
+	// The Handle was already assigned above, so it does not depend on the order in which Meshes finish loading.
+	// NOTE: The Strings are copied, since they may use an Allocator that is not thread-safe
+	ThreadPool::submit([this, filename = String(filename.view()), name = String(name), fallback_loader = std::move(fallback_loader), mesh_data_handle]() {
+		BVHLoader::CacheEntry cache_entry      = BVHLoader::get_cache_entry     (filename.view(), name.view());
+		BVHLoader::CacheEntry bvh2_cache_entry = BVHLoader::get_bvh2_cache_entry(filename.view(), name.view());
+
+		MeshData mesh_data = { };
+
+		bool bvh_loaded = try_to_load_bvh(cache_entry, bvh2_cache_entry, mesh_data);
+		if (!bvh_loaded) {
+			mesh_data.triangles = fallback_loader(filename, nullptr);
+
+			if (mesh_data.triangles.size() == 0) {
+				// FIXME: Right now empty MeshData is handled by inserting a dummy Triangle
+				Triangle triangle = Triangle(
+					Vector3(-1.0f, -1.0f, 0.0f),
+					Vector3( 0.0f, +1.0f, 0.0f),
+					Vector3(+1.0f, -1.0f, 0.0f),
+					Vector3(0.0f, 0.0f, 1.0f),
+					Vector3(0.0f, 0.0f, 1.0f),
+					Vector3(0.0f, 0.0f, 1.0f),
+					Vector2(0.0f, 1.0f),
+					Vector2(0.5f, 0.0f),
+					Vector2(1.0f, 1.0f)
+				);
+				mesh_data.triangles = { triangle };
+			}
+			mesh_data.init_vertices();
+
+			init_bvh(cache_entry, bvh2_cache_entry, mesh_data, BVH::create_from_triangles(mesh_data.triangles));
 		}
 
-		bvh = BVH::create_from_triangles(mesh_data.triangles);
-		BVHLoader::save(bvh_filename, mesh_data, bvh);
-	}
+		{
+			MutexLock lock(mesh_datas_mutex);
+			get_mesh_data(mesh_data_handle) = std::move(mesh_data);
+		}
+	});
 
-	if (cpu_config.bvh_type != BVHType::BVH8 && cpu_config.enable_bvh_collapse) {
-		BVHCollapser::collapse(bvh);
-	}
+	return mesh_data_handle;
+}
 
-	mesh_data.bvh = BVH::create_from_bvh2(std::move(bvh));
+Handle<MeshData> AssetManager::add_mesh_data(Array<Triangle> triangles) {
+	Handle<MeshData> mesh_data_handle = new_mesh_data();
 
-	{
-		MutexLock lock(mesh_datas_mutex);
-		get_mesh_data(mesh_data_handle) = std::move(mesh_data);
-	}
+	ThreadPool::submit([this, triangles = std::move(triangles), mesh_data_handle]() mutable {
+		BVH2 bvh = BVH::create_from_triangles(triangles);
+
+		MeshData mesh_data = { };
+		mesh_data.triangles = std::move(triangles);
+		mesh_data.init_vertices();
+		mesh_data.bvh = BVH::create_from_bvh2(std::move(bvh));
+
+		{
+			MutexLock mutex(mesh_datas_mutex);
+			get_mesh_data(mesh_data_handle) = std::move(mesh_data);
+		}
+	});
 
 	return mesh_data_handle;
 }
 
-Handle<MeshData> AssetManager::add_mesh_data(Array<Triangle> triangles) {
-	Handle<MeshData> mesh_data_handle = new_mesh_data();
+Handle<MeshData> AssetManager::add_curve_mesh_data(String filename, StringView loader_params, CurveFallbackLoader fallback_loader) {
+	// The same file loaded with different parameters results in different CurveSegments
+	String cache_name = loader_params.size() > 0 ? Format().format("{}.{:016x}"_sv, filename, FNVHash::hash(loader_params.data(), loader_params.size())) : filename;
+	Handle<MeshData> & mesh_data_handle = mesh_data_cache[cache_name];
 
-	BVH2 bvh = BVH::create_from_triangles(triangles);
+	if (mesh_data_handle.handle != INVALID) return mesh_data_handle;
 
-	MeshData mesh_data = { };
-	mesh_data.triangles = std::move(triangles);
-	mesh_data.bvh = BVH::create_from_bvh2(std::move(bvh));
+	mesh_data_handle = new_mesh_data();
 
-	{
-		MutexLock mutex(mesh_datas_mutex);
-		get_mesh_data(mesh_data_handle) = std::move(mesh_data);
-	}
+	// Same as for Triangles, see add_mesh_data()
+	ThreadPool::submit([this, filename = String(filename.view()), loader_params = String(loader_params), fallback_loader = std::move(fallback_loader), mesh_data_handle]() {
+		BVHLoader::CacheEntry cache_entry      = BVHLoader::get_cache_entry     (filename.view(), StringView { }, loader_params.view());
+		BVHLoader::CacheEntry bvh2_cache_entry = BVHLoader::get_bvh2_cache_entry(filename.view(), StringView { }, loader_params.view());
+
+		MeshData mesh_data = { };
+
+		bool bvh_loaded = try_to_load_bvh(cache_entry, bvh2_cache_entry, mesh_data);
+		if (!bvh_loaded) {
+			mesh_data.curves = fallback_loader(filename, nullptr);
+
+			if (mesh_data.curves.size() == 0) {
+				// Same as for Triangles, empty MeshData is handled by inserting a dummy CurveSegment
+				CurveSegment curve = { };
+				curve.position_0 = Vector3(0.0f, -1.0f, 0.0f);
+				curve.radius_0   = 0.01f;
+				curve.position_1 = Vector3(0.0f, +1.0f, 0.0f);
+				curve.radius_1   = 0.01f;
+
+				mesh_data.curves = { curve };
+			}
+			mesh_data.init_curve_points();
+
+			init_bvh(cache_entry, bvh2_cache_entry, mesh_data, BVH::create_from_curves(mesh_data.curves));
+		}
+
+		{
+			MutexLock lock(mesh_datas_mutex);
+			get_mesh_data(mesh_data_handle) = std::move(mesh_data);
+		}
+	});
 
 	return mesh_data_handle;
 }
@@ -177,6 +248,7 @@ Handle<Texture> AssetManager::add_texture(String filename, String name) {
 void AssetManager::wait_until_loaded() {
 	if (assets_loaded) return; // Only necessary (and valid) to do this once
 
+	// Join point for all asynchronously loaded MeshDatas and Textures
 	ThreadPool::sync();
 
 	mesh_data_cache.clear();
@@ -13,7 +13,6 @@
 #include "Renderer/Texture.h"
 
 #include "BVHLoader.h"
-#include "BVH/BVHCollapser.h"
 
 #include "Util/ThreadPool.h"
 
@@ -39,12 +38,21 @@ private:
 	Handle<Texture>  new_texture();
 
 public:
+	// MeshDatas and Textures are loaded asynchronously on the ThreadPool, their contents are only valid after wait_until_loaded().
+	// Handles are assigned immediately, in the order in which the assets are added
+	// NOTE: Fallback loaders are called on a worker thread, so they must not refer to memory that is freed before wait_until_loaded()
 	using FallbackLoader = Function<Array<Triangle>(const String & filename, Allocator * allocator)>;
 
-	Handle<MeshData> add_mesh_data(String filename,                      FallbackLoader fallback_loader);
-	Handle<MeshData> add_mesh_data(String filename, String bvh_filename, FallbackLoader fallback_loader);
+	Handle<MeshData> add_mesh_data(String filename,                  FallbackLoader fallback_loader);
+	Handle<MeshData> add_mesh_data(String filename, StringView name, FallbackLoader fallback_loader); // Name distinguishes multiple meshes in the same file
 	Handle<MeshData> add_mesh_data(Array<Triangle> triangles);
 
+	using CurveFallbackLoader = Function<Array<CurveSegment>(const String & filename, Allocator * allocator)>;
+
+	// Same as add_mesh_data(), but for geometry that consists of CurveSegments instead of Triangles (e.g. hair)
+	// Loader parameters are the bytes of any parameters passed to the fallback loader that affect the CurveSegments (e.g. their radius)
+	Handle<MeshData> add_curve_mesh_data(String filename, StringView loader_params, CurveFallbackLoader fallback_loader);
+
 	Handle<Material> add_material(Material material);
 
 	Handle<Medium> add_medium(Medium medium);
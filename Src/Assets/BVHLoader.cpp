@@ -3,36 +3,260 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <chrono>
+#include <type_traits>
+
 #include <miniz/miniz.h>
 
 #include "Core/IO.h"
+#include "Core/Hash.h"
+#include "Core/Mutex.h"
+#include "Core/HashMap.h"
+#include "Core/Random.h"
 #include "Core/Parser.h"
 #include "Core/Allocators/StackAllocator.h"
+#include "Core/Allocators/MappedFileAllocator.h"
+
+#include "BVH/Converters/BVH4Converter.h"
 
 #include "Util/Util.h"
 #include "Util/StringUtil.h"
 
-String BVHLoader::get_bvh_filename(StringView filename, Allocator * allocator) {
-	return Util::combine_stringviews(filename, StringView::from_c_str(BVH_FILE_EXTENSION), allocator);
-}
-
 struct BVHFileHeader {
 	char filetype_identifier[4];
 	char filetype_version;
+	bool is_compressed;
+	char bvh_type;
 
-	// Store settings with which the BVH was created
-	char underlying_bvh_type;
-	bool bvh_is_optimized;
-	float sah_cost_node;
-	float sah_cost_leaf;
+	uint64_t cache_key; // Guards against BVH files that were renamed or copied to the wrong location
 
+	int num_vertices;
 	int num_triangles;
+	int num_curve_points;
+	int num_curves;
 	int num_nodes;
 	int num_indices;
 };
 
-bool BVHLoader::try_to_load(const String & filename, const String & bvh_filename, MeshData * mesh_data, BVH2 * bvh) {
-	if (cpu_config.bvh_force_rebuild || !IO::file_exists(filename.view()) || !IO::file_exists(bvh_filename.view()) || IO::file_is_newer(bvh_filename.view(), filename.view())) {
+// The Node section contains the Nodes of either the final BLAS, or of the binary BVH it is converted from (see CacheEntry)
+static size_t get_node_size(BVHType bvh_type) {
+	switch (bvh_type) {
+		case BVHType::BVH:
+		case BVHType::SBVH: return sizeof(BVHNode2);
+		case BVHType::BVH4: return sizeof(BVHNode4);
+		case BVHType::BVH8: return sizeof(BVHNode8);
+		default: ASSERT_UNREACHABLE();
+	}
+	return 0;
+}
+
+static OwnPtr<BVH> create_bvh(BVHType bvh_type) {
+	switch (bvh_type) {
+		case BVHType::BVH:
+		case BVHType::SBVH: return make_owned<BVH2>();
+		case BVHType::BVH4: return make_owned<BVH4>();
+		case BVHType::BVH8: return make_owned<BVH8>();
+		default: ASSERT_UNREACHABLE();
+	}
+	return nullptr;
+}
+
+template<typename From, typename To>
+using CopyConst = std::conditional_t<std::is_const_v<From>, const To, To>;
+
+// Calls the given function with the Node Array of the BLAS, const if the BLAS is const
+template<typename BLAS, typename Function>
+static void visit_nodes(BLAS & bvh, BVHType bvh_type, Function && function) {
+	static_assert(std::is_same_v<std::remove_const_t<BLAS>, BVH>);
+
+	switch (bvh_type) {
+		case BVHType::BVH:
+		case BVHType::SBVH: function(static_cast<CopyConst<BLAS, BVH2> &>(bvh).nodes); break;
+		case BVHType::BVH4: function(static_cast<CopyConst<BLAS, BVH4> &>(bvh).nodes); break;
+		case BVHType::BVH8: function(static_cast<CopyConst<BLAS, BVH8> &>(bvh).nodes); break;
+		default: ASSERT_UNREACHABLE();
+	}
+}
+
+// Leaf size used when collapsing into a BVH4, the leaves of a BVH8 are limited by its Node encoding instead
+static int get_collapse_max_primitives_in_leaf() {
+	return cpu_config.bvh_type == BVHType::BVH4 ? BVH4Converter::MAX_PRIMITIVES_IN_LEAF : 0;
+}
+
+// Hashes all settings that affect the binary BVH. Settings that are not used with the current configuration are skipped,
+// so that changing them does not needlessly invalidate cached BVHs
+static void hash_build_settings(XXHash64 & hash) {
+	hash.update(BVHLoader::BVH_FILETYPE_VERSION);
+
+	hash.update(cpu_config.bvh_type == BVHType::SBVH);
+	hash.update(cpu_config.bvh_builder);
+	if (cpu_config.bvh_builder == BVHBuilderType::BINNED) {
+		hash.update(cpu_config.bvh_bin_count);
+	}
+	if (cpu_config.bvh_type == BVHType::SBVH) {
+		hash.update(cpu_config.sbvh_alpha);
+		hash.update(cpu_config.sbvh_max_duplication);
+	}
+
+	hash.update(cpu_config.sah_cost_node);
+	hash.update(cpu_config.sah_cost_leaf);
+
+	hash.update(cpu_config.enable_bvh_optimization);
+	if (cpu_config.enable_bvh_optimization) {
+		hash.update(cpu_config.bvh_optimizer_max_time);
+		hash.update(cpu_config.bvh_optimizer_max_num_batches);
+	}
+
+	hash.update(BVH::max_primitives_in_leaf());
+	hash.update(BVH::presplit_budget());
+	hash.update(cpu_config.bvh_node_order);
+}
+
+// Hashes all settings that affect the conversion of the binary BVH into a BVH4 or BVH8
+static void hash_conversion_settings(XXHash64 & hash) {
+	hash.update(cpu_config.bvh_type);
+	hash.update(get_collapse_max_primitives_in_leaf());
+}
+
+// Hashes of the contents of source files, so that a file containing multiple meshes (e.g. a Mitsuba .serialized file) is only read once
+// Every path has its own entry, so that concurrent callers wait for the first one to hash the file, while other files can be hashed in parallel
+struct SourceHash {
+	Mutex    mutex;
+	bool     is_valid = false;
+	uint64_t hash     = 0;
+};
+
+static Mutex                               source_hashes_mutex;
+static HashMap<String, OwnPtr<SourceHash>> source_hashes;
+
+static uint64_t get_source_hash(StringView filename) {
+	String filename_str = String(filename);
+
+	SourceHash * source_hash = nullptr;
+	{
+		MutexLock lock(source_hashes_mutex);
+		OwnPtr<SourceHash> & entry = source_hashes[filename_str];
+		if (!entry) {
+			entry = make_owned<SourceHash>();
+		}
+		source_hash = entry.get(); // NOTE: Entries are never removed, so the pointer remains valid when the HashMap grows
+	}
+
+	MutexLock lock(source_hash->mutex);
+	if (!source_hash->is_valid) {
+		XXHash64 hash;
+
+		OwnPtr<MappedFileAllocator> source = MappedFileAllocator::map(filename_str);
+		if (source) {
+			hash.update(source->data(), source->size());
+		}
+		source_hash->hash     = hash.digest();
+		source_hash->is_valid = true;
+	}
+	return source_hash->hash;
+}
+
+static BVHLoader::CacheEntry get_cache_entry(StringView filename, StringView name, StringView loader_params, BVHType bvh_type) {
+	XXHash64 hash;
+
+	// The path of the source file is deliberately not part of the key, only its contents
+	hash.update(get_source_hash(filename));
+	hash.update(name.data(), name.size());
+	hash.update(loader_params.size()); // Keeps the name and loader parameters apart
+	hash.update(loader_params.data(), loader_params.size());
+	hash_build_settings(hash);
+
+	if (bvh_type == BVHType::BVH4 || bvh_type == BVHType::BVH8) {
+		hash_conversion_settings(hash);
+	}
+
+	BVHLoader::CacheEntry cache_entry = { };
+	cache_entry.key      = hash.digest();
+	cache_entry.bvh_type = bvh_type;
+
+	StringView directory = cpu_config.bvh_cache_directory.size() > 0 ? cpu_config.bvh_cache_directory.view() : Util::get_directory(filename);
+	StringView separator = directory.size() > 0 && directory[directory.size() - 1] != '/' && directory[directory.size() - 1] != '\\' ? "/"_sv : ""_sv;
+	StringView name_separator = name.size() > 0 ? "."_sv : ""_sv;
+
+	cache_entry.filename = Format().format("{}{}{}{}{}.{:016x}{}"_sv,
+		directory, separator, Util::remove_directory(filename), name_separator, name, cache_entry.key, StringView::from_c_str(BVHLoader::BVH_FILE_EXTENSION));
+
+	return cache_entry;
+}
+
+BVHLoader::CacheEntry BVHLoader::get_cache_entry(StringView filename, StringView name, StringView loader_params) {
+	return ::get_cache_entry(filename, name, loader_params, cpu_config.bvh_type);
+}
+
+BVHLoader::CacheEntry BVHLoader::get_bvh2_cache_entry(StringView filename, StringView name, StringView loader_params) {
+	return ::get_cache_entry(filename, name, loader_params, cpu_config.bvh_type == BVHType::SBVH ? BVHType::SBVH : BVHType::BVH);
+}
+
+// Uncompressed BVH files store the sections below directly after the header, each starting at a multiple of SECTION_ALIGNMENT.
+// This allows them to be used in place from a memory mapped file, without any copying or decompression
+static constexpr size_t SECTION_ALIGNMENT = 64;
+
+enum struct BVHFileSection {
+	VERTICES,
+	VERTEX_INDICES,
+	CURVE_POINTS,
+	CURVE_POINT_INDICES,
+	NODES,
+	INDICES,
+
+	COUNT
+};
+
+// Computes the offset of every section in an uncompressed BVH file, returns the total file size
+static size_t get_section_offsets(const BVHFileHeader & header, size_t offsets[size_t(BVHFileSection::COUNT)]) {
+	size_t sizes[size_t(BVHFileSection::COUNT)] = { };
+	sizes[size_t(BVHFileSection::VERTICES)]            = size_t(header.num_vertices)      * sizeof(Vertex);
+	sizes[size_t(BVHFileSection::VERTEX_INDICES)]      = size_t(header.num_triangles) * 3 * sizeof(int);
+	sizes[size_t(BVHFileSection::CURVE_POINTS)]        = size_t(header.num_curve_points)  * sizeof(CurvePoint);
+	sizes[size_t(BVHFileSection::CURVE_POINT_INDICES)] = size_t(header.num_curves)        * sizeof(int);
+	sizes[size_t(BVHFileSection::NODES)]               = size_t(header.num_nodes)         * get_node_size(BVHType(header.bvh_type));
+	sizes[size_t(BVHFileSection::INDICES)]             = size_t(header.num_indices)       * sizeof(int);
+
+	size_t offset = sizeof(BVHFileHeader);
+	for (size_t i = 0; i < size_t(BVHFileSection::COUNT); i++) {
+		offset = Math::round_up(offset, SECTION_ALIGNMENT);
+		offsets[i] = offset;
+		offset += sizes[i];
+	}
+	return offset;
+}
+
+static bool load_mapped(const String & bvh_filename, const BVHFileHeader & header, MeshData * mesh_data, BVH * bvh) {
+	OwnPtr<MappedFileAllocator> mapping = MappedFileAllocator::map(bvh_filename);
+	if (!mapping) return false;
+
+	size_t offsets[size_t(BVHFileSection::COUNT)] = { };
+	size_t file_size = get_section_offsets(header, offsets);
+
+	if (mapping->size() < file_size) {
+		IO::print("WARNING: BVH file '{}' is truncated!\n"_sv, bvh_filename);
+		return false;
+	}
+
+	mesh_data->vertices            = mapping->adopt<Vertex>    (offsets[size_t(BVHFileSection::VERTICES)],            header.num_vertices);
+	mesh_data->vertex_indices      = mapping->adopt<int>       (offsets[size_t(BVHFileSection::VERTEX_INDICES)],      header.num_triangles * 3);
+	mesh_data->curve_points        = mapping->adopt<CurvePoint>(offsets[size_t(BVHFileSection::CURVE_POINTS)],        header.num_curve_points);
+	mesh_data->curve_point_indices = mapping->adopt<int>       (offsets[size_t(BVHFileSection::CURVE_POINT_INDICES)], header.num_curves);
+	bvh->indices                   = mapping->adopt<int>       (offsets[size_t(BVHFileSection::INDICES)],             header.num_indices);
+
+	visit_nodes(*bvh, BVHType(header.bvh_type), [&](auto & nodes) {
+		using Node = std::remove_reference_t<decltype(nodes[0])>;
+		nodes = mapping->adopt<Node>(offsets[size_t(BVHFileSection::NODES)], header.num_nodes);
+	});
+
+	mesh_data->mapping = std::move(mapping);
+	return true;
+}
+
+bool BVHLoader::try_to_load(const CacheEntry & cache_entry, MeshData * mesh_data) {
+	const String & bvh_filename = cache_entry.filename;
+
+	if (cpu_config.bvh_force_rebuild || !IO::file_exists(bvh_filename.view())) {
 		return false;
 	}
 
@@ -147,6 +371,7 @@ bool BVHLoader::try_to_load(const String & filename, const String & bvh_filename
 		return true;
 	};
 
+	OwnPtr<BVH> bvh = create_bvh(cache_entry.bvh_type);
 	bool success = false;
 
 	size_t header_read = fread_s(&header, sizeof(header), sizeof(BVHFileHeader), 1, file);
@@ -159,41 +384,107 @@ bool BVHLoader::try_to_load(const String & filename, const String & bvh_filename
 		goto exit;
 	}
 
-	// Check if the settings used to create the BVH file are the same as the current settings
-	if (header.underlying_bvh_type != char(BVH::underlying_bvh_type()) ||
-		header.bvh_is_optimized    != cpu_config.enable_bvh_optimization ||
-		header.sah_cost_node       != cpu_config.sah_cost_node ||
-		header.sah_cost_leaf       != cpu_config.sah_cost_leaf
-	) {
-		IO::print("BVH file '{}' was created with different settings, rebuiling BVH from scratch.\n"_sv, bvh_filename);
+	// The key includes all settings, so this only fails if the BVH file does not belong to the source file
+	if (header.cache_key != cache_entry.key || header.bvh_type != char(cache_entry.bvh_type)) {
+		IO::print("BVH file '{}' does not match its source file, rebuilding BVH from scratch.\n"_sv, bvh_filename);
 		goto exit;
 	}
 
-	mesh_data->triangles.resize(header.num_triangles);
-	bvh->nodes          .resize(header.num_nodes);
-	bvh->indices        .resize(header.num_indices);
+	if (!header.is_compressed) {
+		success = load_mapped(bvh_filename, header, mesh_data, bvh.get());
+		goto exit;
+	}
 
-	success =
-		decompress_into_buffer(Util::bit_cast<mz_uint8 *>(mesh_data->triangles.data()), mesh_data->triangles.size() * sizeof(Triangle)) &&
-		decompress_into_buffer(Util::bit_cast<mz_uint8 *>(bvh->nodes          .data()), bvh->nodes          .size() * sizeof(BVHNode2)) &&
-		decompress_into_buffer(Util::bit_cast<mz_uint8 *>(bvh->indices        .data()), bvh->indices        .size() * sizeof(int));
+	mesh_data->vertices      .resize(header.num_vertices);
+	mesh_data->vertex_indices.resize(header.num_triangles * 3);
+	mesh_data->curve_points  .resize(header.num_curve_points);
+	mesh_data->curve_point_indices.resize(header.num_curves);
+	bvh->indices             .resize(header.num_indices);
 
-	if (success) {
-		IO::print("Loaded BVH '{}' from disk\n"_sv, bvh_filename);
-	}
+	visit_nodes(*bvh.get(), BVHType(header.bvh_type), [&](auto & nodes) {
+		nodes.resize(header.num_nodes);
+
+		success =
+			decompress_into_buffer(Util::bit_cast<mz_uint8 *>(mesh_data->vertices      .data()), mesh_data->vertices      .size() * sizeof(Vertex)) &&
+			decompress_into_buffer(Util::bit_cast<mz_uint8 *>(mesh_data->vertex_indices.data()), mesh_data->vertex_indices.size() * sizeof(int)) &&
+			decompress_into_buffer(Util::bit_cast<mz_uint8 *>(mesh_data->curve_points  .data()), mesh_data->curve_points  .size() * sizeof(CurvePoint)) &&
+			decompress_into_buffer(Util::bit_cast<mz_uint8 *>(mesh_data->curve_point_indices.data()), mesh_data->curve_point_indices.size() * sizeof(int)) &&
+			decompress_into_buffer(Util::bit_cast<mz_uint8 *>(nodes                    .data()), nodes                    .size() * sizeof(nodes[0])) &&
+			decompress_into_buffer(Util::bit_cast<mz_uint8 *>(bvh->indices             .data()), bvh->indices             .size() * sizeof(int));
+	});
 
 exit:
 	fclose(file);
 
+	if (success) {
+		mesh_data->init_triangles();
+		mesh_data->init_curves();
+		mesh_data->bvh = std::move(bvh);
+
+		IO::print("Loaded BVH '{}' from disk{}\n"_sv, bvh_filename, header.is_compressed ? ""_sv : " (mapped)"_sv);
+	}
+
 	return success;
 }
 
-bool BVHLoader::save(const String & bvh_filename, const MeshData & mesh_data, const BVH2 & bvh) {
+static bool save_uncompressed(FILE * file, const BVHFileHeader & header, const MeshData & mesh_data, const BVH & bvh, const void * nodes, size_t nodes_num_bytes) {
+	size_t offsets[size_t(BVHFileSection::COUNT)] = { };
+	get_section_offsets(header, offsets);
+
+	size_t offset = sizeof(BVHFileHeader);
+
+	auto write_section = [file, &offset, &offsets](BVHFileSection section, const void * data, size_t num_bytes) -> bool {
+		// Pad up to the start of the section
+		static constexpr char zeros[SECTION_ALIGNMENT] = { };
+
+		size_t padding = offsets[size_t(section)] - offset;
+		if (padding > 0 && fwrite(zeros, sizeof(char), padding, file) != padding) {
+			return false;
+		}
+
+		if (num_bytes > 0 && fwrite(data, sizeof(char), num_bytes, file) != num_bytes) {
+			return false;
+		}
+
+		offset = offsets[size_t(section)] + num_bytes;
+		return true;
+	};
+
+	return
+		write_section(BVHFileSection::VERTICES,            mesh_data.vertices           .data(), mesh_data.vertices           .size() * sizeof(Vertex)) &&
+		write_section(BVHFileSection::VERTEX_INDICES,      mesh_data.vertex_indices     .data(), mesh_data.vertex_indices     .size() * sizeof(int)) &&
+		write_section(BVHFileSection::CURVE_POINTS,        mesh_data.curve_points       .data(), mesh_data.curve_points       .size() * sizeof(CurvePoint)) &&
+		write_section(BVHFileSection::CURVE_POINT_INDICES, mesh_data.curve_point_indices.data(), mesh_data.curve_point_indices.size() * sizeof(int)) &&
+		write_section(BVHFileSection::NODES,               nodes,                                nodes_num_bytes) &&
+		write_section(BVHFileSection::INDICES,             bvh.indices                  .data(), bvh.indices                  .size() * sizeof(int));
+}
+
+bool BVHLoader::save(const CacheEntry & cache_entry, const MeshData & mesh_data, const BVH & bvh) {
+	const String & bvh_filename = cache_entry.filename;
+
+	const void * nodes = nullptr;
+	size_t       nodes_num_bytes = 0;
+
+	visit_nodes(bvh, cache_entry.bvh_type, [&](const auto & bvh_nodes) {
+		nodes           = bvh_nodes.data();
+		nodes_num_bytes = bvh_nodes.size() * sizeof(bvh_nodes[0]);
+	});
+
+	if (cpu_config.bvh_cache_directory.size() > 0 && !IO::create_directory(cpu_config.bvh_cache_directory.view())) {
+		IO::print("WARNING: Failed to create BVH cache directory '{}'!\n"_sv, cpu_config.bvh_cache_directory);
+		return false;
+	}
+
+	// The BVH file is written to a uniquely named temporary file first and then moved into place, so that
+	// other processes that share the cache directory never observe a partially written BVH file
+	RNG rng(std::chrono::high_resolution_clock::now().time_since_epoch().count());
+	String temp_filename = Format().format("{}.{:08x}.tmp"_sv, bvh_filename, rng.get_uint32());
+
 	FILE * file = nullptr;
-	errno_t err = fopen_s(&file, bvh_filename.data(), "wb");
+	errno_t err = fopen_s(&file, temp_filename.data(), "wb");
 
 	if (!file) {
-		IO::print("WARNING: Failed to open BVH file '{}' for writing! ({})\n"_sv, bvh_filename, IO::get_error_message(err));
+		IO::print("WARNING: Failed to open BVH file '{}' for writing! ({})\n"_sv, temp_filename, IO::get_error_message(err));
 		return false;
 	}
 
@@ -203,14 +494,15 @@ bool BVHLoader::save(const String & bvh_filename, const MeshData & mesh_data, co
 	header.filetype_identifier[2] = 'H';
 	header.filetype_identifier[3] = '\0';
 	header.filetype_version = BVH_FILETYPE_VERSION;
-
-	header.underlying_bvh_type = char(BVH::underlying_bvh_type());
-	header.bvh_is_optimized    = cpu_config.enable_bvh_optimization;
-	header.sah_cost_node       = cpu_config.sah_cost_node;
-	header.sah_cost_leaf       = cpu_config.sah_cost_leaf;
-
-	header.num_triangles = mesh_data.triangles.size();
-	header.num_nodes     = bvh.nodes  .size();
+	header.is_compressed    = cpu_config.bvh_cache_compression;
+	header.bvh_type         = char(cache_entry.bvh_type);
+	header.cache_key        = cache_entry.key;
+
+	header.num_vertices     = mesh_data.vertices.size();
+	header.num_triangles    = mesh_data.triangles.size();
+	header.num_curve_points = mesh_data.curve_points.size();
+	header.num_curves       = mesh_data.curves.size();
+	header.num_nodes     = bvh.node_count();
 	header.num_indices   = bvh.indices.size();
 
 	tdefl_compressor compressor = { };
@@ -222,6 +514,14 @@ bool BVHLoader::save(const String & bvh_filename, const MeshData & mesh_data, co
 		goto exit;
 	}
 
+	if (!header.is_compressed) {
+		success = save_uncompressed(file, header, mesh_data, bvh, nodes, nodes_num_bytes);
+		if (!success) {
+			IO::print("WARNING: Failed to write to BVH file '{}'!\n"_sv, bvh_filename);
+		}
+		goto exit;
+	}
+
 	tdefl_put_buf_func_ptr file_append_compressed_data = [](const void * buf, int len, void * user) -> mz_bool {
 		size_t bytes_written = fwrite(buf, sizeof(char), len, reinterpret_cast<FILE *>(user));
 		return bytes_written == len;
@@ -234,13 +534,31 @@ bool BVHLoader::save(const String & bvh_filename, const MeshData & mesh_data, co
 		goto exit;
 	}
 
-	status = tdefl_compress_buffer(&compressor, mesh_data.triangles.data(), mesh_data.triangles.size() * sizeof(Triangle), TDEFL_NO_FLUSH);
+	status = tdefl_compress_buffer(&compressor, mesh_data.vertices.data(), mesh_data.vertices.size() * sizeof(Vertex), TDEFL_NO_FLUSH);
 	if (status != TDEFL_STATUS_OKAY) {
-		IO::print("WARNING: Failed to write compressed Triangles to BVH file '{}'!\n"_sv, bvh_filename);
+		IO::print("WARNING: Failed to write compressed Vertices to BVH file '{}'!\n"_sv, bvh_filename);
 		goto exit;
 	}
 
-	status = tdefl_compress_buffer(&compressor, bvh.nodes.data(), bvh.nodes.size() * sizeof(BVHNode2), TDEFL_NO_FLUSH);
+	status = tdefl_compress_buffer(&compressor, mesh_data.vertex_indices.data(), mesh_data.vertex_indices.size() * sizeof(int), TDEFL_NO_FLUSH);
+	if (status != TDEFL_STATUS_OKAY) {
+		IO::print("WARNING: Failed to write compressed Vertex indices to BVH file '{}'!\n"_sv, bvh_filename);
+		goto exit;
+	}
+
+	status = tdefl_compress_buffer(&compressor, mesh_data.curve_points.data(), mesh_data.curve_points.size() * sizeof(CurvePoint), TDEFL_NO_FLUSH);
+	if (status != TDEFL_STATUS_OKAY) {
+		IO::print("WARNING: Failed to write compressed Curve points to BVH file '{}'!\n"_sv, bvh_filename);
+		goto exit;
+	}
+
+	status = tdefl_compress_buffer(&compressor, mesh_data.curve_point_indices.data(), mesh_data.curve_point_indices.size() * sizeof(int), TDEFL_NO_FLUSH);
+	if (status != TDEFL_STATUS_OKAY) {
+		IO::print("WARNING: Failed to write compressed Curve point indices to BVH file '{}'!\n"_sv, bvh_filename);
+		goto exit;
+	}
+
+	status = tdefl_compress_buffer(&compressor, nodes, nodes_num_bytes, TDEFL_NO_FLUSH);
 	if (status != TDEFL_STATUS_OKAY) {
 		IO::print("WARNING: Failed to write compressed BVH nodes to BVH file '{}'!\n"_sv, bvh_filename);
 		goto exit;
@@ -256,5 +574,11 @@ bool BVHLoader::save(const String & bvh_filename, const MeshData & mesh_data, co
 
 exit:
 	fclose(file);
+
+	// Another process may have moved the same BVH file into place already, in which case the move can fail
+	if (!success || !IO::file_move(temp_filename.view(), bvh_filename.view())) {
+		IO::file_delete(temp_filename.view());
+	}
+
 	return success;
 }
@@ -11,10 +11,25 @@
 
 namespace BVHLoader {
 	inline constexpr const char * BVH_FILE_EXTENSION = ".bvh";
-	inline constexpr int          BVH_FILETYPE_VERSION = 7;
+	inline constexpr int          BVH_FILETYPE_VERSION = 16;
 
-	String get_bvh_filename(StringView filename, Allocator * allocator);
+	// BVH files are keyed by a hash of the contents of the source file and of all settings that affect the BLAS,
+	// so they stay valid when the source is copied or its modification time changes, and can be shared between machines
+	// For BVH4 and BVH8 both the final BLAS and the binary BVH it is converted from are cached, so that changing
+	// only the BVH type (or the conversion settings) requires a conversion instead of a full construction
+	struct CacheEntry {
+		String   filename;
+		uint64_t key;
+		BVHType  bvh_type; // Type of the BVH stored in the BVH file
+	};
 
-	bool try_to_load(const String & filename, const String & bvh_filename, MeshData * mesh_data, BVH2 * bvh);
-	bool save(const String & bvh_filename, const MeshData & mesh_data, const BVH2 & bvh);
+	// The name distinguishes multiple meshes that are loaded from the same source file (e.g. the shapes of a Mitsuba serialized file).
+	// Loader parameters that affect the geometry (e.g. the radius of Mitsuba hair) are passed as an opaque blob of bytes that is part of the key.
+	// The BVH file is placed in cpu_config.bvh_cache_directory, or next to the source file if no directory is configured
+	CacheEntry get_cache_entry     (StringView filename, StringView name, StringView loader_params = { }); // Final BLAS of type cpu_config.bvh_type
+	CacheEntry get_bvh2_cache_entry(StringView filename, StringView name, StringView loader_params = { }); // Binary BVH, same as above for BVH and SBVH
+
+	// On success the BVH (of the type of the CacheEntry) is stored in the MeshData
+	bool try_to_load(const CacheEntry & cache_entry, MeshData * mesh_data);
+	bool save(const CacheEntry & cache_entry, const MeshData & mesh_data, const BVH & bvh);
 }
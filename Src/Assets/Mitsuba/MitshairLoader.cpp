@@ -2,11 +2,9 @@
 
 #include "Core/Array.h"
 
-#include "Math/Quaternion.h"
+#include "Renderer/Curve.h"
 
-#include "Renderer/Triangle.h"
-
-Array<Triangle> MitshairLoader::load(const String & filename, Allocator * allocator, SourceLocation location_in_mitsuba_file, float radius) {
+Array<CurveSegment> MitshairLoader::load(const String & filename, Allocator * allocator, SourceLocation location_in_mitsuba_file, float radius) {
 	String file = IO::file_read(filename, allocator);
 
 	Parser parser(file.view(), filename.view());
@@ -47,14 +45,8 @@ Array<Triangle> MitshairLoader::load(const String & filename, Allocator * alloca
 		}
 	}
 
-	Array<Triangle> triangles;
-
-	struct Segment {
-		Vector3 begin;
-		Vector3 end;
-	};
-	Segment prev_segment = { };
-	Segment curr_segment = { };
+	Array<CurveSegment> curves;
+	curves.reserve(hair_vertices.size());
 
 	size_t hair_index = 0;
 
@@ -69,52 +61,14 @@ Array<Triangle> MitshairLoader::load(const String & filename, Allocator * alloca
 			continue;
 		}
 
-		float angle = PI * float(rand()) / float(RAND_MAX);
-
-		Vector3 direction  = Vector3::normalize(strand[1] - strand[0]);
-		Vector3 orthogonal = Quaternion::axis_angle(direction, angle) * Math::orthogonal(direction);
-
-		prev_segment.begin = strand[0] + radius * orthogonal;
-		prev_segment.end   = strand[0] - radius * orthogonal;
-
 		for (int v = 1; v < strand_size; v++) {
-			Vector3 direction = Vector3::normalize(strand[v] - strand[v-1]);
-			Vector3 orthogonal;
-			if (isnan(direction.x + direction.y + direction.z)) {
-				orthogonal = Vector3(1.0f, 0.0f, 0.0f);
-			} else {
-				orthogonal = Quaternion::axis_angle(direction, angle) * Math::orthogonal(direction);
-			}
-
-			float r = Math::lerp(radius, 0.0f, float(v) / float(strand_size - 1));
-			curr_segment.begin = strand[v] + r * orthogonal;
-			curr_segment.end   = strand[v] - r * orthogonal;
-
-			triangles.emplace_back(
-				prev_segment.begin,
-				prev_segment.end,
-				curr_segment.begin,
-				Vector3(0.0f),
-				Vector3(0.0f),
-				Vector3(0.0f),
-				Vector2(0.0f, 0.0f),
-				Vector2(1.0f, 0.0f),
-				Vector2(0.0f, 1.0f)
-			);
-			triangles.emplace_back(
-				prev_segment.end,
-				curr_segment.end,
-				curr_segment.begin,
-				Vector3(0.0f),
-				Vector3(0.0f),
-				Vector3(0.0f),
-				Vector2(0.0f, 0.0f),
-				Vector2(1.0f, 0.0f),
-				Vector2(0.0f, 1.0f)
-			);
-			prev_segment = curr_segment;
+			CurveSegment & curve = curves.emplace_back();
+			curve.position_0 = strand[v-1];
+			curve.radius_0   = Math::lerp(radius, 0.0f, float(v-1) / float(strand_size - 1));
+			curve.position_1 = strand[v];
+			curve.radius_1   = Math::lerp(radius, 0.0f, float(v)   / float(strand_size - 1));
 		}
 	}
 
-	return triangles;
+	return curves;
 }
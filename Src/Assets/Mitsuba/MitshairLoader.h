@@ -2,8 +2,9 @@
 #include "Core/Array.h"
 #include "Core/Parser.h"
 
-struct Triangle;
+struct CurveSegment;
 
 namespace MitshairLoader {
-	Array<Triangle> load(const String & filename, Allocator * allocator, SourceLocation location_in_mitsuba_file, float radius);
+	// Every hair strand becomes a Curve, its radius tapers linearly from 'radius' at the root to zero at the tip
+	Array<CurveSegment> load(const String & filename, Allocator * allocator, SourceLocation location_in_mitsuba_file, float radius);
 }
@@ -4,6 +4,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <memory>
+
 #include "Core/Array.h"
 #include "Core/HashMap.h"
 #include "Core/Format.h"
@@ -33,6 +35,9 @@ using ShapeGroupMap = HashMap<String, ShapeGroup>;
 using MaterialMap   = HashMap<String, Handle<Material>>;
 using TextureMap    = HashMap<String, Handle<Texture>>;
 
+// Serialized Files are shared with the fallback loaders of all shapes that refer to them, which run asynchronously
+using SerializedMap = HashMap<String, std::shared_ptr<SerializedLoader::File>>;
+
 static Handle<Texture> parse_texture(const XMLNode * node, TextureMap & texture_map, StringView path, Scene & scene, Vector3 * rgb) {
 	StringView type = node->get_attribute_value("type");
 
@@ -428,7 +433,7 @@ static Handle<Medium> parse_medium(const XMLNode * node, Scene & scene) {
 	return Handle<Medium> { INVALID };
 }
 
-static Handle<MeshData> parse_shape(const XMLNode * node, Allocator * allocator, Scene & scene, StringView path, String * name) {
+static Handle<MeshData> parse_shape(const XMLNode * node, Allocator * allocator, Scene & scene, SerializedMap & serialized_map, StringView path, String * name) {
 	StringView type = node->get_attribute_value<StringView>("type");
 
 	if (type == "obj" || type == "ply") {
@@ -492,12 +497,17 @@ static Handle<MeshData> parse_shape(const XMLNode * node, Allocator * allocator,
 
 		*name = Format(scene.allocator).format("{}_{}"_sv, filename_rel, shape_index);
 
-		String bvh_filename = Format().format("{}.shape_{}.bvh"_sv, filename_abs, shape_index);
+		String shape_name = Format().format("shape_{}"_sv, shape_index);
 
-		auto fallback_loader = [filename_abs = std::move(filename_abs), location = node->location, shape_index](const String & filename, Allocator * allocator) {
-			return SerializedLoader::load(filename_abs, allocator, location, shape_index);
+		std::shared_ptr<SerializedLoader::File> & file = serialized_map[filename_abs];
+		if (!file) {
+			file = std::make_shared<SerializedLoader::File>();
+		}
+
+		auto fallback_loader = [location = node->location, shape_index, file](const String & filename, Allocator * allocator) {
+			return SerializedLoader::load(filename, *file, allocator, location, shape_index);
 		};
-		return scene.asset_manager.add_mesh_data(bvh_filename, bvh_filename, fallback_loader);
+		return scene.asset_manager.add_mesh_data(std::move(filename_abs), shape_name.view(), fallback_loader);
 	} else if (type == "hair") {
 		StringView filename_rel = node->get_child_value<StringView>("filename");
 		String     filename_abs = Util::combine_stringviews(path, filename_rel, scene.allocator);
@@ -509,14 +519,17 @@ static Handle<MeshData> parse_shape(const XMLNode * node, Allocator * allocator,
 		auto fallback_loader = [location = node->location, radius](const String & filename, Allocator * allocator) {
 			return MitshairLoader::load(filename, allocator, location, radius);
 		};
-		return scene.asset_manager.add_mesh_data(filename_abs, fallback_loader);
+		// The radius is not stored in the hair file, so it needs to be part of the key of the cached BVH
+		StringView loader_params = StringView::from_c_str(reinterpret_cast<const char *>(&radius), sizeof(radius));
+
+		return scene.asset_manager.add_curve_mesh_data(filename_abs, loader_params, fallback_loader);
 	} else {
 		WARNING(node->location, "WARNING: Shape type '{}' not supported!\n", type);
 		return Handle<MeshData> { INVALID };
 	}
 }
 
-static void walk_xml_tree(const XMLNode * node, Allocator * allocator, Scene & scene, ShapeGroupMap & shape_group_map, MaterialMap & material_map, TextureMap & texture_map, StringView path) {
+static void walk_xml_tree(const XMLNode * node, Allocator * allocator, Scene & scene, ShapeGroupMap & shape_group_map, MaterialMap & material_map, TextureMap & texture_map, SerializedMap & serialized_map, StringView path) {
 	if (node->tag == "bsdf") {
 		Handle<Material> material_handle = parse_material(node, scene, material_map, texture_map, path);
 		const Material & material = scene.asset_manager.get_material(material_handle);
@@ -536,7 +549,7 @@ static void walk_xml_tree(const XMLNode * node, Allocator * allocator, Scene & s
 
 				String name = { };
 
-				Handle<MeshData> mesh_data_handle = parse_shape(shape, allocator, scene, path, &name);
+				Handle<MeshData> mesh_data_handle = parse_shape(shape, allocator, scene, serialized_map, path, &name);
 				Handle<Material> material_handle  = parse_material(shape, scene, material_map, texture_map, path);
 
 				StringView id = node->get_attribute_value<StringView>("id");
@@ -558,7 +571,7 @@ static void walk_xml_tree(const XMLNode * node, Allocator * allocator, Scene & s
 		} else {
 			String name = { };
 
-			Handle<MeshData> mesh_data_handle = parse_shape(node, allocator, scene, path, &name);
+			Handle<MeshData> mesh_data_handle = parse_shape(node, allocator, scene, serialized_map, path, &name);
 			Handle<Material> material_handle  = parse_material(node, scene, material_map, texture_map, path);
 			Handle<Medium>   medium_handle    = parse_medium(node, scene);
 
@@ -666,7 +679,7 @@ static void walk_xml_tree(const XMLNode * node, Allocator * allocator, Scene & s
 
 		MitsubaLoader::load(filename_abs, allocator, scene);
 	} else for (int i = 0; i < node->children.size(); i++) {
-		walk_xml_tree(&node->children[i], allocator, scene, shape_group_map, material_map, texture_map, path);
+		walk_xml_tree(&node->children[i], allocator, scene, shape_group_map, material_map, texture_map, serialized_map, path);
 	}
 }
 
@@ -697,5 +710,6 @@ void MitsubaLoader::load(const String & filename, Allocator * allocator, Scene &
 	ShapeGroupMap shape_group_map(allocator);
 	MaterialMap   material_map   (allocator);
 	TextureMap    texture_map    (allocator);
-	walk_xml_tree(scene_node, allocator, scene, shape_group_map, material_map, texture_map, Util::get_directory(filename.view()));
+	SerializedMap serialized_map (allocator);
+	walk_xml_tree(scene_node, allocator, scene, shape_group_map, material_map, texture_map, serialized_map, Util::get_directory(filename.view()));
 }
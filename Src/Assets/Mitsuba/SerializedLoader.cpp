@@ -6,44 +6,65 @@
 
 #include "XMLParser.h"
 
-Array<Triangle> SerializedLoader::load(const String & filename, Allocator * allocator, SourceLocation location_in_mitsuba_file, int shape_index) {
-	String serialized = IO::file_read(filename, allocator);
-	Parser serialized_parser(serialized.view(), filename.view());
+static void open_file(const String & filename, SerializedLoader::File & file, SourceLocation location_in_mitsuba_file) {
+	file.mapping = MappedFileAllocator::map(filename);
+	if (!file.mapping) {
+		ERROR(location_in_mitsuba_file, "ERROR: Failed to open serialized file '{}'!\n", filename);
+	}
+
+	size_t serialized_size = file.mapping->size();
+	Parser serialized_parser(StringView { file.mapping->data(), file.mapping->data() + serialized_size }, filename.view());
 
 	uint16_t file_format_id = serialized_parser.parse_binary<uint16_t>();
 	if (file_format_id != 0x041c) {
 		ERROR(location_in_mitsuba_file, "ERROR: Serialized file '{}' does not start with format ID 0x041c!\n", filename);
 	}
 
-	uint16_t file_version = serialized_parser.parse_binary<uint16_t>();
+	file.file_version = serialized_parser.parse_binary<uint16_t>();
 
 	// Read the End-of-File Dictionary
-	serialized_parser.seek(serialized.size() - sizeof(uint32_t));
+	serialized_parser.seek(serialized_size - sizeof(uint32_t));
 	uint32_t num_meshes = serialized_parser.parse_binary<uint32_t>();
-	uint64_t eof_dictionary_offset = 0;;
+	uint64_t eof_dictionary_offset = 0;
 
-	Array<uint64_t> mesh_offsets(num_meshes + 1, allocator);
+	file.mesh_offsets.resize(num_meshes + 1);
 
-	if (file_version <= 3) {
+	if (file.file_version <= 3) {
 		// Version 0.3.0 and earlier use 32 bit mesh offsets
-		eof_dictionary_offset = serialized.size() - sizeof(uint32_t) - num_meshes * sizeof(uint32_t);
+		eof_dictionary_offset = serialized_size - sizeof(uint32_t) - num_meshes * sizeof(uint32_t);
 		serialized_parser.seek(eof_dictionary_offset);
 
 		for (uint32_t i = 0; i < num_meshes; i++) {
-			mesh_offsets[i] = serialized_parser.parse_binary<uint32_t>();
+			file.mesh_offsets[i] = serialized_parser.parse_binary<uint32_t>();
 		}
 	} else {
 		// Version 0.4.0 and later use 64 bit mesh offsets
-		eof_dictionary_offset = serialized.size() - sizeof(uint32_t) - num_meshes * sizeof(uint64_t);
+		eof_dictionary_offset = serialized_size - sizeof(uint32_t) - num_meshes * sizeof(uint64_t);
 		serialized_parser.seek(eof_dictionary_offset);
 
 		for (uint32_t i = 0; i < num_meshes; i++) {
-			mesh_offsets[i] = serialized_parser.parse_binary<uint64_t>();
+			file.mesh_offsets[i] = serialized_parser.parse_binary<uint64_t>();
+		}
+	}
+
+	file.mesh_offsets[num_meshes] = eof_dictionary_offset;
+	ASSERT(file.mesh_offsets[0] == 0);
+}
+
+Array<Triangle> SerializedLoader::load(const String & filename, File & file, Allocator * allocator, SourceLocation location_in_mitsuba_file, int shape_index) {
+	{
+		MutexLock lock(file.mutex);
+		if (!file.mapping) {
+			open_file(filename, file, location_in_mitsuba_file);
 		}
 	}
 
-	mesh_offsets[num_meshes] = eof_dictionary_offset;
-	ASSERT(mesh_offsets[0] == 0);
+	uint16_t                file_version = file.file_version;
+	const Array<uint64_t> & mesh_offsets = file.mesh_offsets;
+
+	if (shape_index < 0 || size_t(shape_index) + 1 >= mesh_offsets.size()) {
+		ERROR(location_in_mitsuba_file, "ERROR: Serialized file '{}' does not contain shape #{}!\n", filename, shape_index);
+	}
 
 	// Decompress stream for this Mesh
 	mz_ulong num_bytes = mesh_offsets[shape_index + 1] - mesh_offsets[shape_index] - 4;
@@ -56,7 +77,7 @@ Array<Triangle> SerializedLoader::load(const String & filename, Allocator * allo
 
 		int status = uncompress(
 			reinterpret_cast<      unsigned char *>(deserialized.data()), &deserialized_length,
-			reinterpret_cast<const unsigned char *>(serialized.data() + mesh_offsets[shape_index] + 4), num_bytes
+			reinterpret_cast<const unsigned char *>(file.mapping->data() + mesh_offsets[shape_index] + 4), num_bytes
 		);
 
 		if (status == MZ_BUF_ERROR) {
@@ -1,10 +1,24 @@
 #pragma once
 #include <stdint.h>
 
+#include "Core/Mutex.h"
 #include "Core/Parser.h"
+#include "Core/Allocators/MappedFileAllocator.h"
 
 struct Triangle;
 
 namespace SerializedLoader {
-	Array<Triangle> load(const String & filename, Allocator * allocator, SourceLocation location_in_mitsuba_file, int shape_index);
+	// A .serialized file usually contains many shapes. A File is shared by all shapes that refer to it, so that the file
+	// is mapped and its End-of-File Dictionary is parsed only once, when the first of them is loaded
+	struct File {
+		Mutex mutex;
+
+		OwnPtr<MappedFileAllocator> mapping; // nullptr until the first shape is loaded
+
+		uint16_t        file_version;
+		Array<uint64_t> mesh_offsets;
+	};
+
+	// Can be called concurrently for different shapes in the same File
+	Array<Triangle> load(const String & filename, File & file, Allocator * allocator, SourceLocation location_in_mitsuba_file, int shape_index);
 }
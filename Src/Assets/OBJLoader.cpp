@@ -1,12 +1,20 @@
 #include "OBJLoader.h"
 
+#include "Config.h"
+
 #include "Core/Array.h"
 #include "Core/Parser.h"
 #include "Core/String.h"
+#include "Core/Allocators/MappedFileAllocator.h"
 
 #include "Math/Vector2.h"
 #include "Math/Vector3.h"
 
+#include "Util/ThreadPool.h"
+
+// The file is split into chunks at line boundaries, which are parsed independently
+static constexpr size_t CHUNK_SIZE = MEGABYTES(1);
+
 static float parse_float(Parser & parser) {
 	parser.skip_whitespace();
 	return parser.parse_float();
@@ -31,25 +39,40 @@ static Vector3 parse_vector3(Parser & parser) {
 }
 
 struct Index {
-	int v, t, n; // Position, texcoord, normal indices
+	int v, t, n; // Position, texcoord, normal indices. Absolute and 0-based after parsing, INVALID if not specified
 };
 
 struct Face {
 	Index indices[3]; // Always a triangular face
 };
 
-static Index parse_index(Parser & parser) {
-	Index index = { };
+// Number of positions, texcoords, and normals that were defined before the current line, including those in previous chunks
+struct Counts {
+	int v, t, n;
+};
 
-	index.v = parse_int(parser);
+// OBJ indices are 1-based, negative indices are relative to the elements defined so far
+static int resolve_index(int index, int count) {
+	if (index > 0) {
+		return index - 1;
+	} else if (index < 0) {
+		return count + index;
+	}
+	return INVALID;
+}
+
+static Index parse_index(Parser & parser, const Counts & counts) {
+	Index index = { INVALID, INVALID, INVALID };
+
+	index.v = resolve_index(parse_int(parser), counts.v);
 
 	if (parser.match('/')) {
 		if (parser.match('/')) {
-			index.n = parse_int(parser);
+			index.n = resolve_index(parse_int(parser), counts.n);
 		} else {
-			index.t = parse_int(parser);
+			index.t = resolve_index(parse_int(parser), counts.t);
 			if (parser.match('/')) {
-				index.n = parse_int(parser);
+				index.n = resolve_index(parse_int(parser), counts.n);
 			}
 		}
 	}
@@ -83,11 +106,11 @@ static Vector3 parse_vn(Parser & parser) {
 	return parse_vector3(parser);
 }
 
-static void parse_face(Parser & parser, Array<Face> & faces) {
+static void parse_face(Parser & parser, const Counts & counts, Array<Face> & faces) {
 	// Parse first triangular face
-	Index index_0 = parse_index(parser);
-	Index index_1 = parse_index(parser);
-	Index index_2 = parse_index(parser);
+	Index index_0 = parse_index(parser, counts);
+	Index index_1 = parse_index(parser, counts);
+	Index index_2 = parse_index(parser, counts);
 	faces.emplace_back(index_0, index_1, index_2);
 
 	// Triangulate any further vertices in the face
@@ -98,21 +121,37 @@ static void parse_face(Parser & parser, Array<Face> & faces) {
 
 		if (parser.reached_end() || !(*parser.cur == '-' || is_digit(*parser.cur))) break;
 
-		Index curr_index = parse_index(parser);
+		Index curr_index = parse_index(parser, counts);
 		faces.emplace_back(index_0, prev_index, curr_index);
 
 		prev_index = curr_index;
 	}
 }
 
+struct OBJChunk {
+	StringView source;
+
+	// Number of lines and elements in this chunk
+	int    line_count;
+	Counts counts;
+
+	// Number of lines and elements in all previous chunks
+	int    line_offset;
+	Counts offsets;
+	size_t face_offset;
+
+	Array<Face> faces;
+};
+
 struct OBJFile {
 	Array<Vector3> positions;
 	Array<Vector2> tex_coords;
 	Array<Vector3> normals;
 
-	Array<Face> faces;
+	Array<OBJChunk> chunks;
+	size_t          face_count = 0;
 
-	OBJFile(Allocator * allocator = nullptr) : positions(allocator), tex_coords(allocator), normals(allocator), faces(allocator) { }
+	OBJFile(Allocator * allocator = nullptr) : positions(allocator), tex_coords(allocator), normals(allocator), chunks(allocator) { }
 
 	DEFAULT_COPYABLE(OBJFile);
 	DEFAULT_MOVEABLE(OBJFile);
@@ -120,12 +159,77 @@ struct OBJFile {
 	~OBJFile() { }
 };
 
-static OBJFile parse_obj(const String & filename, Allocator * allocator) {
-	String file = IO::file_read(filename, allocator);
+template<typename Work>
+static void for_each_chunk(int chunk_count, Work && work) {
+	bool parallel =
+		cpu_config.enable_parallel_mesh_parsing &&
+		ThreadPool::get_thread_count() > 0 &&
+		chunk_count > 1;
+
+	if (parallel) {
+		ThreadPool::parallel_for(chunk_count, work);
+	} else {
+		for (int chunk = 0; chunk < chunk_count; chunk++) {
+			work(chunk);
+		}
+	}
+}
+
+// Splits the source into chunks of roughly CHUNK_SIZE bytes, each ending directly after a newline
+static Array<OBJChunk> split_chunks(StringView source, Allocator * allocator) {
+	Array<OBJChunk> chunks(allocator);
 
-	OBJFile obj = OBJFile(allocator);
+	const char * chunk_start = source.start;
+	while (chunk_start < source.end) {
+		const char * chunk_end = chunk_start + Math::min(CHUNK_SIZE, size_t(source.end - chunk_start));
+
+		const char * newline = static_cast<const char *>(memchr(chunk_end - 1, '\n', source.end - (chunk_end - 1)));
+		chunk_end = newline ? newline + 1 : source.end;
+
+		OBJChunk & chunk = chunks.emplace_back();
+		chunk.source = StringView { chunk_start, chunk_end };
+
+		chunk_start = chunk_end;
+	}
+
+	return chunks;
+}
 
-	Parser parser(file.view(), filename.view());
+// Counts the lines and the v/vt/vn records in the chunk, so that the offsets of all chunks are known before parsing
+static void count_chunk(OBJChunk & chunk) {
+	chunk.line_count = 0;
+	chunk.counts     = { };
+
+	const char * cur = chunk.source.start;
+	const char * end = chunk.source.end;
+
+	while (cur < end) {
+		const char * line_end = static_cast<const char *>(memchr(cur, '\n', end - cur));
+		if (!line_end) {
+			line_end = end;
+		}
+
+		// Matches the order in which parse_chunk() tries the record types
+		size_t length = line_end - cur;
+		if (length >= 2 && cur[0] == 'v') {
+			if (cur[1] == ' ') {
+				chunk.counts.v++;
+			} else if (length >= 3 && cur[2] == ' ') {
+				if (cur[1] == 't') chunk.counts.t++;
+				if (cur[1] == 'n') chunk.counts.n++;
+			}
+		}
+
+		chunk.line_count++;
+		cur = line_end + 1;
+	}
+}
+
+// Parses the chunk, vertex data is written directly into the (presized) Arrays of the OBJFile at the offsets of the chunk
+static void parse_chunk(OBJChunk & chunk, const String & filename, OBJFile & obj) {
+	Parser parser(chunk.source, SourceLocation { filename.view(), 1 + chunk.line_offset, 0 });
+
+	Counts counts = chunk.offsets;
 
 	while (!parser.reached_end()) {
 		if (parser.match('#') || parser.match("o ")) {
@@ -133,10 +237,10 @@ static OBJFile parse_obj(const String & filename, Allocator * allocator) {
 				parser.advance();
 			}
 		}
-		else if (parser.match("v "))  obj.positions .push_back(parse_v (parser));
-		else if (parser.match("vt ")) obj.tex_coords.push_back(parse_vt(parser));
-		else if (parser.match("vn ")) obj.normals   .push_back(parse_vn(parser));
-		else if (parser.match("f "))  parse_face(parser, obj.faces);
+		else if (parser.match("v "))  obj.positions [counts.v++] = parse_v (parser);
+		else if (parser.match("vt ")) obj.tex_coords[counts.t++] = parse_vt(parser);
+		else if (parser.match("vn ")) obj.normals   [counts.n++] = parse_vn(parser);
+		else if (parser.match("f "))  parse_face(parser, counts, chunk.faces);
 		else {
 			while (!parser.reached_end() && !is_newline(*parser.cur)) {
 				parser.advance();
@@ -147,73 +251,111 @@ static OBJFile parse_obj(const String & filename, Allocator * allocator) {
 		parser.match('\r');
 		parser.expect('\n');
 	}
+}
+
+static OBJFile parse_obj(const String & filename, StringView source, Allocator * allocator) {
+	OBJFile obj = OBJFile(allocator);
+	obj.chunks = split_chunks(source, allocator);
+
+	int chunk_count = int(obj.chunks.size());
+
+	for_each_chunk(chunk_count, [&](int c) {
+		count_chunk(obj.chunks[c]);
+	});
+
+	int    line_offset = 0;
+	Counts offsets     = { };
+
+	for (int c = 0; c < chunk_count; c++) {
+		OBJChunk & chunk = obj.chunks[c];
+		chunk.line_offset = line_offset;
+		chunk.offsets     = offsets;
+
+		line_offset += chunk.line_count;
+		offsets.v   += chunk.counts.v;
+		offsets.t   += chunk.counts.t;
+		offsets.n   += chunk.counts.n;
+	}
+
+	obj.positions .resize(offsets.v);
+	obj.tex_coords.resize(offsets.t);
+	obj.normals   .resize(offsets.n);
+
+	for_each_chunk(chunk_count, [&](int c) {
+		parse_chunk(obj.chunks[c], filename, obj);
+	});
+
+	for (int c = 0; c < chunk_count; c++) {
+		obj.chunks[c].face_offset = obj.face_count;
+		obj.face_count += obj.chunks[c].faces.size();
+	}
 
 	return obj;
 }
 
-Array<Triangle> OBJLoader::load(const String & filename, Allocator * allocator) {
-	OBJFile obj = parse_obj(filename, allocator);
-
-	Array<Triangle> triangles(obj.faces.size());
-
-	for (int f = 0; f < obj.faces.size(); f++) {
-		const Face & face = obj.faces[f];
-
-		Vector3 positions [3] = { };
-		Vector2 tex_coords[3] = { };
-		Vector3 normals   [3] = { };
-
-		for (int i = 0; i < 3; i++) {
-			int v = face.indices[i].v;
-			int t = face.indices[i].t;
-			int n = face.indices[i].n;
-
-			auto get_index = [](int array_size, int index) {
-				int result = INVALID;
-				if (array_size != 0) {
-					if (index > 0) {
-						result = index - 1;
-					} else if (index < 0) {
-						result = array_size + index; // Negative indices are relative to end
-					}
-
-					// Check if the index is valid given the Array size
-					if (result < 0 || result >= array_size) {
-						result = INVALID;
-					}
-				}
-				return result;
-			};
-
-			int index_v = get_index(int(obj.positions .size()), v);
-			int index_t = get_index(int(obj.tex_coords.size()), t);
-			int index_n = get_index(int(obj.normals   .size()), n);
-
-			if (index_v != INVALID) {
-				positions[i] = obj.positions[index_v];
-			}
-			if (index_t != INVALID) {
-				tex_coords[i] = obj.tex_coords[index_t];
-				tex_coords[i].y = 1.0f - tex_coords[i].y; // Flip uv along v
-			}
-			if (index_n != INVALID) {
-				normals[i] = obj.normals[index_n];
-			}
+static Triangle face_to_triangle(const OBJFile & obj, const Face & face) {
+	Vector3 positions [3] = { };
+	Vector2 tex_coords[3] = { };
+	Vector3 normals   [3] = { };
+
+	for (int i = 0; i < 3; i++) {
+		int index_v = face.indices[i].v;
+		int index_t = face.indices[i].t;
+		int index_n = face.indices[i].n;
+
+		// Check if the indices are valid given the Array sizes
+		if (index_v >= 0 && index_v < obj.positions.size()) {
+			positions[i] = obj.positions[index_v];
+		}
+		if (index_t >= 0 && index_t < obj.tex_coords.size()) {
+			tex_coords[i] = obj.tex_coords[index_t];
+			tex_coords[i].y = 1.0f - tex_coords[i].y; // Flip uv along v
 		}
+		if (index_n >= 0 && index_n < obj.normals.size()) {
+			normals[i] = obj.normals[index_n];
+		}
+	}
 
-		triangles[f] = Triangle(
-			positions[0],
-			positions[1],
-			positions[2],
-			normals[0],
-			normals[1],
-			normals[2],
-			tex_coords[0],
-			tex_coords[1],
-			tex_coords[2]
-		);
+	return Triangle(
+		positions[0],
+		positions[1],
+		positions[2],
+		normals[0],
+		normals[1],
+		normals[2],
+		tex_coords[0],
+		tex_coords[1],
+		tex_coords[2]
+	);
+}
+
+Array<Triangle> OBJLoader::load(const String & filename, Allocator * allocator) {
+	// The file is parsed in place from a memory mapping. The Parser may look one character past the end of the last line,
+	// so if the file does not end in a newline it is read into a (null terminated) String instead
+	OwnPtr<MappedFileAllocator> mapping = MappedFileAllocator::map(filename);
+
+	String     file;
+	StringView source;
+
+	if (mapping && mapping->data()[mapping->size() - 1] == '\n') {
+		source = StringView { mapping->data(), mapping->data() + mapping->size() };
+	} else {
+		file   = IO::file_read(filename, allocator);
+		source = file.view();
 	}
 
+	OBJFile obj = parse_obj(filename, source, allocator);
+
+	Array<Triangle> triangles(obj.face_count);
+
+	for_each_chunk(int(obj.chunks.size()), [&](int c) {
+		const OBJChunk & chunk = obj.chunks[c];
+
+		for (size_t f = 0; f < chunk.faces.size(); f++) {
+			triangles[chunk.face_offset + f] = face_to_triangle(obj, chunk.faces[f]);
+		}
+	});
+
 	IO::print("Loaded OBJ '{}' from disk ({} triangles)\n"_sv, filename, triangles.size());
 
 	return triangles;
@@ -1,9 +1,15 @@
 #include "PLYLoader.h"
 
+#include <atomic>
+
+#include "Config.h"
+
 #include "Core/Array.h"
 #include "Core/Parser.h"
 #include "Core/StringView.h"
 
+#include "Util/ThreadPool.h"
+
 enum struct PLYFormat {
 	ASCII,
 	BINARY_LITTLE_ENDIAN,
@@ -148,6 +154,193 @@ static T parse_property_value(Parser & parser, Property::Type::Kind kind, PLYFor
 	}
 }
 
+// Binary Elements with a fixed size are decoded in bulk, in chunks of this many Elements
+static constexpr int BULK_CHUNK_SIZE = 64 * 1024;
+
+template<typename Work>
+static void for_each_chunk(int count, Work && work) {
+	int chunk_count = (count + BULK_CHUNK_SIZE - 1) / BULK_CHUNK_SIZE;
+
+	bool parallel =
+		cpu_config.enable_parallel_mesh_parsing &&
+		ThreadPool::get_thread_count() > 0 &&
+		chunk_count > 1;
+
+	auto work_chunk = [count, &work](int chunk) {
+		int first = chunk * BULK_CHUNK_SIZE;
+		int last  = Math::min(first + BULK_CHUNK_SIZE, count);
+		work(first, last);
+	};
+
+	if (parallel) {
+		ThreadPool::parallel_for(chunk_count, work_chunk);
+	} else {
+		for (int chunk = 0; chunk < chunk_count; chunk++) {
+			work_chunk(chunk);
+		}
+	}
+}
+
+// Returns 0 for lists, since their size varies
+static int get_type_size(Property::Type::Kind kind) {
+	switch (kind) {
+		case Property::Type::Kind::INT8:
+		case Property::Type::Kind::UINT8:   return 1;
+		case Property::Type::Kind::INT16:
+		case Property::Type::Kind::UINT16:  return 2;
+		case Property::Type::Kind::INT32:
+		case Property::Type::Kind::UINT32:
+		case Property::Type::Kind::FLOAT32: return 4;
+		case Property::Type::Kind::FLOAT64: return 8;
+		default: return 0;
+	}
+}
+
+template<PLYFormat Format>
+static uint32_t load_uint32(const char * src) {
+	uint32_t value;
+	memcpy(&value, src, sizeof(value));
+
+	// NOTE: Assumes machine is little endian!
+	if constexpr (Format == PLYFormat::BINARY_BIG_ENDIAN) {
+		value = _byteswap_ulong(value);
+	}
+	return value;
+}
+
+template<PLYFormat Format>
+static void decode_vertices(const char * data, size_t stride, const int offsets[8], int first, int last, Vector3 * positions, Vector3 * normals, Vector2 * tex_coords) {
+	for (int i = first; i < last; i++) {
+		const char * vertex = data + size_t(i) * stride;
+
+		float values[8] = { }; // x, y, z, nx, ny, nz, u, v
+		for (int k = 0; k < 8; k++) {
+			if (offsets[k] != INVALID) {
+				values[k] = Util::bit_cast<float>(load_uint32<Format>(vertex + offsets[k]));
+			}
+		}
+
+		positions [i] = Vector3(values[0], values[1], values[2]);
+		normals   [i] = Vector3(values[3], values[4], values[5]);
+		tex_coords[i] = Vector2(values[6], 1.0f - values[7]);
+	}
+}
+
+// Decodes all vertices at once if all of their properties have a fixed size and the used properties are floats, returns false otherwise
+static bool try_decode_vertices_bulk(Parser & parser, const Element & element, PLYFormat format, Array<Vector3> & positions, Array<Vector3> & normals, Array<Vector2> & tex_coords) {
+	if (format == PLYFormat::ASCII) return false;
+
+	int    offsets[8] = { INVALID, INVALID, INVALID, INVALID, INVALID, INVALID, INVALID, INVALID };
+	size_t stride = 0;
+
+	for (int p = 0; p < element.property_count; p++) {
+		const Property & property = element.properties[p];
+
+		int size = get_type_size(property.type.kind);
+		if (size == 0) return false;
+
+		if (int(property.kind) < int(Property::Kind::IGNORED)) {
+			if (property.type.kind != Property::Type::Kind::FLOAT32) return false;
+
+			offsets[int(property.kind)] = int(stride);
+		}
+		stride += size;
+	}
+
+	if (size_t(parser.end - parser.cur) < size_t(element.count) * stride) {
+		ERROR(parser.location, "Unexpected end of file, expected {} vertices!\n", element.count);
+	}
+
+	size_t offset = positions.size();
+	positions .resize(offset + element.count);
+	normals   .resize(offset + element.count);
+	tex_coords.resize(offset + element.count);
+
+	const char * data = parser.cur;
+
+	for_each_chunk(element.count, [&](int first, int last) {
+		if (format == PLYFormat::BINARY_LITTLE_ENDIAN) {
+			decode_vertices<PLYFormat::BINARY_LITTLE_ENDIAN>(data, stride, offsets, first, last, positions.data() + offset, normals.data() + offset, tex_coords.data() + offset);
+		} else {
+			decode_vertices<PLYFormat::BINARY_BIG_ENDIAN>   (data, stride, offsets, first, last, positions.data() + offset, normals.data() + offset, tex_coords.data() + offset);
+		}
+	});
+
+	parser.cur += size_t(element.count) * stride;
+	return true;
+}
+
+template<PLYFormat Format>
+static void decode_triangles(const char * data, int first, int last, const Array<Vector3> & positions, const Array<Vector3> & normals, const Array<Vector2> & tex_coords, Triangle * triangles, std::atomic<bool> & is_triangle_list, std::atomic<bool> & is_in_bounds) {
+	constexpr size_t STRIDE = 1 + 3 * sizeof(uint32_t);
+
+	for (int i = first; i < last; i++) {
+		const char * face = data + size_t(i) * STRIDE;
+
+		if (face[0] != 3) {
+			is_triangle_list = false;
+			return;
+		}
+
+		uint32_t index_0 = load_uint32<Format>(face + 1);
+		uint32_t index_1 = load_uint32<Format>(face + 5);
+		uint32_t index_2 = load_uint32<Format>(face + 9);
+
+		// Negative int32 indices wrap around and are rejected here as well
+		if (index_0 >= positions.size() || index_1 >= positions.size() || index_2 >= positions.size()) {
+			is_in_bounds = false;
+			return;
+		}
+
+		triangles[i] = Triangle(
+			positions [index_0], positions [index_1], positions [index_2],
+			normals   [index_0], normals   [index_1], normals   [index_2],
+			tex_coords[index_0], tex_coords[index_1], tex_coords[index_2]
+		);
+	}
+}
+
+// Decodes all faces at once if they consist of a single vertex index list with a uchar size and int/uint indices, and all faces are Triangles.
+// Returns false otherwise, in which case nothing was consumed and the generic path handles the faces
+static bool try_decode_faces_bulk(Parser & parser, const Element & element, PLYFormat format, const Array<Vector3> & positions, const Array<Vector3> & normals, const Array<Vector2> & tex_coords, Array<Triangle> & triangles) {
+	if (format == PLYFormat::ASCII || element.property_count != 1) return false;
+
+	const Property & property = element.properties[0];
+	if (property.kind != Property::Kind::VERTEX_INDEX || property.type.kind != Property::Type::Kind::LIST) return false;
+
+	if (get_type_size(property.type.list.size_type_kind) != 1 || get_type_size(property.type.list.list_type_kind) != 4) return false;
+
+	constexpr size_t STRIDE = 1 + 3 * sizeof(uint32_t);
+	if (size_t(parser.end - parser.cur) < size_t(element.count) * STRIDE) return false;
+
+	size_t offset = triangles.size();
+	triangles.resize(offset + element.count);
+
+	const char * data = parser.cur;
+
+	std::atomic<bool> is_triangle_list = true;
+	std::atomic<bool> is_in_bounds     = true;
+
+	for_each_chunk(element.count, [&](int first, int last) {
+		if (format == PLYFormat::BINARY_LITTLE_ENDIAN) {
+			decode_triangles<PLYFormat::BINARY_LITTLE_ENDIAN>(data, first, last, positions, normals, tex_coords, triangles.data() + offset, is_triangle_list, is_in_bounds);
+		} else {
+			decode_triangles<PLYFormat::BINARY_BIG_ENDIAN>   (data, first, last, positions, normals, tex_coords, triangles.data() + offset, is_triangle_list, is_in_bounds);
+		}
+	});
+
+	if (!is_triangle_list) {
+		triangles.resize(offset);
+		return false;
+	}
+	if (!is_in_bounds) {
+		ERROR(parser.location, "Face refers to a vertex that does not exist!\n");
+	}
+
+	parser.cur += size_t(element.count) * STRIDE;
+	return true;
+}
+
 Array<Triangle> PLYLoader::load(const String & filename, Allocator * allocator) {
 	String file = IO::file_read(filename, allocator);
 
@@ -261,6 +454,8 @@ Array<Triangle> PLYLoader::load(const String & filename, Allocator * allocator)
 
 		switch (element.type.kind) {
 			case Element::Type::Kind::VERTEX: {
+				if (try_decode_vertices_bulk(parser, element, format, positions, normals, tex_coords)) break;
+
 				for (int i = 0; i < element.count; i++) {
 					float vertex[9] = { }; // x, y, z, nx, ny, nz, u, v, ignored
 
@@ -284,6 +479,8 @@ Array<Triangle> PLYLoader::load(const String & filename, Allocator * allocator)
 			}
 
 			case Element::Type::Kind::FACE: {
+				if (try_decode_faces_bulk(parser, element, format, positions, normals, tex_coords, triangles)) break;
+
 				for (int i = 0; i < element.count; i++) {
 					for (int p = 0; p < element.property_count; p++) {
 						const Property & property = element.properties[p];
@@ -5,11 +5,17 @@
 #include "Core/Allocators/AlignedAllocator.h"
 
 #include "BVH/Builders/SAHBuilder.h"
+#include "BVH/Builders/BinnedSAHBuilder.h"
+#include "BVH/Builders/LBVHBuilder.h"
+#include "BVH/Builders/PLOCBuilder.h"
 #include "BVH/Builders/SBVHBuilder.h"
+#include "BVH/Builders/BVHPreSplitter.h"
 #include "BVH/Converters/BVH4Converter.h"
 #include "BVH/Converters/BVH8Converter.h"
 
 #include "BVH/BVHOptimizer.h"
+#include "BVH/BVHReorderer.h"
+#include "BVH/BVHQuantizer.h"
 #include <iostream>
 
 #include "Core/IO.h"
@@ -22,25 +28,14 @@ void print_node_info(Array<BVHNode2> nodes) {
 }
 
 void print_node_info(Array<BVHNode4> nodes) {
-	// Even though the amount of nodes loaded into the GPU is equal to
-	// the amount of nodes for BVH2, the used nodes are less
-	// Empty nodes are not removed from the node array
-	size_t empty_node_count = 0;
+	IO::print("BVH4 Node count: {}\n"_sv, nodes.size());
 	double child_count = 0;
 	for (size_t i = 0; i < nodes.size(); i++) {
-		const auto& node = nodes[i];
-		if (node.get_count(0) == 0 && node.get_index(0) == 0 &&
-			node.get_count(1) == 0 && node.get_index(1) == 0 &&
-			node.get_count(2) == 0 && node.get_index(2) == 0 &&
-			node.get_count(3) == 0 && node.get_index(3) == 0) {
-			empty_node_count++;
-		}
-		else {
-			child_count += node.get_child_count();
-		}
+		if (i == 1) continue; // Dummy
+
+		child_count += nodes[i].get_child_count();
 	}
-	IO::print("BVH4 Node count: {}\n"_sv, nodes.size() - empty_node_count);
-	IO::print("BVH4 Average branching factor: {}\n"_sv, child_count / (nodes.size() - empty_node_count));
+	IO::print("BVH4 Average branching factor: {}\n"_sv, child_count / (nodes.size() - 1));
 }
 
 void print_node_info(Array<BVHNode8> nodes) {
@@ -57,6 +52,46 @@ void print_node_info(Array<BVHNode8> nodes) {
 	IO::print("BVH8 Average branching factor: {}\n"_sv, child_count / nodes.size());
 }
 
+int BVHNode4::intersect(const Vector3 & ray_origin, const Vector3 & ray_direction_inv, float max_distance, float t_near[4]) const {
+	int hit_mask = 0;
+
+	int child_count = get_child_count();
+	for (int i = 0; i < child_count; i++) {
+		if (get_child_aabb(i).intersect(ray_origin, ray_direction_inv, max_distance, t_near[i])) {
+			hit_mask |= 1 << i;
+		}
+	}
+
+	return hit_mask;
+}
+
+AABB BVHNode4Quantized::get_child_aabb(int i) const {
+	return BVHQuantizer::get_child_aabb(*this, i);
+}
+
+int BVHNode4Quantized::intersect(const Vector3 & ray_origin, const Vector3 & ray_direction_inv, float max_distance, float t_near[4]) const {
+	int hit_mask = 0;
+
+	int child_count = get_child_count();
+	for (int i = 0; i < child_count; i++) {
+		if (get_child_aabb(i).intersect(ray_origin, ray_direction_inv, max_distance, t_near[i])) {
+			hit_mask |= 1 << i;
+		}
+	}
+
+	return hit_mask;
+}
+
+OwnPtr<BVHBuilder> BVH::create_builder(BVH2 & bvh, BVHBuilderType builder_type, size_t primitive_count) {
+	switch (builder_type) {
+		case BVHBuilderType::SAH:    return make_owned<SAHBuilder>      (bvh, primitive_count);
+		case BVHBuilderType::BINNED: return make_owned<BinnedSAHBuilder>(bvh, primitive_count, cpu_config.bvh_bin_count);
+		case BVHBuilderType::LBVH:   return make_owned<LBVHBuilder>     (bvh, primitive_count);
+		case BVHBuilderType::PLOC:   return make_owned<PLOCBuilder>     (bvh, primitive_count);
+		default: ASSERT_UNREACHABLE();
+	}
+}
+
 BVH2 BVH::create_from_triangles(const Array<Triangle> & triangles) {
 	IO::print("Constructing BVH...\r"_sv);
 
@@ -67,17 +102,65 @@ BVH2 BVH::create_from_triangles(const Array<Triangle> & triangles) {
 	if (cpu_config.bvh_type == BVHType::SBVH) {
 		ScopeTimer timer("SBVH Construction"_sv);
 
-		SBVHBuilder(bvh, triangles.size()).build(triangles);
-	} else  {
+		SBVHBuilder builder(bvh, triangles.size());
+		builder.max_primitives_in_leaf = max_primitives_in_leaf();
+		builder.build(triangles);
+	} else if (presplit_budget() > 0.0f) {
+		Array<PrimitiveRef> refs = BVHPreSplitter::split(triangles, presplit_budget());
+
+		ScopeTimer timer("BVH Construction"_sv);
+
+		if (cpu_config.bvh_builder == BVHBuilderType::SAH) {
+			SAHBuilder builder(bvh, refs.size());
+			builder.max_primitives_in_leaf = max_primitives_in_leaf();
+			builder.build(refs);
+		} else {
+			BinnedSAHBuilder builder(bvh, refs.size(), cpu_config.bvh_bin_count);
+			builder.max_primitives_in_leaf = max_primitives_in_leaf();
+			builder.build(refs);
+		}
+	} else {
+		ScopeTimer timer("BVH Construction"_sv);
+
+		OwnPtr<BVHBuilder> builder = create_builder(bvh, cpu_config.bvh_builder, triangles.size());
+		builder->max_primitives_in_leaf = max_primitives_in_leaf();
+		builder->build(triangles);
+	}
+
+	if (cpu_config.enable_bvh_optimization) {
+		BVHOptimizer::optimize(bvh);
+	}
+
+	BVHReorderer::reorder(bvh, cpu_config.bvh_node_order);
+
+	return bvh;
+}
+
+BVH2 BVH::create_from_curves(const Array<CurveSegment> & curves) {
+	IO::print("Constructing BVH...\r"_sv);
+
+	BVH2 bvh = BVH2(AlignedAllocator<64>::instance());
+
+	{
 		ScopeTimer timer("BVH Construction"_sv);
 
-		SAHBuilder(bvh, triangles.size()).build(triangles);
+		if (cpu_config.bvh_builder == BVHBuilderType::BINNED) {
+			BinnedSAHBuilder builder(bvh, curves.size(), cpu_config.bvh_bin_count);
+			builder.max_primitives_in_leaf = max_primitives_in_leaf();
+			builder.build(curves);
+		} else {
+			SAHBuilder builder(bvh, curves.size());
+			builder.max_primitives_in_leaf = max_primitives_in_leaf();
+			builder.build(curves);
+		}
 	}
 
 	if (cpu_config.enable_bvh_optimization) {
 		BVHOptimizer::optimize(bvh);
 	}
 
+	BVHReorderer::reorder(bvh, cpu_config.bvh_node_order);
+
 	return bvh;
 }
 
@@ -107,6 +190,7 @@ OwnPtr<BVH> BVH::create_from_bvh2(BVH2 bvh) {
 				ScopeTimer timer("BVH8 Converter"_sv);
 				BVH8Converter(*bvh8.get(), bvh).convert();
 			}
+			BVHReorderer::reorder(*bvh8.get(), cpu_config.bvh_node_order);
 			print_node_info(bvh8.get()->nodes);
 			return bvh8;
 		}
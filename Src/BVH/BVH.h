@@ -2,6 +2,7 @@
 #include "Config.h"
 
 #include "Renderer/Triangle.h"
+#include "Renderer/Curve.h"
 
 #include "Core/Array.h"
 #include "Core/OwnPtr.h"
@@ -41,7 +42,7 @@ struct BVHNode4 {
 	inline       int & get_count(int i)       { return index_and_count[i].count; }
 	inline const int & get_count(int i) const { return index_and_count[i].count; }
 
-	inline bool is_leaf(int i) { return get_count(i) > 0; }
+	inline bool is_leaf(int i) const { return get_count(i) > 0; }
 
 	inline int get_child_count() const {
 		int result = 0;
@@ -55,10 +56,59 @@ struct BVHNode4 {
 		return result;
 	}
 
+	inline AABB get_child_aabb(int i) const {
+		AABB aabb;
+		aabb.min = Vector3(aabb_min_x[i], aabb_min_y[i], aabb_min_z[i]);
+		aabb.max = Vector3(aabb_max_x[i], aabb_max_y[i], aabb_max_z[i]);
+		return aabb;
+	}
+
+	// Intersects the Ray with the AABBs of all children, returns a bitmask of the children that were hit
+	int intersect(const Vector3 & ray_origin, const Vector3 & ray_direction_inv, float max_distance, float t_near[4]) const;
+
 };
 
 static_assert(sizeof(BVHNode4) == 128);
 
+// Compressed version of BVHNode4 (64 instead of 128 bytes), meant for when memory bandwidth is the bottleneck
+// Child AABBs are quantized to 8 bits per plane relative to a local grid, using the same scheme as BVHNode8 (see BVHQuantizer)
+struct BVHNode4Quantized {
+	Vector3 p;    // Origin of the quantization grid
+	byte    e[3]; // Exponent of the grid scale along each axis
+	byte    padding_0;
+
+	int  index[4]; // First primitive for leaves, Node for internal children, INVALID for empty slots
+	byte count[4]; // Number of primitives for leaves, 0 for internal children
+
+	byte quantized_min_x[4] = { }, quantized_max_x[4] = { };
+	byte quantized_min_y[4] = { }, quantized_max_y[4] = { };
+	byte quantized_min_z[4] = { }, quantized_max_z[4] = { };
+
+	byte padding_1[4];
+
+	inline bool is_leaf(int i) const { return count[i] > 0; }
+
+	inline int get_child_count() const {
+		int result = 0;
+
+		for (int i = 0; i < 4; i++) {
+			if (index[i] == INVALID) break;
+
+			result++;
+		}
+
+		return result;
+	}
+
+	// Decodes the AABB of the given child, it is guaranteed to contain the original AABB
+	AABB get_child_aabb(int i) const;
+
+	// Intersects the Ray with the (decoded) AABBs of all children, returns a bitmask of the children that were hit
+	int intersect(const Vector3 & ray_origin, const Vector3 & ray_direction_inv, float max_distance, float t_near[4]) const;
+};
+
+static_assert(sizeof(BVHNode4Quantized) == 64);
+
 struct BVHNode8 {
 	Vector3 p;
 	byte e[3];
@@ -73,14 +123,35 @@ struct BVHNode8 {
 	byte quantized_min_y[8] = { }, quantized_max_y[8] = { };
 	byte quantized_min_z[8] = { }, quantized_max_z[8] = { };
 
-	inline bool is_leaf(int child_index) {
+	inline bool is_leaf(int child_index) const {
 		return (meta[child_index] & 0b00011111) < 24;
 	}
+
+	// Returns the index of the first Triangle and the number of Triangles of the given leaf child
+	inline void get_leaf_triangles(int child_index, int & first, int & count) const {
+		first = base_index_triangle + (meta[child_index] & 0b00011111);
+		count = 0;
+
+		// Three highest bits contain unary representation of triangle count
+		for (int j = 5; j < 8; j++) {
+			if (meta[child_index] & (1 << j)) count++;
+		}
+	}
+
+	// Returns the index of the Node of the given internal child
+	inline int get_child_node_index(int child_index) const {
+		int offset = 0;
+		for (int i = 0; i < child_index; i++) {
+			if (imask & (1 << i)) offset++;
+		}
+		return base_index_child + offset;
+	}
 };
 
 static_assert(sizeof(BVHNode8) == 80);
 
 struct BVH2;
+struct BVHBuilder;
 
 struct BVH {
 	Array<int> indices;
@@ -89,18 +160,32 @@ struct BVH {
 
 	virtual size_t node_count() const = 0;
 
+	static OwnPtr<BVHBuilder> create_builder(BVH2 & bvh, BVHBuilderType builder_type, size_t primitive_count);
+
 	static BVH2 create_from_triangles(const Array<Triangle> & triangles);
 
+	// Curves only support object splits, so they are built with the binned SAH builder if it is selected and the full SAH builder otherwise
+	static BVH2 create_from_curves(const Array<CurveSegment> & curves);
+
 	static OwnPtr<BVH> create_from_bvh2(BVH2 bvh);
 
-	static BVHType underlying_bvh_type() {
-		// All BVH use standard BVH as underlying type, only SBVH uses SBVH
-		if (cpu_config.bvh_type == BVHType::SBVH) {
-			return BVHType::SBVH;
+	// Leaf size limit used by the builders, BVH8 conversion and BVH optimization both require one primitive per leaf
+	static int max_primitives_in_leaf() {
+		if (cpu_config.bvh_type == BVHType::BVH8 || cpu_config.enable_bvh_optimization) {
+			return 1;
 		} else {
-			return BVHType::BVH;
+			return Math::max(cpu_config.bvh_max_primitives_in_leaf, 1);
 		}
 	}
+
+	// Pre-splitting budget used for the BLAS, only the SAH and binned SAH builders support pre-split references
+	static float presplit_budget() {
+		bool supported =
+			cpu_config.bvh_type != BVHType::SBVH &&
+			(cpu_config.bvh_builder == BVHBuilderType::SAH || cpu_config.bvh_builder == BVHBuilderType::BINNED);
+
+		return supported ? Math::max(cpu_config.bvh_presplit_budget, 0.0f) : 0.0f;
+	}
 };
 
 struct BVH2 final : BVH {
@@ -9,30 +9,10 @@
 #include "Core/Random.h"
 #include "Core/Allocators/LinearAllocator.h"
 
-#include "Util/Util.h"
-
-// Calculates the SAH cost of a whole tree
-static float bvh_sah_cost(const BVH2 & bvh) {
-	float sum_leaf = 0.0f;
-	float sum_node = 0.0f;
-
-	for (size_t i = 0; i < bvh.nodes.size(); i++) {
-		if (i == 1) continue;
-
-		const BVHNode2 & node = bvh.nodes[i];
-
-		if (node.is_leaf()) {
-			sum_leaf += node.aabb.surface_area() * node.count;
-		} else {
-			sum_node += node.aabb.surface_area();
-		}
-	}
+#include "BVH/BVHRefitter.h"
 
-	return (
-		cpu_config.sah_cost_node * sum_node +
-		cpu_config.sah_cost_leaf * sum_leaf
-	) / bvh.nodes[0].aabb.surface_area();
-}
+#include "Util/Util.h"
+#include "Util/ThreadPool.h"
 
 // Initialize array of parent indices
 static Array<int> get_parent_indices(const BVH2 & bvh, Allocator * allocator) {
@@ -108,30 +88,70 @@ static void select_nodes_measure(const BVH2 & bvh, const Array<int> & parent_ind
 	}
 }
 
-// Finds the global minimum of where best to insert the reinsertion node by traversing the tree using Branch and Bound
-static void find_reinsertion(const BVH2 & bvh, const BVHNode2 & node_reinsert, Allocator * allocator, float & min_cost, int & min_index) {
-	float node_reinsert_area = node_reinsert.aabb.surface_area();
+struct ReinsertionCandidate {
+	int   node_index;
+	float induced_cost;
+
+	bool operator<(ReinsertionCandidate other) const {
+		return induced_cost < other.induced_cost; // Compare based on induced cost
+	}
+};
 
-	struct Pair {
-		int   node_index;
-		float induced_cost;
+// Describes the removal of a Node (and its parent) from the tree, without actually modifying the tree
+// This allows the reinsertion searches of multiple Nodes to be performed concurrently on the same tree
+struct ReinsertionRemoval {
+	int parent;  // Removed together with the Node
+	int sibling; // Takes the place of the parent
 
-		bool operator<(Pair other) const {
-			return induced_cost < other.induced_cost; // Compare based on induced cost
+	Array<int>  ancestors;     // Ancestors of the parent, from bottom to top
+	Array<AABB> ancestor_aabbs; // AABBs of the ancestors after the removal
+
+	void init(const BVH2 & bvh, const Array<int> & parent_indices, int node_index) {
+		parent  = parent_indices[node_index];
+		sibling = node_index ^ 1;
+
+		ancestors     .clear();
+		ancestor_aabbs.clear();
+
+		AABB aabb  = bvh.nodes[sibling].aabb;
+		int  child = parent;
+
+		for (int ancestor = parent_indices[parent]; ancestor != INVALID; ancestor = parent_indices[ancestor]) {
+			aabb = AABB::unify(aabb, bvh.nodes[child ^ 1].aabb);
+
+			ancestors     .push_back(ancestor);
+			ancestor_aabbs.push_back(aabb);
+
+			child = ancestor;
 		}
-	};
+	}
 
-	MinHeap<Pair> priority_queue(allocator);
-	priority_queue.emplace(0, 0.0f); // Push BVH root with 0 induced cost
+	const AABB & get_aabb(const BVH2 & bvh, int node_index) const {
+		for (size_t i = 0; i < ancestors.size(); i++) {
+			if (ancestors[i] == node_index) return ancestor_aabbs[i];
+		}
+		return bvh.nodes[node_index].aabb;
+	}
+};
+
+// Finds the global minimum of where best to insert the reinsertion node by traversing the tree using Branch and Bound
+// If 'removal' is provided, the search is performed as if the described removal had already taken place
+// The search can be limited to a subtree by providing its root and the cost induced on the ancestors of that root
+static void find_reinsertion(const BVH2 & bvh, const BVHNode2 & node_reinsert, MinHeap<ReinsertionCandidate> & priority_queue, const ReinsertionRemoval * removal, float & min_cost, int & min_index, int root_index = 0, float root_induced_cost = 0.0f) {
+	float node_reinsert_area = node_reinsert.aabb.surface_area();
+
+	priority_queue.data.clear();
+	priority_queue.emplace(root_index, root_induced_cost);
 
 	while (priority_queue.size() > 0) {
 		auto [node_index, induced_cost] = priority_queue.pop();
 
 		const BVHNode2 & node = bvh.nodes[node_index];
+		const AABB     & node_aabb = removal ? removal->get_aabb(bvh, node_index) : node.aabb;
 
 		if (induced_cost + node_reinsert_area >= min_cost) break; // Not possible to reduce min_cost, terminate
 
-		float direct_cost = AABB::unify(node.aabb, node_reinsert.aabb).surface_area();
+		float direct_cost = AABB::unify(node_aabb, node_reinsert.aabb).surface_area();
 		float cost = induced_cost + direct_cost;
 
 		if (cost < min_cost) {
@@ -140,16 +160,45 @@ static void find_reinsertion(const BVH2 & bvh, const BVHNode2 & node_reinsert, A
 		}
 
 		if (!node.is_leaf()) {
-			float child_induced_cost = cost - node.aabb.surface_area();
+			float child_induced_cost = cost - node_aabb.surface_area();
 
 			if (child_induced_cost + node_reinsert_area < min_cost) {
-				priority_queue.emplace(node.left,     child_induced_cost);
-				priority_queue.emplace(node.left + 1, child_induced_cost);
+				for (int c = 0; c < 2; c++) {
+					int child = node.left + c;
+
+					// The removed parent is replaced by its other child
+					if (removal && child == removal->parent) {
+						child = removal->sibling;
+					}
+
+					priority_queue.emplace(child, child_induced_cost);
+				}
 			}
 		}
 	}
 }
 
+// Calculates the cost of inserting 'node_reinsert' as a sibling of the given Node in the current tree
+// Returns INFINITY if the Node is no longer part of the tree, which is checked by walking up to the root and verifying that every parent actually points to the child
+static float calc_reinsertion_cost(const BVH2 & bvh, const Array<int> & parent_indices, const BVHNode2 & node_reinsert, int node_index) {
+	float cost = AABB::unify(bvh.nodes[node_index].aabb, node_reinsert.aabb).surface_area();
+
+	for (size_t depth = 0; node_index != 0; depth++) {
+		if (depth >= bvh.nodes.size()) return INFINITY;
+
+		int parent = parent_indices[node_index];
+		if (parent == INVALID) return INFINITY;
+
+		const BVHNode2 & node_parent = bvh.nodes[parent];
+		if (node_parent.is_leaf() || node_parent.left != (node_index & ~1)) return INFINITY;
+
+		cost += AABB::unify(node_parent.aabb, node_reinsert.aabb).surface_area() - node_parent.aabb.surface_area();
+
+		node_index = parent;
+	}
+	return cost;
+}
+
 // Update AABBs bottom up, until the root of the tree is reached
 static void update_aabbs_bottom_up(BVH2 & bvh, const Array<int> & parent_indices, int node_index) {
 	ASSERT(node_index >= 0);
@@ -230,7 +279,7 @@ void BVHOptimizer::optimize(BVH2 & bvh) {
 
 	ScopeTimer timer("BVH Optimization"_sv);
 
-	float cost_before = bvh_sah_cost(bvh);
+	float cost_before = BVHRefitter::calc_sah_cost(bvh);
 
 	LinearAllocator<MEGABYTES(1)> init_allocator; // Memory used during the entire optimization process
 	LinearAllocator<MEGABYTES(1)> loop_allocator; // Memory reset every batch iteration
@@ -260,9 +309,30 @@ void BVHOptimizer::optimize(BVH2 & bvh) {
 	Array<int> originated  (bvh.nodes.size(), &init_allocator);
 	Array<int> displacement(bvh.nodes.size(), &init_allocator);
 
+	bool parallel =
+		cpu_config.enable_parallel_bvh_build &&
+		ThreadPool::get_thread_count() > 0;
+
+	// When running in parallel, batches are processed in rounds. The reinsertion positions for the two children
+	// of every Node in a round are found in parallel, before the tree is modified by the reinsertions of that round
+	struct ReinsertionTarget {
+		int   node_reinsert; // Node to reinsert (as index at the start of the batch)
+		int   node_index;    // Best position to reinsert at (as index at the start of the batch)
+		float cost;
+	};
+
+	constexpr int ROUND_CHUNK_SIZE = 16;
+	int round_size = ROUND_CHUNK_SIZE * (ThreadPool::get_thread_count() + 1);
+
+	Array<ReinsertionTarget> reinsertion_targets(parallel ? 2 * round_size : 0, &init_allocator);
+
+	MinHeap<ReinsertionCandidate> priority_queue(nullptr);
+
 	RNG rng(time(nullptr));
 
-	clock_t start_time = clock();
+	// Wall clock time, since the CPU time of all threads combined would exhaust the time budget early
+	Timer timer_total;
+	timer_total.start();
 
 	while (true) {
 		loop_allocator.reset();
@@ -280,6 +350,43 @@ void BVHOptimizer::optimize(BVH2 & bvh) {
 		}
 
 		for (int i = 0; i < batch_size; i++) {
+			if (parallel && i % round_size == 0) {
+				// Run the Branch and Bound searches for the next round of the batch in parallel on the current tree
+				int round_end = Math::min(i + round_size, batch_size);
+
+				ThreadPool::parallel_for(Math::divide_round_up(round_end - i, ROUND_CHUNK_SIZE), [&](int chunk) {
+					MinHeap<ReinsertionCandidate> priority_queue(nullptr);
+					ReinsertionRemoval            removal;
+
+					int first = i + chunk * ROUND_CHUNK_SIZE;
+					int last  = Math::min(first + ROUND_CHUNK_SIZE, round_end);
+
+					for (int k = first; k < last; k++) {
+						ReinsertionTarget * targets = &reinsertion_targets[2 * (k % round_size)];
+
+						int node_index = displacement[batch_indices[k]];
+						if (node_index == INVALID || bvh.nodes[node_index].is_leaf() || parent_indices[node_index] == 0) {
+							targets[0] = { INVALID, INVALID, INFINITY };
+							targets[1] = { INVALID, INVALID, INFINITY };
+							continue;
+						}
+
+						const BVHNode2 & node = bvh.nodes[node_index];
+
+						removal.init(bvh, parent_indices, node_index);
+
+						for (int c = 0; c < 2; c++) {
+							float min_cost  = INFINITY;
+							int   min_index = INVALID;
+
+							find_reinsertion(bvh, bvh.nodes[node.left + c], priority_queue, &removal, min_cost, min_index);
+
+							targets[c] = { originated[node.left + c], min_index == INVALID ? INVALID : originated[min_index], min_cost };
+						}
+					}
+				});
+			}
+
 			int node_index = displacement[batch_indices[i]];
 			if (node_index == INVALID) continue; // This Node was overwritten by another reinsertion and no longer exists
 
@@ -335,6 +442,8 @@ void BVHOptimizer::optimize(BVH2 & bvh) {
 
 			update_aabbs_bottom_up(bvh, parent_indices, parent_parent);
 
+			int inserted_index = INVALID; // Parent of the first reinserted Node
+
 			// Reinsert Nodes
 			for (int j = 0; j < 2; j++) {
 				int      unused   = nodes_unused  [j];
@@ -346,7 +455,48 @@ void BVHOptimizer::optimize(BVH2 & bvh) {
 				float min_cost  = INFINITY;
 				int   min_index = INVALID;
 
-				find_reinsertion(bvh, reinsert.node, &loop_allocator, min_cost, min_index);
+				if (parallel) {
+					const ReinsertionTarget * targets = &reinsertion_targets[2 * (i % round_size)];
+					const ReinsertionTarget * target  = nullptr;
+
+					// The parallel search may have been done for other children (e.g. if this Node was moved by an earlier reinsertion)
+					for (int t = 0; t < 2; t++) {
+						if (targets[t].node_reinsert == originated[reinsert.node_index]) {
+							target = &targets[t];
+						}
+					}
+
+					// Earlier reinsertions in this round may have removed the target or made it more expensive,
+					// in that case the target is discarded and the search is redone serially on the current tree
+					int target_index = INVALID;
+					if (target) {
+						if (target->node_index == originated[parent]) {
+							target_index = parent; // The sibling of the removed Node has taken the place of the parent
+						} else if (target->node_index != INVALID) {
+							target_index = displacement[target->node_index];
+						}
+					}
+
+					if (target_index != INVALID) {
+						float target_cost = calc_reinsertion_cost(bvh, parent_indices, reinsert.node, target_index);
+
+						// Only accept the target if its cost did not increase at all, otherwise the reinsertion may worsen the SAH
+						if (target_cost <= target->cost) {
+							min_cost  = target_cost;
+							min_index = target_index;
+
+							// The subtree containing the other child was not part of the tree during the parallel search and may contain a better position
+							if (j == 1) {
+								float induced_cost = calc_reinsertion_cost(bvh, parent_indices, reinsert.node, inserted_index) - AABB::unify(bvh.nodes[inserted_index].aabb, reinsert.node.aabb).surface_area();
+								find_reinsertion(bvh, reinsert.node, priority_queue, nullptr, min_cost, min_index, inserted_index, induced_cost);
+							}
+						}
+					}
+				}
+
+				if (min_index == INVALID) {
+					find_reinsertion(bvh, reinsert.node, priority_queue, nullptr, min_cost, min_index);
+				}
 
 				// Bookkeeping updates to perform the reinsertion
 				bvh.nodes[unused    ] = bvh.nodes[min_index];
@@ -378,11 +528,13 @@ void BVHOptimizer::optimize(BVH2 & bvh) {
 
 				bvh_node_calc_axis(bvh, parent_indices, displacement, originated, bvh.nodes[min_index]);
 
+				inserted_index = min_index;
+
 				ASSERT(!bvh.nodes[min_index].is_leaf());
 			}
 		}
 
-		float sah_cost = bvh_sah_cost(bvh);
+		float sah_cost = BVHRefitter::calc_sah_cost(bvh);
 
 		if (sah_cost < sah_cost_best) {
 			sah_cost_best = sah_cost;
@@ -403,8 +555,7 @@ void BVHOptimizer::optimize(BVH2 & bvh) {
 			}
 		}
 
-		clock_t curr_time = clock();
-		size_t  duration  = (curr_time - start_time) * 1000 / CLOCKS_PER_SEC;
+		size_t duration = timer_total.stop() / 1000;
 
 		if (duration >= cpu_config.bvh_optimizer_max_time || batch_count >= cpu_config.bvh_optimizer_max_num_batches) {
 			break;
@@ -415,6 +566,6 @@ void BVHOptimizer::optimize(BVH2 & bvh) {
 	}
 
 	// Report the improvement of the SAH cost
-	float cost_after = bvh_sah_cost(bvh);
+	float cost_after = BVHRefitter::calc_sah_cost(bvh);
 	IO::print("\ncost: {} -> {}\n"_sv, cost_before, cost_after);
 }
@@ -0,0 +1,104 @@
+#pragma once
+#include <float.h>
+
+#include "BVH.h"
+
+#include "Math/Math.h"
+
+#include "Util/Util.h"
+
+// Quantization of child AABBs to 8 bits per plane, relative to a local grid per Node (Ylitie et al. 2017)
+// Shared by the Node types that store quantized children (BVHNode8 and BVHNode4Quantized)
+namespace BVHQuantizer {
+	// Returns the scale of the quantization grid of the Node along each axis
+	template<typename Node>
+	inline Vector3 get_scale(const Node & node) {
+		return Vector3(
+			Util::bit_cast<float>(unsigned(node.e[0]) << 23),
+			Util::bit_cast<float>(unsigned(node.e[1]) << 23),
+			Util::bit_cast<float>(unsigned(node.e[2]) << 23)
+		);
+	}
+
+	// Sets the origin and scale of the quantization grid of the Node, returns the reciprocal of the scale
+	template<typename Node>
+	inline Vector3 quantize_node(Node & node, const AABB & aabb) {
+		node.p = aabb.min;
+
+		constexpr int Nq = 8;
+		constexpr float denom = 1.0f / float((1 << Nq) - 1);
+
+		Vector3 e;
+		for (int dimension = 0; dimension < 3; dimension++) {
+			// Smallest power of two that covers the extent in 255 steps, a zero extent still needs a valid (normal) scale
+			e[dimension] = fmaxf(exp2f(ceilf(log2f((aabb.max[dimension] - aabb.min[dimension]) * denom))), FLT_MIN);
+
+			// The grid is anchored at p, make sure the last grid line is not below the max due to rounding
+			while (aabb.min[dimension] + 255.0f * e[dimension] < aabb.max[dimension]) {
+				e[dimension] *= 2.0f;
+			}
+		}
+
+		unsigned u_ex = Util::bit_cast<unsigned>(e.x);
+		unsigned u_ey = Util::bit_cast<unsigned>(e.y);
+		unsigned u_ez = Util::bit_cast<unsigned>(e.z);
+
+		// Only the exponent bits can be non-zero
+		ASSERT((u_ex & 0b10000000011111111111111111111111) == 0);
+		ASSERT((u_ey & 0b10000000011111111111111111111111) == 0);
+		ASSERT((u_ez & 0b10000000011111111111111111111111) == 0);
+
+		// Store only 8 bit exponent
+		node.e[0] = u_ex >> 23;
+		node.e[1] = u_ey >> 23;
+		node.e[2] = u_ez >> 23;
+
+		return Vector3(1.0f / e.x, 1.0f / e.y, 1.0f / e.z);
+	}
+
+	// Quantizes the AABB of a child conservatively, relative to the grid of its parent Node
+	// The decoded bounds p + q * e are guaranteed to contain the child AABB
+	template<typename Node>
+	inline void quantize_child(Node & node, int child_index, const AABB & child_aabb, const Vector3 & one_over_e) {
+		Vector3 e = get_scale(node);
+
+		byte * quantized_min[3] = { node.quantized_min_x, node.quantized_min_y, node.quantized_min_z };
+		byte * quantized_max[3] = { node.quantized_max_x, node.quantized_max_y, node.quantized_max_z };
+
+		for (int dimension = 0; dimension < 3; dimension++) {
+			float p = node.p[dimension];
+
+			int q_min = int(floorf((child_aabb.min[dimension] - p) * one_over_e[dimension]));
+			int q_max = int(ceilf ((child_aabb.max[dimension] - p) * one_over_e[dimension]));
+
+			q_min = Math::clamp(q_min, 0, 255);
+			q_max = Math::clamp(q_max, 0, 255);
+
+			// Correct for rounding in the subtraction, such that the decoded bounds are conservative
+			while (q_min > 0   && p + float(q_min) * e[dimension] > child_aabb.min[dimension]) q_min--;
+			while (q_max < 255 && p + float(q_max) * e[dimension] < child_aabb.max[dimension]) q_max++;
+
+			quantized_min[dimension][child_index] = byte(q_min);
+			quantized_max[dimension][child_index] = byte(q_max);
+		}
+	}
+
+	// Decodes the conservative AABB of the given child
+	template<typename Node>
+	inline AABB get_child_aabb(const Node & node, int child_index) {
+		Vector3 e = get_scale(node);
+
+		AABB aabb;
+		aabb.min = Vector3(
+			node.p.x + float(node.quantized_min_x[child_index]) * e.x,
+			node.p.y + float(node.quantized_min_y[child_index]) * e.y,
+			node.p.z + float(node.quantized_min_z[child_index]) * e.z
+		);
+		aabb.max = Vector3(
+			node.p.x + float(node.quantized_max_x[child_index]) * e.x,
+			node.p.y + float(node.quantized_max_y[child_index]) * e.y,
+			node.p.z + float(node.quantized_max_z[child_index]) * e.z
+		);
+		return aabb;
+	}
+}
@@ -0,0 +1,279 @@
+#include "BVHRefitter.h"
+
+#include "Core/IO.h"
+
+#include "Renderer/Mesh.h"
+#include "Renderer/MeshData.h"
+
+#include "BVH/BVHQuantizer.h"
+
+template<typename Primitive>
+static AABB calc_leaf_aabb(const Array<Primitive> & primitives, const Array<int> & indices, int first, int count) {
+	AABB aabb = AABB::create_empty();
+	for (int i = first; i < first + count; i++) {
+		aabb.expand(primitives[indices[i]].get_aabb());
+	}
+	return aabb;
+}
+
+template<typename Primitive>
+static AABB refit_recursive(BVH2 & bvh, const Array<Primitive> & primitives, int node_index) {
+	BVHNode2 & node = bvh.nodes[node_index];
+
+	if (node.is_leaf()) {
+		node.aabb = calc_leaf_aabb(primitives, bvh.indices, node.first, node.count);
+	} else {
+		// NOTE: Nodes are not necessarily stored in depth first order (e.g. after optimization), so recursion is used instead of a reverse linear pass
+		node.aabb = AABB::unify(
+			refit_recursive(bvh, primitives, node.left),
+			refit_recursive(bvh, primitives, node.left + 1)
+		);
+	}
+
+	return node.aabb;
+}
+
+void BVHRefitter::refit(BVH2 & bvh, const Array<Triangle> & triangles) {
+	refit_recursive(bvh, triangles, 0);
+}
+
+void BVHRefitter::refit(BVH2 & bvh, const Array<CurveSegment> & curves) {
+	refit_recursive(bvh, curves, 0);
+}
+
+void BVHRefitter::refit(BVH2 & bvh, const Array<Mesh> & meshes) {
+	refit_recursive(bvh, meshes, 0);
+}
+
+template<typename Primitive>
+static AABB refit_recursive(BVH4 & bvh, const Array<Primitive> & primitives, int node_index) {
+	BVHNode4 & node = bvh.nodes[node_index];
+
+	AABB aabb = AABB::create_empty();
+
+	int child_count = node.get_child_count();
+	for (int i = 0; i < child_count; i++) {
+		AABB child_aabb;
+		if (node.is_leaf(i)) {
+			child_aabb = calc_leaf_aabb(primitives, bvh.indices, node.get_index(i), node.get_count(i));
+		} else {
+			child_aabb = refit_recursive(bvh, primitives, node.get_index(i));
+		}
+
+		node.aabb_min_x[i] = child_aabb.min.x;
+		node.aabb_min_y[i] = child_aabb.min.y;
+		node.aabb_min_z[i] = child_aabb.min.z;
+		node.aabb_max_x[i] = child_aabb.max.x;
+		node.aabb_max_y[i] = child_aabb.max.y;
+		node.aabb_max_z[i] = child_aabb.max.z;
+
+		aabb.expand(child_aabb);
+	}
+
+	return aabb;
+}
+
+void BVHRefitter::refit(BVH4 & bvh, const Array<Triangle> & triangles) {
+	refit_recursive(bvh, triangles, 0);
+}
+
+void BVHRefitter::refit(BVH4 & bvh, const Array<CurveSegment> & curves) {
+	refit_recursive(bvh, curves, 0);
+}
+
+void BVHRefitter::refit(BVH4 & bvh, const Array<Mesh> & meshes) {
+	refit_recursive(bvh, meshes, 0);
+}
+
+template<typename Primitive>
+static AABB refit_recursive(BVH8 & bvh, const Array<Primitive> & primitives, int node_index) {
+	// The quantization grid depends on the AABB of the Node itself, so all child AABBs are needed before any can be quantized
+	AABB child_aabbs[8];
+	AABB aabb = AABB::create_empty();
+
+	for (int i = 0; i < 8; i++) {
+		const BVHNode8 & node = bvh.nodes[node_index];
+		if (node.meta[i] == 0) continue; // Empty slot
+
+		if (node.is_leaf(i)) {
+			int first, count;
+			node.get_leaf_triangles(i, first, count);
+
+			child_aabbs[i] = calc_leaf_aabb(primitives, bvh.indices, first, count);
+		} else {
+			child_aabbs[i] = refit_recursive(bvh, primitives, node.get_child_node_index(i));
+		}
+
+		aabb.expand(child_aabbs[i]);
+	}
+
+	BVHNode8 & node = bvh.nodes[node_index];
+
+	Vector3 one_over_e = BVHQuantizer::quantize_node(node, aabb);
+
+	for (int i = 0; i < 8; i++) {
+		if (node.meta[i] != 0) {
+			BVHQuantizer::quantize_child(node, i, child_aabbs[i], one_over_e);
+		}
+	}
+
+	return aabb;
+}
+
+void BVHRefitter::refit(BVH8 & bvh, const Array<Triangle> & triangles) {
+	refit_recursive(bvh, triangles, 0);
+}
+
+void BVHRefitter::refit(BVH8 & bvh, const Array<CurveSegment> & curves) {
+	refit_recursive(bvh, curves, 0);
+}
+
+void BVHRefitter::refit(BVH8 & bvh, const Array<Mesh> & meshes) {
+	refit_recursive(bvh, meshes, 0);
+}
+
+float BVHRefitter::calc_sah_cost(const BVH2 & bvh) {
+	float sum_leaf = 0.0f;
+	float sum_node = 0.0f;
+
+	for (size_t i = 0; i < bvh.nodes.size(); i++) {
+		if (i == 1) continue;
+
+		const BVHNode2 & node = bvh.nodes[i];
+
+		if (node.is_leaf()) {
+			sum_leaf += node.aabb.surface_area() * node.count;
+		} else {
+			sum_node += node.aabb.surface_area();
+		}
+	}
+
+	return (
+		cpu_config.sah_cost_node * sum_node +
+		cpu_config.sah_cost_leaf * sum_leaf
+	) / bvh.nodes[0].aabb.surface_area();
+}
+
+static void calc_sah_cost_recursive(const BVH4 & bvh, int node_index, AABB & aabb, float & sum_leaf, float & sum_node) {
+	const BVHNode4 & node = bvh.nodes[node_index];
+
+	int child_count = node.get_child_count();
+	for (int i = 0; i < child_count; i++) {
+		AABB child_aabb = node.get_child_aabb(i);
+		aabb.expand(child_aabb);
+
+		if (node.get_count(i) > 0) {
+			sum_leaf += child_aabb.surface_area() * node.get_count(i);
+		} else {
+			sum_node += child_aabb.surface_area();
+
+			AABB aabb_dummy = AABB::create_empty();
+			calc_sah_cost_recursive(bvh, node.get_index(i), aabb_dummy, sum_leaf, sum_node);
+		}
+	}
+}
+
+float BVHRefitter::calc_sah_cost(const BVH4 & bvh) {
+	AABB  aabb_root = AABB::create_empty();
+	float sum_leaf  = 0.0f;
+	float sum_node  = 0.0f;
+
+	calc_sah_cost_recursive(bvh, 0, aabb_root, sum_leaf, sum_node);
+
+	float area_root = aabb_root.surface_area();
+
+	return (
+		cpu_config.sah_cost_node * (sum_node + area_root) +
+		cpu_config.sah_cost_leaf * sum_leaf
+	) / area_root;
+}
+
+float BVHRefitter::calc_sah_cost(const BVH8 & bvh) {
+	float sum_leaf  = 0.0f;
+	float sum_node  = 0.0f;
+	float area_root = 0.0f;
+
+	for (size_t n = 0; n < bvh.nodes.size(); n++) {
+		const BVHNode8 & node = bvh.nodes[n];
+
+		AABB aabb = AABB::create_empty();
+
+		for (int i = 0; i < 8; i++) {
+			if (node.meta[i] == 0) continue; // Empty slot
+
+			AABB child_aabb = BVHQuantizer::get_child_aabb(node, i);
+
+			aabb.expand(child_aabb);
+
+			if (node.is_leaf(i)) {
+				int first, count;
+				node.get_leaf_triangles(i, first, count);
+
+				sum_leaf += child_aabb.surface_area() * float(count);
+			} else {
+				sum_node += child_aabb.surface_area();
+			}
+		}
+
+		if (n == 0) {
+			area_root = aabb.surface_area();
+			sum_node += area_root;
+		}
+	}
+
+	return (
+		cpu_config.sah_cost_node * sum_node +
+		cpu_config.sah_cost_leaf * sum_leaf
+	) / area_root;
+}
+
+template<typename Primitive>
+static void refit(BVH & bvh, const Array<Primitive> & primitives) {
+	switch (cpu_config.bvh_type) {
+		case BVHType::BVH:
+		case BVHType::SBVH: BVHRefitter::refit(static_cast<BVH2 &>(bvh), primitives); break;
+		case BVHType::BVH4: BVHRefitter::refit(static_cast<BVH4 &>(bvh), primitives); break;
+		case BVHType::BVH8: BVHRefitter::refit(static_cast<BVH8 &>(bvh), primitives); break;
+		default: ASSERT_UNREACHABLE();
+	}
+}
+
+float BVHRefitter::calc_sah_cost(const BVH & bvh) {
+	switch (cpu_config.bvh_type) {
+		case BVHType::BVH:
+		case BVHType::SBVH: return BVHRefitter::calc_sah_cost(static_cast<const BVH2 &>(bvh));
+		case BVHType::BVH4: return BVHRefitter::calc_sah_cost(static_cast<const BVH4 &>(bvh));
+		case BVHType::BVH8: return BVHRefitter::calc_sah_cost(static_cast<const BVH8 &>(bvh));
+		default: ASSERT_UNREACHABLE();
+	}
+}
+
+bool BVHRefitter::refit_or_rebuild(MeshData & mesh_data) {
+	// The AABBs have not been refitted yet, so they still describe the BVH as it was built (or loaded from the cache)
+	if (mesh_data.bvh_sah_cost == 0.0f) {
+		mesh_data.bvh_sah_cost = calc_sah_cost(*mesh_data.bvh.get());
+	}
+
+	if (mesh_data.has_curves()) {
+		::refit(*mesh_data.bvh.get(), mesh_data.curves);
+	} else {
+		::refit(*mesh_data.bvh.get(), mesh_data.triangles);
+	}
+
+	float threshold = cpu_config.bvh_refit_rebuild_threshold;
+	if (threshold <= 0.0f) return false;
+
+	float sah_cost = calc_sah_cost(*mesh_data.bvh.get());
+	if (sah_cost <= threshold * mesh_data.bvh_sah_cost) return false;
+
+	IO::print("BVH SAH cost degraded from {} to {} after refitting, rebuilding...\n"_sv, mesh_data.bvh_sah_cost, sah_cost);
+
+	if (mesh_data.has_curves()) {
+		mesh_data.bvh = BVH::create_from_bvh2(BVH::create_from_curves(mesh_data.curves));
+	} else {
+		mesh_data.bvh = BVH::create_from_bvh2(BVH::create_from_triangles(mesh_data.triangles));
+	}
+	mesh_data.bvh_sah_cost = calc_sah_cost(*mesh_data.bvh.get());
+
+	return true;
+}
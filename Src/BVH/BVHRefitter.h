@@ -0,0 +1,35 @@
+#pragma once
+#include "BVH.h"
+
+struct Mesh;
+struct MeshData;
+
+namespace BVHRefitter {
+	// Recomputes all AABBs bottom up after the Triangles have moved, while keeping the topology of the BVH intact
+	// No memory is allocated, which makes this suitable for deforming (skinned or simulated) Meshes that change every frame
+	// NOTE: for an SBVH the refitted leaves bound the whole Triangle instead of only its clipped part
+	void refit(BVH2 & bvh, const Array<Triangle> & triangles);
+	void refit(BVH4 & bvh, const Array<Triangle> & triangles);
+	void refit(BVH8 & bvh, const Array<Triangle> & triangles); // Child AABBs are requantized in place
+
+	// Same as above, but for CurveSegments
+	void refit(BVH2 & bvh, const Array<CurveSegment> & curves);
+	void refit(BVH4 & bvh, const Array<CurveSegment> & curves);
+	void refit(BVH8 & bvh, const Array<CurveSegment> & curves);
+
+	// Same as above, but for a TLAS over Meshes
+	void refit(BVH2 & bvh, const Array<Mesh> & meshes);
+	void refit(BVH4 & bvh, const Array<Mesh> & meshes);
+	void refit(BVH8 & bvh, const Array<Mesh> & meshes);
+
+	// SAH cost of the BVH based on its current AABBs, normalized by the surface area of the root
+	float calc_sah_cost(const BVH2 & bvh);
+	float calc_sah_cost(const BVH4 & bvh);
+	float calc_sah_cost(const BVH8 & bvh);
+	float calc_sah_cost(const BVH  & bvh); // Dispatches on cpu_config.bvh_type
+
+	// Refits the BVH of the MeshData after its Triangles (or CurveSegments) have been updated by the caller. If the SAH cost has degraded by
+	// more than a factor of cpu_config.bvh_refit_rebuild_threshold relative to the BVH at the time it was built, it is rebuilt instead
+	// Returns true if the BVH was rebuilt, in which case its topology (and Node count) may have changed and it should be uploaded in full
+	bool refit_or_rebuild(MeshData & mesh_data);
+}
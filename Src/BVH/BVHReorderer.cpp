@@ -0,0 +1,349 @@
+#include "BVHReorderer.h"
+
+#include "Core/Sort.h"
+#include "Core/Timer.h"
+
+#include "BVH/BVHQuantizer.h"
+
+// Siblings (the two children of a BVH2 Node, or all internal children of a BVH8 Node) have to be stored contiguously,
+// so a layout is an order of these groups of siblings. The root forms a group of its own
+struct NodeGroup {
+	int first_node; // Index of the first Node of the group in the original layout
+	int node_count;
+
+	float area; // Surface area of the parent of the group, larger groups are more likely to be visited
+
+	int first_child; // Offset into GroupTree::child_groups
+	int child_count;
+};
+
+struct GroupTree {
+	Array<NodeGroup> groups; // Breadth first, so children always come after their parent
+	Array<int>       child_groups;
+};
+
+// Total size in bytes of a single BFS treelet
+static constexpr int BFS_TREELET_SIZE = 512;
+
+static void add_child_group(GroupTree & tree, int first_node, int node_count, float area) {
+	tree.child_groups.push_back(int(tree.groups.size()));
+
+	NodeGroup & group = tree.groups.emplace_back();
+	group.first_node = first_node;
+	group.node_count = node_count;
+	group.area       = area;
+}
+
+static GroupTree build_group_tree(const BVH2 & bvh) {
+	GroupTree tree;
+
+	// The dummy Node at index 1 is kept next to the root
+	NodeGroup & root = tree.groups.emplace_back();
+	root.first_node = 0;
+	root.node_count = 2;
+
+	for (size_t g = 0; g < tree.groups.size(); g++) {
+		tree.groups[g].first_child = int(tree.child_groups.size());
+
+		int first_node = tree.groups[g].first_node;
+		int node_count = tree.groups[g].node_count;
+
+		for (int i = first_node; i < first_node + node_count; i++) {
+			if (i == 1) continue; // Dummy
+
+			const BVHNode2 & node = bvh.nodes[i];
+			if (!node.is_leaf()) {
+				add_child_group(tree, node.left, 2, node.aabb.surface_area());
+			}
+		}
+
+		tree.groups[g].child_count = int(tree.child_groups.size()) - tree.groups[g].first_child;
+	}
+
+	return tree;
+}
+
+static GroupTree build_group_tree(const BVH8 & bvh) {
+	GroupTree tree;
+
+	NodeGroup & root = tree.groups.emplace_back();
+	root.first_node = 0;
+	root.node_count = 1;
+
+	for (size_t g = 0; g < tree.groups.size(); g++) {
+		tree.groups[g].first_child = int(tree.child_groups.size());
+
+		int first_node = tree.groups[g].first_node;
+		int node_count = tree.groups[g].node_count;
+
+		for (int i = first_node; i < first_node + node_count; i++) {
+			const BVHNode8 & node = bvh.nodes[i];
+			if (node.imask == 0) continue;
+
+			AABB aabb        = AABB::create_empty();
+			int  child_count = 0;
+
+			for (int c = 0; c < 8; c++) {
+				if (node.meta[c] != 0) aabb.expand(BVHQuantizer::get_child_aabb(node, c));
+				if (node.imask & (1 << c)) child_count++;
+			}
+
+			add_child_group(tree, node.base_index_child, child_count, aabb.surface_area());
+		}
+
+		tree.groups[g].child_count = int(tree.child_groups.size()) - tree.groups[g].first_child;
+	}
+
+	return tree;
+}
+
+// Returns the children of the group, sorted by decreasing area
+static int get_children_sorted(const GroupTree & tree, int group_index, int children[8]) {
+	const NodeGroup & group = tree.groups[group_index];
+	ASSERT(group.child_count <= 8);
+
+	for (int i = 0; i < group.child_count; i++) {
+		children[i] = tree.child_groups[group.first_child + i];
+	}
+
+	// Insertion sort, there are at most 8 children
+	for (int i = 1; i < group.child_count; i++) {
+		int child = children[i];
+		int j = i;
+		while (j > 0 && tree.groups[children[j - 1]].area < tree.groups[child].area) {
+			children[j] = children[j - 1];
+			j--;
+		}
+		children[j] = child;
+	}
+
+	return group.child_count;
+}
+
+static void order_dfs(const GroupTree & tree, Array<int> & order) {
+	Array<int> stack;
+	stack.push_back(0);
+
+	while (stack.size() > 0) {
+		int group_index = stack.back();
+		stack.pop_back();
+
+		order.push_back(group_index);
+
+		int children[8];
+		int child_count = get_children_sorted(tree, group_index, children);
+
+		// Push in reverse so that the largest child is popped first
+		for (int i = child_count - 1; i >= 0; i--) {
+			stack.push_back(children[i]);
+		}
+	}
+}
+
+static void order_bfs_treelets(const GroupTree & tree, Array<int> & order, int treelet_node_count) {
+	Array<int> treelet_roots;
+	treelet_roots.push_back(0);
+
+	Array<int> queue;
+
+	while (treelet_roots.size() > 0) {
+		int treelet_root = treelet_roots.back();
+		treelet_roots.pop_back();
+
+		queue.clear();
+		queue.push_back(treelet_root);
+
+		// Grow the treelet breadth first, the first group is always accepted
+		size_t queue_head = 0;
+		int    node_count = 0;
+
+		while (queue_head < queue.size()) {
+			int group_index = queue[queue_head];
+			if (node_count > 0 && node_count + tree.groups[group_index].node_count > treelet_node_count) break;
+
+			queue_head++;
+			order.push_back(group_index);
+			node_count += tree.groups[group_index].node_count;
+
+			int children[8];
+			int child_count = get_children_sorted(tree, group_index, children);
+
+			for (int i = 0; i < child_count; i++) {
+				queue.push_back(children[i]);
+			}
+		}
+
+		// Groups that did not fit start new treelets, pushed in reverse so that the largest is laid out first
+		for (size_t i = queue.size(); i > queue_head; i--) {
+			treelet_roots.push_back(queue[i - 1]);
+		}
+	}
+}
+
+static void collect_groups_at_depth(const GroupTree & tree, int group_index, int depth, Array<int> & result) {
+	if (depth == 0) {
+		result.push_back(group_index);
+		return;
+	}
+
+	const NodeGroup & group = tree.groups[group_index];
+	for (int i = 0; i < group.child_count; i++) {
+		collect_groups_at_depth(tree, tree.child_groups[group.first_child + i], depth - 1, result);
+	}
+}
+
+// Lays out the top 'levels' levels of the subtree below the given group: first the top half of these levels,
+// then each of the subtrees hanging below the top half, both recursively in the same way
+static void order_veb(const GroupTree & tree, const Array<int> & heights, int group_index, int levels, Array<int> & order, Array<int> & frontier) {
+	levels = Math::min(levels, heights[group_index]);
+
+	if (levels == 1) {
+		order.push_back(group_index);
+		return;
+	}
+
+	int levels_top    = levels / 2;
+	int levels_bottom = levels - levels_top;
+
+	order_veb(tree, heights, group_index, levels_top, order, frontier);
+
+	// The frontier is shared between recursive calls, every call removes the groups it added before returning
+	size_t frontier_offset = frontier.size();
+	collect_groups_at_depth(tree, group_index, levels_top, frontier);
+	size_t frontier_end = frontier.size();
+
+	for (size_t i = frontier_offset; i < frontier_end; i++) {
+		order_veb(tree, heights, frontier[i], levels_bottom, order, frontier);
+	}
+
+	while (frontier.size() > frontier_offset) {
+		frontier.pop_back();
+	}
+}
+
+static Array<int> calc_group_order(const GroupTree & tree, BVHNodeOrder order, int treelet_node_count) {
+	Array<int> group_order;
+
+	switch (order) {
+		case BVHNodeOrder::DFS: order_dfs(tree, group_order); break;
+
+		case BVHNodeOrder::BFS_TREELET: order_bfs_treelets(tree, group_order, treelet_node_count); break;
+
+		case BVHNodeOrder::VEB: {
+			// Height of every group, in groups. Children come after their parent, so iterate in reverse
+			Array<int> heights(tree.groups.size());
+			for (size_t g = tree.groups.size(); g > 0; g--) {
+				const NodeGroup & group = tree.groups[g - 1];
+
+				int height = 0;
+				for (int i = 0; i < group.child_count; i++) {
+					height = Math::max(height, heights[tree.child_groups[group.first_child + i]]);
+				}
+				heights[g - 1] = height + 1;
+			}
+
+			Array<int> frontier;
+			order_veb(tree, heights, 0, heights[0], group_order, frontier);
+			break;
+		}
+
+		default: ASSERT_UNREACHABLE();
+	}
+
+	ASSERT(group_order.size() == tree.groups.size());
+	ASSERT(group_order[0] == 0);
+
+	return group_order;
+}
+
+// Returns for every Node in the original layout its index in the new layout, or INVALID if it is unreachable
+static Array<int> calc_node_permutation(size_t node_count, const GroupTree & tree, const Array<int> & group_order, size_t * new_node_count) {
+	Array<int> permutation(node_count);
+	for (size_t i = 0; i < node_count; i++) {
+		permutation[i] = INVALID;
+	}
+
+	int offset = 0;
+	for (size_t i = 0; i < group_order.size(); i++) {
+		const NodeGroup & group = tree.groups[group_order[i]];
+
+		for (int j = 0; j < group.node_count; j++) {
+			permutation[group.first_node + j] = offset++;
+		}
+	}
+
+	*new_node_count = offset;
+	return permutation;
+}
+
+static void apply_group_order(BVH2 & bvh, const GroupTree & tree, const Array<int> & group_order) {
+	size_t     new_node_count = 0;
+	Array<int> permutation    = calc_node_permutation(bvh.nodes.size(), tree, group_order, &new_node_count);
+
+	Array<BVHNode2> new_nodes(new_node_count, bvh.nodes.allocator);
+
+	for (size_t i = 0; i < bvh.nodes.size(); i++) {
+		if (permutation[i] == INVALID) continue;
+
+		BVHNode2 & node = new_nodes[permutation[i]];
+		node = bvh.nodes[i];
+
+		if (i != 1 && !node.is_leaf()) {
+			node.left = permutation[node.left];
+		}
+	}
+
+	bvh.nodes = std::move(new_nodes);
+}
+
+void BVHReorderer::reorder(BVH2 & bvh, BVHNodeOrder order) {
+	if (order == BVHNodeOrder::NONE || bvh.nodes.size() <= 2) return;
+
+	ScopeTimer timer("BVH Node Reordering"_sv);
+
+	GroupTree tree = build_group_tree(bvh);
+	apply_group_order(bvh, tree, calc_group_order(tree, order, BFS_TREELET_SIZE / sizeof(BVHNode2)));
+}
+
+void BVHReorderer::compact(BVH2 & bvh) {
+	if (bvh.nodes.size() <= 2) return;
+
+	GroupTree tree = build_group_tree(bvh);
+
+	Array<int> group_order(tree.groups.size());
+	for (size_t i = 0; i < tree.groups.size(); i++) {
+		group_order[i] = int(i);
+	}
+	Sort::quick_sort(group_order.begin(), group_order.end(), [&tree](int a, int b) {
+		return tree.groups[a].first_node < tree.groups[b].first_node;
+	});
+
+	apply_group_order(bvh, tree, group_order);
+}
+
+void BVHReorderer::reorder(BVH8 & bvh, BVHNodeOrder order) {
+	if (order == BVHNodeOrder::NONE || bvh.nodes.size() <= 1) return;
+
+	ScopeTimer timer("BVH8 Node Reordering"_sv);
+
+	GroupTree  tree        = build_group_tree(bvh);
+	Array<int> group_order = calc_group_order(tree, order, BFS_TREELET_SIZE / sizeof(BVHNode8));
+
+	size_t     new_node_count = 0;
+	Array<int> permutation    = calc_node_permutation(bvh.nodes.size(), tree, group_order, &new_node_count);
+
+	Array<BVHNode8> new_nodes(new_node_count, bvh.nodes.allocator);
+
+	for (size_t i = 0; i < bvh.nodes.size(); i++) {
+		if (permutation[i] == INVALID) continue;
+
+		BVHNode8 & node = new_nodes[permutation[i]];
+		node = bvh.nodes[i];
+
+		if (node.imask != 0) {
+			node.base_index_child = permutation[node.base_index_child];
+		}
+	}
+
+	bvh.nodes = std::move(new_nodes);
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include "BVH.h"
+
+namespace BVHReorderer {
+	// Rewrites the Nodes of the BVH in the given order, to better match the memory access patterns of traversal
+	// Sibling Nodes stay adjacent and the root stays at index 0 (followed by the dummy Node for BVH2)
+	// Nodes that are not reachable from the root (e.g. left behind by SAH based leaf termination) are removed
+	void reorder(BVH2 & bvh, BVHNodeOrder order);
+	void reorder(BVH8 & bvh, BVHNodeOrder order);
+
+	// Removes all Nodes that are not reachable from the root, while keeping the relative order of the remaining Nodes
+	void compact(BVH2 & bvh);
+}
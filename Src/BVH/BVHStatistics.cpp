@@ -0,0 +1,465 @@
+#include "BVHStatistics.h"
+
+#include <stdio.h>
+
+#include "Config.h"
+
+#include "Core/IO.h"
+
+#include "CUDA/Common.h"
+
+#include "BVH/BVHQuantizer.h"
+#include "BVH/BVHRefitter.h"
+
+#include "Renderer/Mesh.h"
+#include "Renderer/MeshData.h"
+
+#include "Util/StringUtil.h"
+#include "Util/ThreadPool.h"
+
+// BVH type independent representation of a BVH, where every AABB a ray can be tested against is a separate Node
+// For wide BVHs this means every child slot becomes a Node, the root Node has the union of the root's children as its AABB
+struct StatisticsNode {
+	AABB aabb;
+	int  depth;
+
+	int first_child; // Internal Nodes only
+	int child_count;
+
+	int first_primitive; // Leaves only, offset into the indices of the BVH
+	int primitive_count;
+
+	bool is_leaf() const { return primitive_count > 0; }
+};
+
+static int add_children(Array<StatisticsNode> & nodes, int node_index, int child_count) {
+	int first_child = int(nodes.size());
+	int depth       = nodes[node_index].depth + 1;
+
+	nodes[node_index].first_child = first_child;
+	nodes[node_index].child_count = child_count;
+
+	for (int i = 0; i < child_count; i++) {
+		StatisticsNode & child = nodes.emplace_back();
+		child.depth = depth;
+	}
+	return first_child;
+}
+
+static void flatten(const BVH2 & bvh, int node_index, Array<StatisticsNode> & nodes, int index) {
+	const BVHNode2 & node = bvh.nodes[node_index];
+	nodes[index].aabb = node.aabb;
+
+	if (node.is_leaf()) {
+		nodes[index].first_primitive = node.first;
+		nodes[index].primitive_count = node.count;
+	} else {
+		int first_child = add_children(nodes, index, 2);
+		flatten(bvh, node.left,     nodes, first_child);
+		flatten(bvh, node.left + 1, nodes, first_child + 1);
+	}
+}
+
+// Flattens the children of the given BVH4 Node into the children of the StatisticsNode at the given index
+static void flatten(const BVH4 & bvh, int node_index, Array<StatisticsNode> & nodes, int index) {
+	const BVHNode4 & node = bvh.nodes[node_index];
+
+	int child_count = node.get_child_count();
+	int first_child = add_children(nodes, index, child_count);
+
+	for (int i = 0; i < child_count; i++) {
+		nodes[first_child + i].aabb = node.get_child_aabb(i);
+
+		if (node.is_leaf(i)) {
+			nodes[first_child + i].first_primitive = node.get_index(i);
+			nodes[first_child + i].primitive_count = node.get_count(i);
+		} else {
+			flatten(bvh, node.get_index(i), nodes, first_child + i);
+		}
+	}
+}
+
+// Flattens the children of the given BVH8 Node into the children of the StatisticsNode at the given index
+static void flatten(const BVH8 & bvh, int node_index, Array<StatisticsNode> & nodes, int index) {
+	const BVHNode8 & node = bvh.nodes[node_index];
+
+	int child_count = 0;
+	for (int i = 0; i < 8; i++) {
+		if (node.meta[i] != 0) child_count++;
+	}
+	int first_child = add_children(nodes, index, child_count);
+
+	int child_index = first_child;
+	for (int i = 0; i < 8; i++) {
+		if (node.meta[i] == 0) continue; // Empty slot
+
+		nodes[child_index].aabb = BVHQuantizer::get_child_aabb(node, i);
+
+		if (node.is_leaf(i)) {
+			node.get_leaf_triangles(i, nodes[child_index].first_primitive, nodes[child_index].primitive_count);
+		} else {
+			flatten(bvh, node.get_child_node_index(i), nodes, child_index);
+		}
+		child_index++;
+	}
+}
+
+static Array<StatisticsNode> flatten(const BVH & bvh) {
+	Array<StatisticsNode> nodes;
+	nodes.emplace_back();
+
+	switch (cpu_config.bvh_type) {
+		case BVHType::BVH:
+		case BVHType::SBVH: flatten(static_cast<const BVH2 &>(bvh), 0, nodes, 0); break;
+		case BVHType::BVH4: flatten(static_cast<const BVH4 &>(bvh), 0, nodes, 0); break;
+		case BVHType::BVH8: flatten(static_cast<const BVH8 &>(bvh), 0, nodes, 0); break;
+		default: ASSERT_UNREACHABLE();
+	}
+
+	// Wide BVHs store no AABB for the root itself
+	if (cpu_config.bvh_type == BVHType::BVH4 || cpu_config.bvh_type == BVHType::BVH8) {
+		AABB aabb = AABB::create_empty();
+		for (int i = 0; i < nodes[0].child_count; i++) {
+			aabb.expand(nodes[nodes[0].first_child + i].aabb);
+		}
+		nodes[0].aabb = aabb;
+	}
+
+	return nodes;
+}
+
+static size_t get_node_size() {
+	switch (cpu_config.bvh_type) {
+		case BVHType::BVH:
+		case BVHType::SBVH: return sizeof(BVHNode2);
+		case BVHType::BVH4: return sizeof(BVHNode4);
+		case BVHType::BVH8: return sizeof(BVHNode8);
+		default: ASSERT_UNREACHABLE();
+	}
+}
+
+// Fills in all statistics that only depend on the structure of the BVH
+static BVHStatistics calculate_structure(String name, const BVH & bvh, size_t primitive_count, const Array<StatisticsNode> & nodes) {
+	BVHStatistics statistics = { };
+	statistics.name            = std::move(name);
+	statistics.node_count      = bvh.node_count();
+	statistics.primitive_count = primitive_count;
+	statistics.epo             = -1.0f;
+	statistics.stack_size      = BVH_STACK_SIZE;
+
+	double surface_area_parents = 0.0;
+	double surface_area_overlap = 0.0;
+
+	for (size_t n = 0; n < nodes.size(); n++) {
+		const StatisticsNode & node = nodes[n];
+
+		if (node.is_leaf()) {
+			statistics.reference_count += node.primitive_count;
+			statistics.max_depth = Math::max(statistics.max_depth, node.depth);
+
+			if (statistics.leaf_size_histogram.size() <= node.primitive_count) statistics.leaf_size_histogram.resize(node.primitive_count + 1);
+			if (statistics.depth_histogram    .size() <= node.depth)           statistics.depth_histogram    .resize(node.depth + 1);
+
+			statistics.leaf_size_histogram[node.primitive_count]++;
+			statistics.depth_histogram[node.depth]++;
+		} else {
+			surface_area_parents += node.aabb.surface_area();
+
+			for (int i = 0; i < node.child_count; i++) {
+				for (int j = i + 1; j < node.child_count; j++) {
+					AABB overlap = AABB::overlap(nodes[node.first_child + i].aabb, nodes[node.first_child + j].aabb);
+					if (overlap.is_valid()) {
+						surface_area_overlap += overlap.surface_area();
+					}
+				}
+			}
+		}
+	}
+
+	if (surface_area_parents > 0.0) {
+		statistics.overlap_ratio = float(surface_area_overlap / surface_area_parents);
+	}
+	if (primitive_count > 0) {
+		statistics.bytes_per_primitive = float(statistics.node_count * get_node_size() + bvh.indices.size() * sizeof(int)) / float(primitive_count);
+		statistics.duplication_factor  = float(statistics.reference_count) / float(primitive_count);
+	}
+
+	return statistics;
+}
+
+static float calc_triangle_area(const Vector3 & position_0, const Vector3 & position_1, const Vector3 & position_2) {
+	return 0.5f * Vector3::length(Vector3::cross(position_1 - position_0, position_2 - position_0));
+}
+
+// Surface area of the part of the Triangle that lies inside the AABB, by clipping it against all 6 planes (Sutherland-Hodgman)
+static float calc_clipped_area(const Triangle & triangle, const AABB & aabb) {
+	static constexpr int MAX_VERTEX_COUNT = 16;
+
+	Vector3 polygon[2][MAX_VERTEX_COUNT];
+	polygon[0][0] = triangle.position_0;
+	polygon[0][1] = triangle.position_1;
+	polygon[0][2] = triangle.position_2;
+
+	int vertex_count = 3;
+	int current      = 0;
+
+	for (int dimension = 0; dimension < 3; dimension++) {
+		for (int side = 0; side < 2; side++) {
+			const Vector3 * vertices_in  = polygon[current];
+			      Vector3 * vertices_out = polygon[1 - current];
+			int vertex_count_out = 0;
+
+			// Signed distance to the plane, positive on the inside
+			auto distance = [&](const Vector3 & vertex) {
+				return side == 0 ? vertex[dimension] - aabb.min[dimension] : aabb.max[dimension] - vertex[dimension];
+			};
+
+			for (int i = 0; i < vertex_count; i++) {
+				const Vector3 & a = vertices_in[i];
+				const Vector3 & b = vertices_in[(i + 1) % vertex_count];
+
+				float distance_a = distance(a);
+				float distance_b = distance(b);
+
+				if (distance_a >= 0.0f) {
+					vertices_out[vertex_count_out++] = a;
+				}
+				if ((distance_a >= 0.0f) != (distance_b >= 0.0f)) {
+					vertices_out[vertex_count_out++] = a + (b - a) * (distance_a / (distance_a - distance_b));
+				}
+				ASSERT(vertex_count_out <= MAX_VERTEX_COUNT - 2);
+			}
+
+			vertex_count = vertex_count_out;
+			current      = 1 - current;
+
+			if (vertex_count < 3) return 0.0f;
+		}
+	}
+
+	float area = 0.0f;
+	for (int i = 1; i < vertex_count - 1; i++) {
+		area += calc_triangle_area(polygon[current][0], polygon[current][i], polygon[current][i + 1]);
+	}
+	return area;
+}
+
+static bool aabbs_touch(const AABB & a, const AABB & b) {
+	return
+		a.min.x <= b.max.x && a.max.x >= b.min.x &&
+		a.min.y <= b.max.y && a.max.y >= b.min.y &&
+		a.min.z <= b.max.z && a.max.z >= b.min.z;
+}
+
+// Effective Primitive Overlap (Aila et al. 2013): for every Node, the surface area of all Triangles (or parts thereof)
+// that lie inside its AABB without being in its subtree, weighted by the SAH cost of the Node and normalized by the total Triangle area
+static float calc_epo(const Array<StatisticsNode> & nodes, const Array<int> & indices, const Array<Triangle> & triangles) {
+	double area_total = 0.0;
+	for (size_t i = 0; i < triangles.size(); i++) {
+		area_total += calc_triangle_area(triangles[i].position_0, triangles[i].position_1, triangles[i].position_2);
+	}
+	if (area_total == 0.0) return 0.0f;
+
+	int chunk_count = 1;
+	if (ThreadPool::get_thread_count() > 0) {
+		chunk_count = ThreadPool::get_thread_count() + 1;
+	}
+
+	Array<double> epo_chunks(chunk_count);
+
+	auto calc_epo_chunk = [&](int chunk) {
+		// Triangles are stamped per Node, so that they are counted at most once per Node even if they are referenced multiple times (SBVH)
+		Array<int> stamps(triangles.size());
+		Array<int> stack;
+
+		double epo = 0.0;
+
+		// The root contains all Triangles in its subtree, so it is skipped
+		for (int n = 1 + chunk; n < int(nodes.size()); n += chunk_count) {
+			const StatisticsNode & node = nodes[n];
+
+			int stamp_inside  = 2 * n + 1;
+			int stamp_outside = 2 * n + 2;
+
+			// Mark all Triangles in the subtree of the Node
+			stack.clear();
+			stack.push_back(n);
+			while (stack.size() > 0) {
+				const StatisticsNode & subtree_node = nodes[stack.back()];
+				stack.pop_back();
+
+				if (subtree_node.is_leaf()) {
+					for (int i = subtree_node.first_primitive; i < subtree_node.first_primitive + subtree_node.primitive_count; i++) {
+						stamps[indices[i]] = stamp_inside;
+					}
+				} else {
+					for (int i = 0; i < subtree_node.child_count; i++) {
+						stack.push_back(subtree_node.first_child + i);
+					}
+				}
+			}
+
+			// Find all other Triangles that overlap the AABB of the Node
+			double area = 0.0;
+
+			stack.clear();
+			stack.push_back(0);
+			while (stack.size() > 0) {
+				int other_index = stack.back();
+				stack.pop_back();
+				if (other_index == n) continue;
+
+				const StatisticsNode & other = nodes[other_index];
+				if (!aabbs_touch(other.aabb, node.aabb)) continue;
+
+				if (other.is_leaf()) {
+					for (int i = other.first_primitive; i < other.first_primitive + other.primitive_count; i++) {
+						int triangle_index = indices[i];
+
+						if (stamps[triangle_index] == stamp_inside || stamps[triangle_index] == stamp_outside) continue;
+						stamps[triangle_index] = stamp_outside;
+
+						area += calc_clipped_area(triangles[triangle_index], node.aabb);
+					}
+				} else {
+					for (int i = 0; i < other.child_count; i++) {
+						stack.push_back(other.first_child + i);
+					}
+				}
+			}
+
+			float cost = node.is_leaf() ? cpu_config.sah_cost_leaf * float(node.primitive_count) : cpu_config.sah_cost_node;
+			epo += cost * area;
+		}
+
+		epo_chunks[chunk] = epo;
+	};
+
+	if (chunk_count > 1) {
+		ThreadPool::parallel_for(chunk_count, calc_epo_chunk);
+	} else {
+		calc_epo_chunk(0);
+	}
+
+	double epo = 0.0;
+	for (int i = 0; i < chunk_count; i++) {
+		epo += epo_chunks[i];
+	}
+	return float(epo / area_total);
+}
+
+BVHStatistics BVHStatistics::calculate(String name, const MeshData & mesh_data) {
+	const BVH & bvh = *mesh_data.bvh.get();
+
+	Array<StatisticsNode> nodes = flatten(bvh);
+
+	BVHStatistics statistics = calculate_structure(std::move(name), bvh, mesh_data.primitive_count(), nodes);
+
+	statistics.sah_cost = BVHRefitter::calc_sah_cost(bvh);
+	statistics.epo      = mesh_data.has_curves() ? -1.0f : calc_epo(nodes, bvh.indices, mesh_data.triangles);
+
+	return statistics;
+}
+
+BVHStatistics BVHStatistics::calculate(String name, const BVH & tlas, const Array<Mesh> & meshes) {
+	Array<StatisticsNode> nodes = flatten(tlas);
+
+	BVHStatistics statistics = calculate_structure(std::move(name), tlas, meshes.size(), nodes);
+	statistics.sah_cost = BVHRefitter::calc_sah_cost(tlas);
+
+	return statistics;
+}
+
+static const char * get_bvh_type_name(BVHType bvh_type) {
+	switch (bvh_type) {
+		case BVHType::BVH:  return "BVH";
+		case BVHType::SBVH: return "SBVH";
+		case BVHType::BVH4: return "BVH4";
+		case BVHType::BVH8: return "BVH8";
+		default: ASSERT_UNREACHABLE();
+	}
+}
+
+static void write_histogram(FILE * file, const Array<int> & histogram, const char * separator) {
+	for (size_t i = 0; i < histogram.size(); i++) {
+		if (i > 0) fprintf(file, "%s", separator);
+		fprintf(file, "%i", histogram[i]);
+	}
+}
+
+// Writes the string with quotes, escaping characters where needed (Windows paths contain backslashes)
+static void write_string(FILE * file, const String & str, bool csv) {
+	fputc('"', file);
+	for (size_t i = 0; i < str.size(); i++) {
+		char c = str.data()[i];
+		if (c == '"') {
+			fputc(csv ? '"' : '\\', file);
+		} else if (c == '\\' && !csv) {
+			fputc('\\', file);
+		}
+		fputc(c, file);
+	}
+	fputc('"', file);
+}
+
+void BVHStatistics::write_report(const String & filename, const Array<BVHStatistics> & statistics) {
+	FILE * file = nullptr;
+	fopen_s(&file, filename.data(), "wb");
+
+	if (!file) {
+		IO::print("BVHStatistics: Failed to write report '{}'!\n"_sv, filename);
+		return;
+	}
+
+	if (Util::get_file_extension(filename.view()) == "csv"_sv) {
+		fprintf(file, "name,node_count,primitive_count,reference_count,sah_cost,epo,overlap_ratio,bytes_per_primitive,duplication_factor,max_depth,stack_size,leaf_size_histogram,depth_histogram\n");
+
+		for (size_t i = 0; i < statistics.size(); i++) {
+			const BVHStatistics & stats = statistics[i];
+
+			write_string(file, stats.name, true);
+			fprintf(file, ",%zu,%zu,%zu,%f,", stats.node_count, stats.primitive_count, stats.reference_count, stats.sah_cost);
+			if (stats.epo >= 0.0f) fprintf(file, "%f", stats.epo);
+			fprintf(file, ",%f,%f,%f,%i,%i,", stats.overlap_ratio, stats.bytes_per_primitive, stats.duplication_factor, stats.max_depth, stats.stack_size);
+			write_histogram(file, stats.leaf_size_histogram, ";");
+			fprintf(file, ",");
+			write_histogram(file, stats.depth_histogram, ";");
+			fprintf(file, "\n");
+		}
+	} else {
+		fprintf(file, "{\n\t\"bvh_type\": \"%s\",\n\t\"bvhs\": [\n", get_bvh_type_name(cpu_config.bvh_type));
+
+		for (size_t i = 0; i < statistics.size(); i++) {
+			const BVHStatistics & stats = statistics[i];
+
+			fprintf(file, "\t\t{\n\t\t\t\"name\": ");
+			write_string(file, stats.name, false);
+			fprintf(file, ",\n");
+			fprintf(file, "\t\t\t\"node_count\": %zu,\n",          stats.node_count);
+			fprintf(file, "\t\t\t\"primitive_count\": %zu,\n",     stats.primitive_count);
+			fprintf(file, "\t\t\t\"reference_count\": %zu,\n",     stats.reference_count);
+			fprintf(file, "\t\t\t\"sah_cost\": %f,\n",             stats.sah_cost);
+			if (stats.epo >= 0.0f) {
+				fprintf(file, "\t\t\t\"epo\": %f,\n", stats.epo);
+			} else {
+				fprintf(file, "\t\t\t\"epo\": null,\n");
+			}
+			fprintf(file, "\t\t\t\"overlap_ratio\": %f,\n",        stats.overlap_ratio);
+			fprintf(file, "\t\t\t\"bytes_per_primitive\": %f,\n",  stats.bytes_per_primitive);
+			fprintf(file, "\t\t\t\"duplication_factor\": %f,\n",   stats.duplication_factor);
+			fprintf(file, "\t\t\t\"max_depth\": %i,\n",            stats.max_depth);
+			fprintf(file, "\t\t\t\"stack_size\": %i,\n",           stats.stack_size);
+			fprintf(file, "\t\t\t\"leaf_size_histogram\": [");
+			write_histogram(file, stats.leaf_size_histogram, ", ");
+			fprintf(file, "],\n\t\t\t\"depth_histogram\": [");
+			write_histogram(file, stats.depth_histogram, ", ");
+			fprintf(file, "]\n\t\t}%s\n", i + 1 < statistics.size() ? "," : "");
+		}
+
+		fprintf(file, "\t]\n}\n");
+	}
+
+	fclose(file);
+
+	IO::print("Written BVH statistics of {} BVHs to '{}'\n"_sv, statistics.size(), filename);
+}
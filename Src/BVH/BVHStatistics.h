@@ -0,0 +1,35 @@
+#pragma once
+#include "BVH.h"
+
+#include "Core/String.h"
+
+struct Mesh;
+struct MeshData;
+
+// Quality metrics of a single BVH, written to a machine readable report with --bvh-stats
+// so that BVH quality can be tracked across builder changes
+struct BVHStatistics {
+	String name;
+
+	size_t node_count;
+	size_t primitive_count; // Triangles for a BLAS, Meshes for the TLAS
+	size_t reference_count; // Primitive references in leaves, exceeds primitive_count if primitives were split (SBVH)
+
+	float sah_cost;
+	float epo;           // Effective Primitive Overlap (Aila et al. 2013), only calculated for BLASes over Triangles (negative otherwise)
+	float overlap_ratio; // Surface area of pairwise overlap between siblings, relative to the surface area of their parents
+
+	float bytes_per_primitive;
+	float duplication_factor; // reference_count / primitive_count
+
+	int        max_depth;
+	int        stack_size;          // BVH_STACK_SIZE of the GPU traversal, for comparison with max_depth
+	Array<int> leaf_size_histogram; // Number of leaves per number of primitives
+	Array<int> depth_histogram;     // Number of leaves per depth
+
+	static BVHStatistics calculate(String name, const MeshData & mesh_data);
+	static BVHStatistics calculate(String name, const BVH & tlas, const Array<Mesh> & meshes);
+
+	// Writes the statistics as JSON, or as CSV (one row per BVH, histograms as ';' separated lists) if the filename ends in .csv
+	static void write_report(const String & filename, const Array<BVHStatistics> & statistics);
+};
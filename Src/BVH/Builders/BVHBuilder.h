@@ -0,0 +1,25 @@
+#pragma once
+#include "BVH/BVH.h"
+
+struct Triangle;
+struct CurveSegment;
+struct Mesh;
+struct PrimitiveRef;
+
+// Builds a binary BVH (BVH2) over either Triangles (BLAS) or Meshes (TLAS)
+struct BVHBuilder {
+	// Nodes with at most this many primitives become a leaf if that is cheaper in terms of the SAH than splitting them further
+	// The default of 1 disables SAH termination, every leaf then contains exactly one primitive (required for the TLAS)
+	// NOTE: Only the SAH and binned SAH builders support this, the other builders always produce one primitive per leaf
+	int max_primitives_in_leaf = 1;
+
+	BVHBuilder() = default;
+
+	NON_COPYABLE(BVHBuilder);
+	NON_MOVEABLE(BVHBuilder);
+
+	virtual ~BVHBuilder() = default;
+
+	virtual void build(const Array<Triangle> & triangles) = 0;
+	virtual void build(const Array<Mesh>     & meshes)    = 0;
+};
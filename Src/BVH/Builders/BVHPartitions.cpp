@@ -1,9 +1,14 @@
 #include "BVHPartitions.h"
 
+#include "Config.h"
+
 #include "Renderer/Mesh.h"
 #include "Renderer/Triangle.h"
+#include "Renderer/Curve.h"
 #include "Core/IO.h"
 
+#include "Util/ThreadPool.h"
+
 // Evaluates SAH for every object for every dimension to determine splitting candidate
 template<typename GetAABB>
 ObjectSplit partition_sah_impl(GetAABB get_aabb, int first_index, int index_count, float * sah) {
@@ -60,6 +65,13 @@ ObjectSplit BVHPartitions::partition_sah(const Array<Triangle> & triangles, int
 	return partition_sah_impl(get_aabb, first_index, index_count, sah);
 }
 
+ObjectSplit BVHPartitions::partition_sah(const Array<CurveSegment> & curves, int * indices[3], int first_index, int index_count, float * sah) {
+	auto get_aabb = [&curves, &indices](int dimension, int index) {
+		return curves[indices[dimension][index]].get_aabb();
+	};
+	return partition_sah_impl(get_aabb, first_index, index_count, sah);
+}
+
 ObjectSplit BVHPartitions::partition_sah(const Array<Mesh> & meshes, int * indices[3], int first_index, int index_count, float * sah) {
 	auto get_aabb = [&meshes, &indices](int dimension, int index) {
 		return meshes[indices[dimension][index]].aabb;
@@ -67,6 +79,13 @@ ObjectSplit BVHPartitions::partition_sah(const Array<Mesh> & meshes, int * indic
 	return partition_sah_impl(get_aabb, first_index, index_count, sah);
 }
 
+ObjectSplit BVHPartitions::partition_sah(const Array<PrimitiveRef> & refs, int * indices[3], int first_index, int index_count, float * sah) {
+	auto get_aabb = [&refs, &indices](int dimension, int index) {
+		return refs[indices[dimension][index]].aabb;
+	};
+	return partition_sah_impl(get_aabb, first_index, index_count, sah);
+}
+
 ObjectSplit BVHPartitions::partition_sah(Array<PrimitiveRef> primitive_refs[3], int first_index, int index_count, float * sah) {
 	auto get_aabb = [&primitive_refs](int dimension, int index) {
 		return primitive_refs[dimension][index].aabb;
@@ -74,6 +93,133 @@ ObjectSplit BVHPartitions::partition_sah(Array<PrimitiveRef> primitive_refs[3],
 	return partition_sah_impl(get_aabb, first_index, index_count, sah);
 }
 
+// Bins primitive centroids along each dimension and only evaluates the SAH at the bin boundaries
+// Unlike the other partitions, the indices are partitioned in place (split.index is the first index that goes right)
+ObjectSplit BVHPartitions::partition_binned_sah(const Array<AABB> & aabbs, const Array<Vector3> & centers, int * indices, int first_index, int index_count, int bin_count) {
+	ASSERT(bin_count >= 2 && bin_count <= BINNED_SAH_MAX_BIN_COUNT);
+
+	ObjectSplit split = { };
+	split.cost = INFINITY;
+	split.index     = -1;
+	split.dimension = -1;
+	split.aabb_left  = AABB::create_empty();
+	split.aabb_right = AABB::create_empty();
+
+	AABB centroid_bounds = AABB::create_empty();
+	for (int i = first_index; i < first_index + index_count; i++) {
+		centroid_bounds.expand(centers[indices[i]]);
+	}
+
+	// Small nodes do not benefit from many bins, limit the bin count to reduce the per-node overhead
+	bin_count = Math::min(bin_count, 4 * index_count);
+
+	struct Bin {
+		AABB aabb;
+		int  count;
+	};
+	Bin bins[3][BINNED_SAH_MAX_BIN_COUNT];
+
+	float bin_scales[3];
+	for (int dimension = 0; dimension < 3; dimension++) {
+		float extent = centroid_bounds.max[dimension] - centroid_bounds.min[dimension];
+		bin_scales[dimension] = extent > 0.0f ? float(bin_count) / extent : 0.0f;
+
+		for (int b = 0; b < bin_count; b++) {
+			bins[dimension][b].aabb  = AABB::create_empty();
+			bins[dimension][b].count = 0;
+		}
+	}
+
+	auto get_bin = [&](const Vector3 & center, int dimension) {
+		return Math::min(int(bin_scales[dimension] * (center[dimension] - centroid_bounds.min[dimension])), bin_count - 1);
+	};
+
+	// Bin all primitives along all three dimensions in a single pass
+	for (int i = first_index; i < first_index + index_count; i++) {
+		int index = indices[i];
+
+		const AABB    & aabb   = aabbs  [index];
+		const Vector3 & center = centers[index];
+
+		for (int dimension = 0; dimension < 3; dimension++) {
+			Bin & bin = bins[dimension][get_bin(center, dimension)];
+			bin.aabb.expand(aabb);
+			bin.count++;
+		}
+	}
+
+	int split_bin = -1;
+
+	for (int dimension = 0; dimension < 3; dimension++) {
+		if (bin_scales[dimension] == 0.0f) continue; // All centroids coincide along this dimension, no split possible
+
+		float bin_sah    [BINNED_SAH_MAX_BIN_COUNT];
+		AABB  bounds_left[BINNED_SAH_MAX_BIN_COUNT];
+
+		// First traverse left to right along the current dimension to evaluate first half of the SAH
+		AABB aabb_left  = AABB::create_empty();
+		int  count_left = 0;
+
+		for (int b = 1; b < bin_count; b++) {
+			aabb_left.expand(bins[dimension][b-1].aabb);
+			count_left += bins[dimension][b-1].count;
+
+			bounds_left[b] = aabb_left;
+			bin_sah    [b] = count_left > 0 ? aabb_left.surface_area() * float(count_left) : INFINITY;
+		}
+
+		// Then traverse right to left along the current dimension to evaluate second half of the SAH
+		AABB aabb_right  = AABB::create_empty();
+		int  count_right = 0;
+
+		for (int b = bin_count - 1; b > 0; b--) {
+			aabb_right.expand(bins[dimension][b].aabb);
+			count_right += bins[dimension][b].count;
+
+			if (count_right == 0) continue;
+
+			float cost = bin_sah[b] + aabb_right.surface_area() * float(count_right);
+			if (cost < split.cost) {
+				split.cost = cost;
+				split.dimension = dimension;
+				split.aabb_left  = bounds_left[b];
+				split.aabb_right = aabb_right;
+
+				split_bin = b;
+			}
+		}
+	}
+
+	if (split.dimension == -1) {
+		// All centroids coincide, fall back to splitting the primitives in half
+		split.index     = first_index + index_count / 2;
+		split.dimension = 0;
+
+		for (int i = first_index; i < split.index;               i++) split.aabb_left .expand(aabbs[indices[i]]);
+		for (int i = split.index; i < first_index + index_count; i++) split.aabb_right.expand(aabbs[indices[i]]);
+
+		return split;
+	}
+
+	// Partition indices in place based on which side of the split bin their centroid lies
+	int * left  = indices + first_index;
+	int * right = indices + first_index + index_count - 1;
+
+	while (left <= right) {
+		if (get_bin(centers[*left], split.dimension) < split_bin) {
+			left++;
+		} else {
+			Util::swap(*left, *right);
+			right--;
+		}
+	}
+
+	split.index = int(left - indices);
+	ASSERT(split.index > first_index && split.index < first_index + index_count);
+
+	return split;
+}
+
 void BVHPartitions::triangle_intersect_plane(Vector3 vertices[3], int dimension, float plane, Vector3 intersections[], int * intersection_count) {
 	for (int i = 0; i < 3; i++) {
 		float vertex_i = vertices[i][dimension];
@@ -98,124 +244,171 @@ void BVHPartitions::triangle_intersect_plane(Vector3 vertices[3], int dimension,
 	}
 }
 
-SpatialSplit BVHPartitions::partition_spatial(const Array<Triangle> & triangles, const Array<PrimitiveRef> indices[3], int first_index, int index_count, float * sah, AABB bounds) {
-	// We use a binning of 256 split planes -Herdi
-	// Seems to be along each axis
-	SpatialSplit split = { };
-	split.cost = INFINITY;
-	split.index     = -1;
-	split.dimension = -1;
-	split.plane_distance = NAN;
+struct SpatialBin {
+	AABB aabb = AABB::create_empty();
+	int entries = 0;
+	int exits   = 0;
+};
 
-	for (int dimension = 0; dimension < 3; dimension++) {
-		float bounds_min  = bounds.min[dimension] - 0.001f;
-		float bounds_max  = bounds.max[dimension] + 0.001f;
-		float bounds_step = (bounds_max - bounds_min) / SBVH_BIN_COUNT;
+// Clips the references in the given range against the bins they overlap along the given dimension, and accumulates the result into the bins
+static void bin_spatial(const Array<Triangle> & triangles, const PrimitiveRef * refs, int ref_count, const AABB & bounds, int dimension, SpatialBin bins[BVHPartitions::SBVH_BIN_COUNT]) {
+	using BVHPartitions::SBVH_BIN_COUNT;
 
-		float inv_bounds_delta = 1.0f / (bounds_max - bounds_min);
+	float bounds_min  = bounds.min[dimension] - 0.001f;
+	float bounds_max  = bounds.max[dimension] + 0.001f;
+	float bounds_step = (bounds_max - bounds_min) / SBVH_BIN_COUNT;
 
-		struct Bin {
-			AABB aabb = AABB::create_empty();
-			int entries = 0;
-			int exits   = 0;
-		} bins[SBVH_BIN_COUNT];
+	float inv_bounds_delta = 1.0f / (bounds_max - bounds_min);
 
-		for (int i = first_index; i < first_index + index_count; i++) {
-			const Triangle & triangle = triangles[indices[dimension][i].index];
+	for (int i = 0; i < ref_count; i++) {
+		const Triangle & triangle = triangles[refs[i].index];
 
-			AABB triangle_aabb = indices[dimension][i].aabb;
+		AABB triangle_aabb = refs[i].aabb;
 
-			Vector3 vertices[3] = {
-				triangle.position_0,
-				triangle.position_1,
-				triangle.position_2
-			};
+		Vector3 vertices[3] = {
+			triangle.position_0,
+			triangle.position_1,
+			triangle.position_2
+		};
 
-			// Sort the vertices along the current dimension
-			if (vertices[0][dimension] > vertices[1][dimension]) Util::swap(vertices[0], vertices[1]);
-			if (vertices[1][dimension] > vertices[2][dimension]) Util::swap(vertices[1], vertices[2]);
-			if (vertices[0][dimension] > vertices[1][dimension]) Util::swap(vertices[0], vertices[1]);
+		// Sort the vertices along the current dimension
+		if (vertices[0][dimension] > vertices[1][dimension]) Util::swap(vertices[0], vertices[1]);
+		if (vertices[1][dimension] > vertices[2][dimension]) Util::swap(vertices[1], vertices[2]);
+		if (vertices[0][dimension] > vertices[1][dimension]) Util::swap(vertices[0], vertices[1]);
 
-			float triangle_aabb_min = triangle_aabb.min[dimension];
-			float triangle_aabb_max = triangle_aabb.max[dimension];
+		float triangle_aabb_min = triangle_aabb.min[dimension];
+		float triangle_aabb_max = triangle_aabb.max[dimension];
 
-			int bin_min = int(SBVH_BIN_COUNT * ((triangle_aabb_min - bounds_min) * inv_bounds_delta));
-			int bin_max = int(SBVH_BIN_COUNT * ((triangle_aabb_max - bounds_min) * inv_bounds_delta));
+		int bin_min = int(SBVH_BIN_COUNT * ((triangle_aabb_min - bounds_min) * inv_bounds_delta));
+		int bin_max = int(SBVH_BIN_COUNT * ((triangle_aabb_max - bounds_min) * inv_bounds_delta));
 
-			bin_min = Math::clamp(bin_min, 0, SBVH_BIN_COUNT - 1);
-			bin_max = Math::clamp(bin_max, 0, SBVH_BIN_COUNT - 1);
+		bin_min = Math::clamp(bin_min, 0, SBVH_BIN_COUNT - 1);
+		bin_max = Math::clamp(bin_max, 0, SBVH_BIN_COUNT - 1);
 
-			bins[bin_min].entries++;
-			bins[bin_max].exits++;
+		bins[bin_min].entries++;
+		bins[bin_max].exits++;
 
-			// Iterate over bins that intersect the AABB along the current dimension
-			for (int b = bin_min; b <= bin_max; b++) {
-				Bin & bin = bins[b];
+		// Iterate over bins that intersect the AABB along the current dimension
+		for (int b = bin_min; b <= bin_max; b++) {
+			SpatialBin & bin = bins[b];
 
-				float bin_left_plane  = bounds_min + float(b) * bounds_step;
-				float bin_right_plane = bin_left_plane + bounds_step;
+			float bin_left_plane  = bounds_min + float(b) * bounds_step;
+			float bin_right_plane = bin_left_plane + bounds_step;
 
-				ASSERT(bin.aabb.is_valid() || bin.aabb.is_empty());
+			ASSERT(bin.aabb.is_valid() || bin.aabb.is_empty());
 
-				// If all vertices lie outside the bin we don't care about this triangle
-				if (triangle_aabb_min >= bin_right_plane || triangle_aabb_max <= bin_left_plane) {
-					continue;
-				}
+			// If all vertices lie outside the bin we don't care about this triangle
+			if (triangle_aabb_min >= bin_right_plane || triangle_aabb_max <= bin_left_plane) {
+				continue;
+			}
 
-				// Calculate relevant portion of the AABB with regard to the two planes that define the current Bin
-				AABB triangle_aabb_clipped_against_bin = AABB::create_empty();
+			// Calculate relevant portion of the AABB with regard to the two planes that define the current Bin
+			AABB triangle_aabb_clipped_against_bin = AABB::create_empty();
 
-				// If all verticies lie between the two planes, the AABB is just the Triangle's entire AABB
-				if (triangle_aabb_min >= bin_left_plane && triangle_aabb_max <= bin_right_plane) {
+			// If all verticies lie between the two planes, the AABB is just the Triangle's entire AABB
+			if (triangle_aabb_min >= bin_left_plane && triangle_aabb_max <= bin_right_plane) {
+				triangle_aabb_clipped_against_bin = triangle_aabb;
+			} else {
+				Vector3 intersections[12];
+				int     intersection_count = 0;
+
+				if (triangle_aabb_min <= bin_left_plane  && bin_left_plane  <= triangle_aabb_max) BVHPartitions::triangle_intersect_plane(vertices, dimension, bin_left_plane,  intersections, &intersection_count);
+				if (triangle_aabb_min <= bin_right_plane && bin_right_plane <= triangle_aabb_max) BVHPartitions::triangle_intersect_plane(vertices, dimension, bin_right_plane, intersections, &intersection_count);
+
+				// Gives assertion error on crytek sponza, original was < not <=
+				ASSERT(intersection_count <= Util::array_count(intersections));
+
+				if (intersection_count == 0) {
 					triangle_aabb_clipped_against_bin = triangle_aabb;
 				} else {
-					Vector3 intersections[12];
-					int     intersection_count = 0;
+					// All intersection points should be included in the AABB
+					triangle_aabb_clipped_against_bin = AABB::from_points(intersections, intersection_count);
 
-					if (triangle_aabb_min <= bin_left_plane  && bin_left_plane  <= triangle_aabb_max) triangle_intersect_plane(vertices, dimension, bin_left_plane,  intersections, &intersection_count);
-					if (triangle_aabb_min <= bin_right_plane && bin_right_plane <= triangle_aabb_max) triangle_intersect_plane(vertices, dimension, bin_right_plane, intersections, &intersection_count);
+					// If the middle vertex lies between the two planes it should be included in the AABB
+					if (vertices[1][dimension] >= bin_left_plane && vertices[1][dimension] < bin_right_plane) {
+						triangle_aabb_clipped_against_bin.expand(vertices[1]);
+					}
 
-					// Gives assertion error on crytek sponza, original was < not <=
-					ASSERT(intersection_count <= Util::array_count(intersections));
+					if (vertices[2][dimension] <= bin_right_plane && vertices[2][dimension] <= triangle_aabb_max) triangle_aabb_clipped_against_bin.expand(vertices[2]);
+					if (vertices[0][dimension] >= bin_left_plane  && vertices[0][dimension] >= triangle_aabb_min) triangle_aabb_clipped_against_bin.expand(vertices[0]);
 
-					if (intersection_count == 0) {
-						triangle_aabb_clipped_against_bin = triangle_aabb;
-					} else {
-						// All intersection points should be included in the AABB
-						triangle_aabb_clipped_against_bin = AABB::from_points(intersections, intersection_count);
+					triangle_aabb_clipped_against_bin = AABB::overlap(triangle_aabb_clipped_against_bin, triangle_aabb);
+				}
+			}
 
-						// If the middle vertex lies between the two planes it should be included in the AABB
-						if (vertices[1][dimension] >= bin_left_plane && vertices[1][dimension] < bin_right_plane) {
-							triangle_aabb_clipped_against_bin.expand(vertices[1]);
-						}
+			// Clip the AABB against the parent bounds
+			bin.aabb.expand(triangle_aabb_clipped_against_bin);
+			bin.aabb = AABB::overlap(bin.aabb, bounds);
 
-						if (vertices[2][dimension] <= bin_right_plane && vertices[2][dimension] <= triangle_aabb_max) triangle_aabb_clipped_against_bin.expand(vertices[2]);
-						if (vertices[0][dimension] >= bin_left_plane  && vertices[0][dimension] >= triangle_aabb_min) triangle_aabb_clipped_against_bin.expand(vertices[0]);
+			bin.aabb.fix_if_needed();
 
-						triangle_aabb_clipped_against_bin = AABB::overlap(triangle_aabb_clipped_against_bin, triangle_aabb);
-					}
-				}
+			// AABB must be valid
+			ASSERT(bin.aabb.is_valid() || bin.aabb.is_empty());
+
+			// The AABB of the current Bin cannot exceed the planes of the current Bin
+			const float epsilon = 0.01f;
+			ASSERT(bin.aabb.min[dimension] > bin_left_plane  - epsilon);
+			ASSERT(bin.aabb.max[dimension] < bin_right_plane + epsilon);
+
+			// The AABB of the current Bin cannot exceed the bounds of the Node's AABB
+			ASSERT(bin.aabb.min[0] > bounds.min[0] - epsilon && bin.aabb.max[0] < bounds.max[0] + epsilon);
+			ASSERT(bin.aabb.min[1] > bounds.min[1] - epsilon && bin.aabb.max[1] < bounds.max[1] + epsilon);
+			ASSERT(bin.aabb.min[2] > bounds.min[2] - epsilon && bin.aabb.max[2] < bounds.max[2] + epsilon);
+		}
+	}
+}
+
+SpatialSplit BVHPartitions::partition_spatial(const Array<Triangle> & triangles, const Array<PrimitiveRef> indices[3], int first_index, int index_count, float * sah, AABB bounds, bool parallel) {
+	// We use a binning of 256 split planes -Herdi
+	// Seems to be along each axis
+	SpatialSplit split = { };
+	split.cost = INFINITY;
+	split.index     = -1;
+	split.dimension = -1;
+	split.plane_distance = NAN;
+
+	SpatialBin bins[3][SBVH_BIN_COUNT];
 
-				// Clip the AABB against the parent bounds
-				bin.aabb.expand(triangle_aabb_clipped_against_bin);
-				bin.aabb = AABB::overlap(bin.aabb, bounds);
+	if (parallel && index_count >= SBVH_PARALLEL_MIN_PRIMITIVES) {
+		// Every dimension is divided into chunks of references, each chunk is binned separately and the results are merged afterwards.
+		// Bins only accumulate bounds and counts, so the result does not depend on the number of chunks
+		int chunk_count = (index_count + SBVH_PARALLEL_CHUNK_SIZE - 1) / SBVH_PARALLEL_CHUNK_SIZE;
 
-				bin.aabb.fix_if_needed();
+		Array<SpatialBin> chunk_bins(3 * chunk_count * SBVH_BIN_COUNT);
 
-				// AABB must be valid
-				ASSERT(bin.aabb.is_valid() || bin.aabb.is_empty());
+		ThreadPool::parallel_for(3 * chunk_count, [&](int work_index) {
+			int dimension = work_index / chunk_count;
+			int chunk     = work_index % chunk_count;
 
-				// The AABB of the current Bin cannot exceed the planes of the current Bin
-				const float epsilon = 0.01f;
-				ASSERT(bin.aabb.min[dimension] > bin_left_plane  - epsilon);
-				ASSERT(bin.aabb.max[dimension] < bin_right_plane + epsilon);
+			int chunk_first = chunk * SBVH_PARALLEL_CHUNK_SIZE;
+			int chunk_size  = Math::min(SBVH_PARALLEL_CHUNK_SIZE, index_count - chunk_first);
 
-				// The AABB of the current Bin cannot exceed the bounds of the Node's AABB
-				ASSERT(bin.aabb.min[0] > bounds.min[0] - epsilon && bin.aabb.max[0] < bounds.max[0] + epsilon);
-				ASSERT(bin.aabb.min[1] > bounds.min[1] - epsilon && bin.aabb.max[1] < bounds.max[1] + epsilon);
-				ASSERT(bin.aabb.min[2] > bounds.min[2] - epsilon && bin.aabb.max[2] < bounds.max[2] + epsilon);
+			bin_spatial(triangles, indices[dimension].data() + first_index + chunk_first, chunk_size, bounds, dimension, chunk_bins.data() + work_index * SBVH_BIN_COUNT);
+		});
+
+		for (int dimension = 0; dimension < 3; dimension++) {
+			for (int chunk = 0; chunk < chunk_count; chunk++) {
+				const SpatialBin * chunk_bin = chunk_bins.data() + (dimension * chunk_count + chunk) * SBVH_BIN_COUNT;
+
+				for (int b = 0; b < SBVH_BIN_COUNT; b++) {
+					bins[dimension][b].aabb.expand(chunk_bin[b].aabb);
+					bins[dimension][b].entries += chunk_bin[b].entries;
+					bins[dimension][b].exits   += chunk_bin[b].exits;
+				}
 			}
 		}
+	} else {
+		for (int dimension = 0; dimension < 3; dimension++) {
+			bin_spatial(triangles, indices[dimension].data() + first_index, index_count, bounds, dimension, bins[dimension]);
+		}
+	}
+
+	for (int dimension = 0; dimension < 3; dimension++) {
+		float bounds_min  = bounds.min[dimension] - 0.001f;
+		float bounds_max  = bounds.max[dimension] + 0.001f;
+		float bounds_step = (bounds_max - bounds_min) / SBVH_BIN_COUNT;
+
+		const SpatialBin * dimension_bins = bins[dimension];
 
 		float bin_sah[SBVH_BIN_COUNT];
 
@@ -234,11 +427,11 @@ SpatialSplit BVHPartitions::partition_spatial(const Array<Triangle> & triangles,
 		// First traverse left to right along the current dimension to evaluate first half of the SAH
 		for (int b = 1; b < SBVH_BIN_COUNT; b++) {
 			bounds_left[b] = bounds_left[b-1];
-			bounds_left[b].expand(bins[b-1].aabb);
+			bounds_left[b].expand(dimension_bins[b-1].aabb);
 
 			ASSERT(bounds_left[b].is_valid() || bounds_left[b].is_empty());
 
-			count_left[b] = count_left[b-1] + bins[b-1].entries;
+			count_left[b] = count_left[b-1] + dimension_bins[b-1].entries;
 
 			if (count_left[b] < index_count) {
 				bin_sah[b] = bounds_left[b].surface_area() * float(count_left[b]);
@@ -250,11 +443,11 @@ SpatialSplit BVHPartitions::partition_spatial(const Array<Triangle> & triangles,
 		// Then traverse right to left along the current dimension to evaluate second half of the SAH
 		for (int b = SBVH_BIN_COUNT - 1; b > 0; b--) {
 			bounds_right[b] = bounds_right[b+1];
-			bounds_right[b].expand(bins[b].aabb);
+			bounds_right[b].expand(dimension_bins[b].aabb);
 
 			ASSERT(bounds_right[b].is_valid() || bounds_right[b].is_empty());
 
-			count_right[b] = count_right[b+1] + bins[b].exits;
+			count_right[b] = count_right[b+1] + dimension_bins[b].exits;
 
 			if (count_right[b] < index_count) {
 				bin_sah[b] += bounds_right[b].surface_area() * float(count_right[b]);
@@ -263,8 +456,8 @@ SpatialSplit BVHPartitions::partition_spatial(const Array<Triangle> & triangles,
 			}
 		}
 
-		ASSERT(count_left [SBVH_BIN_COUNT - 1] + bins[SBVH_BIN_COUNT - 1].entries == index_count);
-		ASSERT(count_right[1]                  + bins[0].exits                    == index_count);
+		ASSERT(count_left [SBVH_BIN_COUNT - 1] + dimension_bins[SBVH_BIN_COUNT - 1].entries == index_count);
+		ASSERT(count_right[1]                  + dimension_bins[0].exits                    == index_count);
 
 		// Find the splitting plane that yields the lowest SAH cost along the current dimension
 		for (int b = 1; b < SBVH_BIN_COUNT; b++) {
@@ -286,4 +479,11 @@ SpatialSplit BVHPartitions::partition_spatial(const Array<Triangle> & triangles,
 	}
 
 	return split;
-}
\ No newline at end of file
+}
+
+bool BVHPartitions::sah_prefers_leaf(float split_cost, const AABB & aabb, int primitive_count) {
+	float cost_leaf  = cpu_config.sah_cost_leaf * float(primitive_count);
+	float cost_split = cpu_config.sah_cost_node + cpu_config.sah_cost_leaf * split_cost / aabb.surface_area();
+
+	return cost_leaf <= cost_split;
+}
@@ -7,11 +7,16 @@
 #include "Util/Util.h"
 
 struct Triangle;
+struct CurveSegment;
 struct Mesh;
 
 struct PrimitiveRef {
 	int  index;
 	AABB aabb;
+
+	// Allows the builders to treat references the same as Triangles or Meshes
+	AABB    get_aabb()   const { return aabb; }
+	Vector3 get_center() const { return aabb.get_center(); }
 };
 
 struct ObjectSplit {
@@ -41,12 +46,25 @@ struct SpatialSplit {
 namespace BVHPartitions {
 	inline constexpr int SBVH_BIN_COUNT = 32;
 
+	// Spatial split searches over at least this many references are distributed over the ThreadPool, in chunks of the given size
+	inline constexpr int SBVH_PARALLEL_MIN_PRIMITIVES = 16 * 1024;
+	inline constexpr int SBVH_PARALLEL_CHUNK_SIZE     = 4 * 1024;
+
+	inline constexpr int BINNED_SAH_MAX_BIN_COUNT = 64;
+
 	ObjectSplit partition_sah(const Array<Triangle> & triangles, int * indices[3], int first_index, int index_count, float * sah);
+	ObjectSplit partition_sah(const Array<CurveSegment> & curves, int * indices[3], int first_index, int index_count, float * sah);
 	ObjectSplit partition_sah(const Array<Mesh>     & meshes,    int * indices[3], int first_index, int index_count, float * sah);
+	ObjectSplit partition_sah(const Array<PrimitiveRef> & refs,  int * indices[3], int first_index, int index_count, float * sah);
 
 	ObjectSplit partition_sah(Array<PrimitiveRef> primitive_refs[3], int first_index, int index_count, float * sah);
 
+	ObjectSplit partition_binned_sah(const Array<AABB> & aabbs, const Array<Vector3> & centers, int * indices, int first_index, int index_count, int bin_count);
+
 	void triangle_intersect_plane(Vector3 vertices[3], int dimension, float plane, Vector3 intersections[], int * intersection_count);
 
-	SpatialSplit partition_spatial(const Array<Triangle> & triangles, const Array<PrimitiveRef> indices[3], int first_index, int index_count, float * sah, AABB bounds);
+	SpatialSplit partition_spatial(const Array<Triangle> & triangles, const Array<PrimitiveRef> indices[3], int first_index, int index_count, float * sah, AABB bounds, bool parallel);
+
+	// SAH termination criterion, returns true if a leaf is cheaper than a split with the given cost (as returned by the partition functions)
+	bool sah_prefers_leaf(float split_cost, const AABB & aabb, int primitive_count);
 }
@@ -0,0 +1,258 @@
+#include "BVHPreSplitter.h"
+
+#include "Config.h"
+
+#include "Core/IO.h"
+#include "Core/Timer.h"
+
+#include "Renderer/Triangle.h"
+
+#include "Util/ThreadPool.h"
+
+// Triangles are processed in chunks, each chunk emits its references into its own Array
+static constexpr int CHUNK_SIZE = 4 * 1024;
+
+// Maximum depth of the grid of split planes
+static constexpr int MAX_SPLIT_LEVEL = 24;
+
+// Limits the number of references a single Triangle can be split into
+static constexpr int MAX_SPLITS_PER_TRIANGLE = 64;
+
+// Returns the coarsest plane of a regular power of two grid over the root bounds that lies strictly inside the AABB along the given dimension.
+// Using the same planes for all Triangles makes it likely that the builder picks them as well, which makes splitting effective
+static float get_split_plane(const AABB & aabb, const AABB & root_aabb, int dimension, int * level) {
+	float root_min = root_aabb.min[dimension];
+	float cell     = root_aabb.max[dimension] - root_min;
+
+	for (int l = 0; l < MAX_SPLIT_LEVEL; l++) {
+		cell *= 0.5f;
+
+		float plane = root_min + ceilf((aabb.min[dimension] - root_min) / cell) * cell;
+		if (plane <= aabb.min[dimension]) plane += cell;
+
+		if (plane < aabb.max[dimension]) {
+			*level = l;
+			return plane;
+		}
+	}
+
+	*level = MAX_SPLIT_LEVEL;
+	return 0.5f * (aabb.min[dimension] + aabb.max[dimension]);
+}
+
+static int get_largest_dimension(const AABB & aabb) {
+	Vector3 extent = aabb.max - aabb.min;
+
+	if (extent.x >= extent.y && extent.x >= extent.z) return 0;
+	if (extent.y >= extent.z) return 1;
+	return 2;
+}
+
+// Splits are spent on Triangles whose AABB overestimates the Triangle itself the most,
+// weighted by the importance of the coarsest grid plane that the Triangle straddles
+static float get_priority(const Triangle & triangle, const AABB & root_aabb) {
+	AABB aabb = triangle.get_aabb();
+
+	// Surface area of the AABBs when the Triangle is split infinitely often, equal to twice its area projected onto the three axis planes
+	Vector3 normal = Vector3::cross(triangle.position_1 - triangle.position_0, triangle.position_2 - triangle.position_0);
+	float area_ideal = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+
+	float area_excess = aabb.surface_area() - area_ideal;
+	if (area_excess <= 0.0f) return 0.0f;
+
+	int level = MAX_SPLIT_LEVEL;
+	for (int dimension = 0; dimension < 3; dimension++) {
+		int dimension_level;
+		get_split_plane(aabb, root_aabb, dimension, &dimension_level);
+
+		level = Math::min(level, dimension_level);
+	}
+
+	return cbrtf(ldexpf(area_excess, -level));
+}
+
+static int get_split_count(float priority, float split_scale) {
+	return int(Math::min(priority * split_scale, float(MAX_SPLITS_PER_TRIANGLE)));
+}
+
+static size_t get_total_split_count(const Array<float> & priorities, float split_scale) {
+	size_t total = 0;
+	for (size_t i = 0; i < priorities.size(); i++) {
+		total += get_split_count(priorities[i], split_scale);
+	}
+	return total;
+}
+
+// Splits the part of the Triangle inside 'aabb' into 'split_count' + 1 references
+static void split_recursive(const Triangle & triangle, int index, const AABB & aabb, int split_count, const AABB & root_aabb, Array<PrimitiveRef> & refs) {
+	if (split_count == 0) {
+		refs.push_back({ index, aabb });
+		return;
+	}
+
+	int dimension = get_largest_dimension(aabb);
+
+	int   level;
+	float plane = get_split_plane(aabb, root_aabb, dimension, &level);
+
+	Vector3 vertices[3] = {
+		triangle.position_0,
+		triangle.position_1,
+		triangle.position_2
+	};
+
+	// Sort the vertices along the current dimension
+	if (vertices[0][dimension] > vertices[1][dimension]) Util::swap(vertices[0], vertices[1]);
+	if (vertices[1][dimension] > vertices[2][dimension]) Util::swap(vertices[1], vertices[2]);
+	if (vertices[0][dimension] > vertices[1][dimension]) Util::swap(vertices[0], vertices[1]);
+
+	Vector3 intersections[6];
+	int     intersection_count = 0;
+
+	BVHPartitions::triangle_intersect_plane(vertices, dimension, plane, intersections, &intersection_count);
+
+	if (intersection_count == 0) {
+		refs.push_back({ index, aabb });
+		return;
+	}
+
+	// All intersection points are included in both AABBs, the vertices only on their own side of the plane
+	AABB aabb_left  = AABB::from_points(intersections, intersection_count);
+	AABB aabb_right = aabb_left;
+
+	for (int v = 0; v < 3; v++) {
+		if (vertices[v][dimension] < plane) {
+			aabb_left.expand(vertices[v]);
+		} else {
+			aabb_right.expand(vertices[v]);
+		}
+	}
+
+	// Only the part of the Triangle inside the current AABB is relevant
+	aabb_left .min = Vector3::max(aabb_left .min, aabb.min);
+	aabb_left .max = Vector3::min(aabb_left .max, aabb.max);
+	aabb_right.min = Vector3::max(aabb_right.min, aabb.min);
+	aabb_right.max = Vector3::min(aabb_right.max, aabb.max);
+
+	aabb_left .max[dimension] = Math::min(aabb_left .max[dimension], plane);
+	aabb_right.min[dimension] = Math::max(aabb_right.min[dimension], plane);
+
+	aabb_left .fix_if_needed();
+	aabb_right.fix_if_needed();
+
+	// Distribute the remaining splits proportional to the size of both halves
+	float size_left  = aabb_left .max[get_largest_dimension(aabb_left )] - aabb_left .min[get_largest_dimension(aabb_left )];
+	float size_right = aabb_right.max[get_largest_dimension(aabb_right)] - aabb_right.min[get_largest_dimension(aabb_right)];
+
+	int split_count_left  = int(float(split_count - 1) * size_left / (size_left + size_right) + 0.5f);
+	int split_count_right = split_count - 1 - split_count_left;
+
+	split_recursive(triangle, index, aabb_left,  split_count_left,  root_aabb, refs);
+	split_recursive(triangle, index, aabb_right, split_count_right, root_aabb, refs);
+}
+
+Array<PrimitiveRef> BVHPreSplitter::split(const Array<Triangle> & triangles, float budget) {
+	ScopeTimer timer("BVH Pre-splitting"_sv);
+
+	int triangle_count = int(triangles.size());
+	int chunk_count    = (triangle_count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+	bool parallel =
+		cpu_config.enable_parallel_bvh_build &&
+		ThreadPool::get_thread_count() > 0 &&
+		chunk_count > 1;
+
+	auto for_each_chunk = [parallel, chunk_count](auto && work) {
+		if (parallel) {
+			ThreadPool::parallel_for(chunk_count, work);
+		} else {
+			for (int chunk = 0; chunk < chunk_count; chunk++) {
+				work(chunk);
+			}
+		}
+	};
+
+	AABB root_aabb = AABB::create_empty();
+	for (int i = 0; i < triangle_count; i++) {
+		root_aabb.expand(triangles[i].get_aabb());
+	}
+
+	Array<float> priorities(triangle_count);
+	Array<float> chunk_priority_sums(chunk_count);
+
+	for_each_chunk([&](int chunk) {
+		int first = chunk * CHUNK_SIZE;
+		int last  = Math::min(first + CHUNK_SIZE, triangle_count);
+
+		float priority_sum = 0.0f;
+		for (int i = first; i < last; i++) {
+			priorities[i] = get_priority(triangles[i], root_aabb);
+			priority_sum += priorities[i];
+		}
+		chunk_priority_sums[chunk] = priority_sum;
+	});
+
+	double priority_sum = 0.0;
+	for (int chunk = 0; chunk < chunk_count; chunk++) {
+		priority_sum += chunk_priority_sums[chunk];
+	}
+
+	// Every Triangle receives a share of the budget proportional to its priority. Since the shares are rounded down,
+	// the proportionality constant is increased using a binary search to use as much of the budget as possible
+	size_t split_budget = size_t(double(Math::max(budget, 0.0f)) * double(triangle_count));
+
+	float split_scale = priority_sum > 0.0 ? float(double(split_budget) / priority_sum) : 0.0f;
+
+	if (split_scale > 0.0f) {
+		float split_scale_min = split_scale;
+		float split_scale_max = split_scale * 2.0f;
+
+		while (get_total_split_count(priorities, split_scale_max) <= split_budget && split_scale_max < 1e30f) {
+			split_scale_min  = split_scale_max;
+			split_scale_max *= 2.0f;
+		}
+
+		for (int i = 0; i < 16; i++) {
+			float split_scale_mid = 0.5f * (split_scale_min + split_scale_max);
+
+			if (get_total_split_count(priorities, split_scale_mid) <= split_budget) {
+				split_scale_min = split_scale_mid;
+			} else {
+				split_scale_max = split_scale_mid;
+			}
+		}
+
+		split_scale = split_scale_min;
+	}
+
+	Array<Array<PrimitiveRef>> chunk_refs(chunk_count);
+
+	for_each_chunk([&](int chunk) {
+		int first = chunk * CHUNK_SIZE;
+		int last  = Math::min(first + CHUNK_SIZE, triangle_count);
+
+		Array<PrimitiveRef> & refs = chunk_refs[chunk];
+		refs.reserve(last - first);
+
+		for (int i = first; i < last; i++) {
+			split_recursive(triangles[i], i, triangles[i].get_aabb(), get_split_count(priorities[i], split_scale), root_aabb, refs);
+		}
+	});
+
+	// Concatenate in chunk order, so that the result does not depend on the number of threads
+	size_t ref_count = 0;
+	for (int chunk = 0; chunk < chunk_count; chunk++) {
+		ref_count += chunk_refs[chunk].size();
+	}
+
+	Array<PrimitiveRef> refs;
+	refs.reserve(ref_count);
+
+	for (int chunk = 0; chunk < chunk_count; chunk++) {
+		refs.push_back(chunk_refs[chunk].data(), chunk_refs[chunk].size());
+	}
+
+	IO::print("Pre-splitting created {} additional references ({} Triangles)\n"_sv, ref_count - triangles.size(), triangles.size());
+
+	return refs;
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include "BVHPartitions.h"
+
+// Splits large Triangles into multiple references before a regular BVH is built over them, see Karras and Aila 2013
+// This captures most of the benefit of the spatial splits of an SBVH for long thin Triangles, at close to the build cost of a regular BVH
+namespace BVHPreSplitter {
+	// Creates at most 'budget' times the number of Triangles additional references. Triangles whose AABB is large
+	// compared to the Triangle itself, and that straddle important split planes near the root, receive the most splits
+	Array<PrimitiveRef> split(const Array<Triangle> & triangles, float budget);
+}
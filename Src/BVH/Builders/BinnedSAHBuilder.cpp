@@ -0,0 +1,151 @@
+#include "BinnedSAHBuilder.h"
+
+#include "Config.h"
+
+#include "Core/Sort.h"
+
+#include "BVH/BVH.h"
+#include "BVH/BVHReorderer.h"
+#include "BVHPartitions.h"
+
+#include "Renderer/Mesh.h"
+#include "Renderer/Curve.h"
+
+#include "Util/ThreadPool.h"
+
+// Subtree whose construction is deferred, so that it can be built on any thread of the ThreadPool
+struct BinnedSAHBuilderTask {
+	int node_index;
+	int child_offset;
+	int first_index;
+	int index_count;
+};
+
+// Uses the same Node layout as SAHBuilder: depth first with siblings next to each other,
+// where a subtree over n primitives occupies at most 2n - 1 Nodes starting at a known location
+static void build_bvh_recursive(BinnedSAHBuilder & builder, int node_index, int child_offset, int first_index, int index_count, Array<BinnedSAHBuilderTask> * tasks, int task_size) {
+	BVHNode2 & node = builder.bvh.nodes[node_index];
+
+	if (index_count == 1) {
+		// Leaf Node, terminate recursion
+		node.first = first_index;
+		node.count = index_count;
+		node.axis  = 0;
+
+		return;
+	}
+
+	// When building in parallel, small enough subtrees are deferred so that they can be distributed over the ThreadPool
+	if (tasks && index_count <= task_size) {
+		tasks->emplace_back(node_index, child_offset, first_index, index_count);
+		return;
+	}
+
+	ObjectSplit split = BVHPartitions::partition_binned_sah(builder.aabbs, builder.centers, builder.indices.data(), first_index, index_count, builder.bin_count);
+
+	if (index_count <= builder.max_primitives_in_leaf && BVHPartitions::sah_prefers_leaf(split.cost, node.aabb, index_count)) {
+		// Leaf Node, terminated based on the SAH
+		node.first = first_index;
+		node.count = index_count;
+		node.axis  = 0;
+
+		return;
+	}
+
+	node.left  = child_offset;
+	node.count = 0;
+	node.axis  = split.dimension;
+
+	builder.bvh.nodes[child_offset    ].aabb = split.aabb_left;
+	builder.bvh.nodes[child_offset + 1].aabb = split.aabb_right;
+
+	int num_left  = split.index - first_index;
+	int num_right = first_index + index_count - split.index;
+
+	build_bvh_recursive(builder, child_offset,     child_offset + 2,            first_index,            num_left,  tasks, task_size);
+	build_bvh_recursive(builder, child_offset + 1, child_offset + 2 * num_left, first_index + num_left, num_right, tasks, task_size);
+}
+
+template<typename Primitive>
+static void build_bvh_impl(BinnedSAHBuilder & builder, const Array<Primitive> & primitives) {
+	int primitive_count = int(primitives.size());
+
+	builder.bin_count = Math::clamp(builder.bin_count, 2, BVHPartitions::BINNED_SAH_MAX_BIN_COUNT);
+
+	builder.bvh.indices.clear();
+
+	if (primitive_count == 0) {
+		// Empty BVH (e.g. a TLAS without Meshes), the root and dummy have empty AABBs so that no Ray can intersect them
+		builder.bvh.nodes.resize(2);
+		builder.bvh.nodes[0] = { };
+		builder.bvh.nodes[1] = { };
+		builder.bvh.nodes[0].aabb = AABB::create_empty();
+		builder.bvh.nodes[1].aabb = AABB::create_empty();
+		return;
+	}
+
+	builder.bvh.nodes.resize(2 * primitive_count);
+	builder.bvh.nodes[1] = { }; // Dummy
+
+	AABB root_aabb = AABB::create_empty();
+	for (int i = 0; i < primitive_count; i++) {
+		builder.aabbs  [i] = primitives[i].get_aabb();
+		builder.centers[i] = primitives[i].get_center();
+
+		root_aabb.expand(builder.aabbs[i]);
+	}
+	builder.bvh.nodes[0].aabb = root_aabb;
+
+	bool parallel =
+		cpu_config.enable_parallel_bvh_build &&
+		ThreadPool::get_thread_count() > 0 &&
+		primitive_count >= BinnedSAHBuilder::PARALLEL_BUILD_MIN_PRIMITIVES;
+
+	if (!parallel) {
+		build_bvh_recursive(builder, 0, 2, 0, primitive_count, nullptr, 0);
+	} else {
+		int thread_count = ThreadPool::get_thread_count() + 1;
+		int task_size    = Math::max(primitive_count / (8 * thread_count), BinnedSAHBuilder::PARALLEL_BUILD_MIN_TASK_SIZE);
+
+		// Build the top of the tree on the calling thread until the remaining subtrees are small enough
+		Array<BinnedSAHBuilderTask> tasks;
+		build_bvh_recursive(builder, 0, 2, 0, primitive_count, &tasks, task_size);
+
+		// Start with the largest subtrees for better load balancing
+		Sort::quick_sort(tasks.begin(), tasks.end(), [](const BinnedSAHBuilderTask & a, const BinnedSAHBuilderTask & b) {
+			return a.index_count > b.index_count;
+		});
+
+		// Subtrees operate on disjoint ranges of indices and Nodes, so no scratch memory or synchronization is needed
+		ThreadPool::parallel_for(int(tasks.size()), [&builder, &tasks](int i) {
+			const BinnedSAHBuilderTask & task = tasks[i];
+			build_bvh_recursive(builder, task.node_index, task.child_offset, task.first_index, task.index_count, nullptr, 0);
+		});
+	}
+
+	builder.bvh.indices = builder.indices; // NOTE: copy!
+
+	if (builder.max_primitives_in_leaf > 1) {
+		BVHReorderer::compact(builder.bvh);
+	}
+}
+
+void BinnedSAHBuilder::build(const Array<Triangle> & triangles) {
+	return build_bvh_impl(*this, triangles);
+}
+
+void BinnedSAHBuilder::build(const Array<Mesh> & meshes) {
+	return build_bvh_impl(*this, meshes);
+}
+
+void BinnedSAHBuilder::build(const Array<PrimitiveRef> & refs) {
+	build_bvh_impl(*this, refs);
+
+	for (size_t i = 0; i < bvh.indices.size(); i++) {
+		bvh.indices[i] = refs[bvh.indices[i]].index;
+	}
+}
+
+void BinnedSAHBuilder::build(const Array<CurveSegment> & curves) {
+	build_bvh_impl(*this, curves);
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include "BVHBuilder.h"
+
+// Builds a binary BVH using binned SAH partitioning, see Wald 2007
+// Unlike SAHBuilder no presorting is required, which makes it considerably faster to build at the cost of slightly lower quality trees
+struct BinnedSAHBuilder final : BVHBuilder {
+	BVH2 & bvh;
+
+	Array<int>     indices;
+	Array<AABB>    aabbs;   // AABB of every primitive
+	Array<Vector3> centers; // Center of every primitive, used for binning
+
+	int bin_count;
+
+	// Meshes with fewer primitives than this are always built on a single thread
+	static constexpr int PARALLEL_BUILD_MIN_PRIMITIVES = 16 * 1024;
+	// Subtrees are handed off to the ThreadPool once they contain fewer primitives than this
+	static constexpr int PARALLEL_BUILD_MIN_TASK_SIZE = 4 * 1024;
+
+	BinnedSAHBuilder(BVH2 & bvh, size_t primitive_count, int bin_count) :
+		bvh(bvh),
+		indices(primitive_count),
+		aabbs  (primitive_count),
+		centers(primitive_count),
+		bin_count(bin_count)
+	{
+		for (int i = 0; i < primitive_count; i++) {
+			indices[i] = i;
+		}
+	}
+
+	void build(const Array<Triangle> & triangles) override;
+	void build(const Array<Mesh>     & meshes)    override;
+
+	// Builds over (pre-split) references to Triangles, the indices of the resulting BVH refer to the Triangles
+	void build(const Array<PrimitiveRef> & refs);
+
+	void build(const Array<CurveSegment> & curves);
+};
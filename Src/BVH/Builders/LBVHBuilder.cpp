@@ -0,0 +1,165 @@
+#include "LBVHBuilder.h"
+
+#include "Config.h"
+
+#include "Renderer/Mesh.h"
+
+#include "Util/ThreadPool.h"
+
+// Subtree whose construction is deferred, so that it can be built on any thread of the ThreadPool
+struct LBVHBuilderTask {
+	int node_index;
+	int child_offset;
+	int first_index;
+	int index_count;
+};
+
+// Finds the split in the (sorted) range of primitives at the highest Morton code bit that differs within the range
+// This corresponds to splitting the space spanned by the range in half along the axis of that bit
+static int find_split(const LBVHBuilder & builder, int first_index, int index_count, int * axis) {
+	unsigned code_first = builder.morton_primitives[first_index].code;
+	unsigned code_last  = builder.morton_primitives[first_index + index_count - 1].code;
+
+	if (code_first == code_last) {
+		// All Morton codes in the range are identical, split in the middle
+		*axis = 0;
+		return first_index + index_count / 2;
+	}
+
+	// Isolate the highest differing bit
+	unsigned diff = code_first ^ code_last;
+	diff |= diff >> 1;
+	diff |= diff >> 2;
+	diff |= diff >> 4;
+	diff |= diff >> 8;
+	diff |= diff >> 16;
+	unsigned split_bit = diff ^ (diff >> 1);
+
+	int bit_index = 0;
+	while ((1u << bit_index) != split_bit) bit_index++;
+
+	// Bits are interleaved as xyz, with z in the least significant position
+	*axis = 2 - bit_index % 3;
+
+	// Binary search for the first primitive that has the split bit set
+	int lo = first_index;
+	int hi = first_index + index_count - 1;
+
+	while (lo + 1 < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (builder.morton_primitives[mid].code & split_bit) {
+			hi = mid;
+		} else {
+			lo = mid;
+		}
+	}
+
+	return hi;
+}
+
+// Uses the same Node layout as SAHBuilder: depth first with siblings next to each other,
+// where a subtree over n primitives always occupies 2n - 1 Nodes starting at a known location
+static void build_bvh_recursive(LBVHBuilder & builder, int node_index, int child_offset, int first_index, int index_count, Array<LBVHBuilderTask> * tasks, int task_size) {
+	BVHNode2 & node = builder.bvh.nodes[node_index];
+
+	if (index_count == 1) {
+		// Leaf Node, terminate recursion
+		// Just like the other builders we recurse down to 1 primitive per leaf, so
+		// that the BVHs that are cached to disk have a standard layout
+		node.aabb  = builder.aabbs[builder.morton_primitives[first_index].index];
+		node.first = first_index;
+		node.count = index_count;
+		node.axis  = 0;
+
+		return;
+	}
+
+	// When building in parallel, small enough subtrees are deferred so that they can be distributed over the ThreadPool
+	if (tasks && index_count <= task_size) {
+		tasks->emplace_back(node_index, child_offset, first_index, index_count);
+		return;
+	}
+
+	int axis;
+	int split_index = find_split(builder, first_index, index_count, &axis);
+
+	node.left  = child_offset;
+	node.count = 0;
+	node.axis  = axis;
+
+	int num_left  = split_index - first_index;
+	int num_right = first_index + index_count - split_index;
+
+	build_bvh_recursive(builder, child_offset,     child_offset + 2,            first_index,            num_left,  tasks, task_size);
+	build_bvh_recursive(builder, child_offset + 1, child_offset + 2 * num_left, first_index + num_left, num_right, tasks, task_size);
+}
+
+template<typename Primitive>
+static void build_bvh_impl(LBVHBuilder & builder, const Array<Primitive> & primitives) {
+	int primitive_count = int(primitives.size());
+
+	builder.bvh.indices.resize(primitive_count);
+
+	if (primitive_count == 0) {
+		// Empty BVH (e.g. a TLAS without Meshes), the root and dummy have empty AABBs so that no Ray can intersect them
+		builder.bvh.nodes.resize(2);
+		builder.bvh.nodes[0] = { };
+		builder.bvh.nodes[1] = { };
+		builder.bvh.nodes[0].aabb = AABB::create_empty();
+		builder.bvh.nodes[1].aabb = AABB::create_empty();
+		return;
+	}
+
+	builder.bvh.nodes.resize(2 * primitive_count);
+	builder.bvh.nodes[1] = { }; // Dummy
+
+	for (int i = 0; i < primitive_count; i++) {
+		builder.aabbs[i] = primitives[i].get_aabb();
+	}
+
+	Morton::sort_primitives(primitives, builder.morton_primitives);
+
+	bool parallel =
+		cpu_config.enable_parallel_bvh_build &&
+		ThreadPool::get_thread_count() > 0 &&
+		primitive_count >= LBVHBuilder::PARALLEL_BUILD_MIN_PRIMITIVES;
+
+	if (!parallel) {
+		build_bvh_recursive(builder, 0, 2, 0, primitive_count, nullptr, 0);
+	} else {
+		int thread_count = ThreadPool::get_thread_count() + 1;
+		int task_size    = Math::max(primitive_count / (8 * thread_count), LBVHBuilder::PARALLEL_BUILD_MIN_TASK_SIZE);
+
+		// Build the top of the tree on the calling thread until the remaining subtrees are small enough
+		Array<LBVHBuilderTask> tasks;
+		build_bvh_recursive(builder, 0, 2, 0, primitive_count, &tasks, task_size);
+
+		ThreadPool::parallel_for(int(tasks.size()), [&builder, &tasks](int i) {
+			const LBVHBuilderTask & task = tasks[i];
+			build_bvh_recursive(builder, task.node_index, task.child_offset, task.first_index, task.index_count, nullptr, 0);
+		});
+	}
+
+	// Children are always stored after their parent, so a reverse pass computes the AABBs bottom up
+	for (int i = 2 * primitive_count - 1; i >= 0; i--) {
+		if (i == 1) continue; // Skip dummy
+
+		BVHNode2 & node = builder.bvh.nodes[i];
+		if (!node.is_leaf()) {
+			node.aabb = AABB::unify(builder.bvh.nodes[node.left].aabb, builder.bvh.nodes[node.left + 1].aabb);
+		}
+	}
+
+	for (int i = 0; i < primitive_count; i++) {
+		builder.bvh.indices[i] = builder.morton_primitives[i].index;
+	}
+}
+
+void LBVHBuilder::build(const Array<Triangle> & triangles) {
+	return build_bvh_impl(*this, triangles);
+}
+
+void LBVHBuilder::build(const Array<Mesh> & meshes) {
+	return build_bvh_impl(*this, meshes);
+}
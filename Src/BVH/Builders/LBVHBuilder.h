@@ -0,0 +1,23 @@
+#pragma once
+#include "BVHBuilder.h"
+#include "Morton.h"
+
+// Linear BVH, builds the hierarchy by sorting primitives along a Morton curve, see Lauterbach et al. 2009
+// Much faster to build than the SAH based builders at the cost of lower quality trees,
+// which makes it suitable for geometry that needs to be rebuilt often
+struct LBVHBuilder final : BVHBuilder {
+	BVH2 & bvh;
+
+	Array<Morton::Primitive> morton_primitives; // Sorted along the Morton curve
+	Array<AABB>              aabbs;             // AABB of every primitive, in original order
+
+	// Meshes with fewer primitives than this are always built on a single thread
+	static constexpr int PARALLEL_BUILD_MIN_PRIMITIVES = 16 * 1024;
+	// Subtrees are handed off to the ThreadPool once they contain fewer primitives than this
+	static constexpr int PARALLEL_BUILD_MIN_TASK_SIZE = 4 * 1024;
+
+	LBVHBuilder(BVH2 & bvh, size_t primitive_count) : bvh(bvh), morton_primitives(primitive_count), aabbs(primitive_count) { }
+
+	void build(const Array<Triangle> & triangles) override;
+	void build(const Array<Mesh>     & meshes)    override;
+};
@@ -0,0 +1,61 @@
+#pragma once
+#include "Core/Array.h"
+#include "Core/Sort.h"
+
+#include "Math/Math.h"
+#include "Math/AABB.h"
+
+// Helpers for ordering primitives along a Morton (Z-order) curve, used by the LBVH and PLOC builders
+namespace Morton {
+	struct Primitive {
+		unsigned code;
+		int      index;
+	};
+
+	// Spreads the lower 10 bits of x out over 30 bits, leaving two zero bits in between every bit
+	inline unsigned expand_bits(unsigned x) {
+		x = (x * 0x00010001u) & 0xff0000ffu;
+		x = (x * 0x00000101u) & 0x0f00f00fu;
+		x = (x * 0x00000011u) & 0xc30c30c3u;
+		x = (x * 0x00000005u) & 0x49249249u;
+		return x;
+	}
+
+	// Calculates 30 bit Morton code for a point inside the unit cube
+	// Bits are interleaved as xyz, with z in the least significant position
+	inline unsigned encode(const Vector3 & point) {
+		unsigned x = unsigned(Math::clamp(point.x * 1024.0f, 0.0f, 1023.0f));
+		unsigned y = unsigned(Math::clamp(point.y * 1024.0f, 0.0f, 1023.0f));
+		unsigned z = unsigned(Math::clamp(point.z * 1024.0f, 0.0f, 1023.0f));
+
+		return (expand_bits(x) << 2) | (expand_bits(y) << 1) | expand_bits(z);
+	}
+
+	// Sorts the primitives along the Morton curve, codes are calculated relative to the bounds of the primitive centers
+	template<typename T>
+	void sort_primitives(const Array<T> & primitives, Array<Primitive> & sorted_primitives) {
+		size_t primitive_count = primitives.size();
+		sorted_primitives.resize(primitive_count);
+
+		AABB centroid_bounds = AABB::create_empty();
+		for (size_t i = 0; i < primitive_count; i++) {
+			centroid_bounds.expand(primitives[i].get_center());
+		}
+
+		Vector3 extent = centroid_bounds.max - centroid_bounds.min;
+		Vector3 scale  = Vector3(
+			extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+			extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+			extent.z > 0.0f ? 1.0f / extent.z : 0.0f
+		);
+
+		for (size_t i = 0; i < primitive_count; i++) {
+			sorted_primitives[i].code  = encode((primitives[i].get_center() - centroid_bounds.min) * scale);
+			sorted_primitives[i].index = int(i);
+		}
+
+		Sort::radix_sort(sorted_primitives.begin(), sorted_primitives.end(), [](const Primitive & primitive) {
+			return primitive.code;
+		});
+	}
+}
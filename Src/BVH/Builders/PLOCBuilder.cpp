@@ -0,0 +1,178 @@
+#include "PLOCBuilder.h"
+
+#include "Config.h"
+
+#include "Renderer/Mesh.h"
+
+#include "Util/ThreadPool.h"
+
+// Finds the nearest neighbour of every cluster in the range [first, last),
+// using the surface area of the combined AABB as distance metric
+static void find_nearest_neighbours(PLOCBuilder & builder, int cluster_count, int first, int last) {
+	for (int i = first; i < last; i++) {
+		const AABB & aabb = builder.nodes[builder.clusters[i]].aabb;
+
+		int   best_index = INVALID;
+		float best_area  = INFINITY;
+
+		int search_first = Math::max(i - PLOCBuilder::SEARCH_RADIUS, 0);
+		int search_last  = Math::min(i + PLOCBuilder::SEARCH_RADIUS, cluster_count - 1);
+
+		for (int j = search_first; j <= search_last; j++) {
+			if (j == i) continue;
+
+			float area = AABB::unify(aabb, builder.nodes[builder.clusters[j]].aabb).surface_area();
+			if (area < best_area) {
+				best_area  = area;
+				best_index = j;
+			}
+		}
+
+		builder.nearest_neighbours[i] = best_index;
+	}
+}
+
+// Picks the axis along which the two children are separated the most, used to order traversal
+static int get_split_axis(const AABB & aabb_left, const AABB & aabb_right) {
+	Vector3 delta = aabb_right.get_center() - aabb_left.get_center();
+	delta = Vector3(fabsf(delta.x), fabsf(delta.y), fabsf(delta.z));
+
+	if (delta.x >= delta.y && delta.x >= delta.z) return 0;
+	if (delta.y >= delta.z) return 1;
+	return 2;
+}
+
+template<typename Primitive>
+static void build_bvh_impl(PLOCBuilder & builder, const Array<Primitive> & primitives) {
+	int primitive_count = int(primitives.size());
+
+	if (primitive_count == 0) {
+		// Empty BVH (e.g. a TLAS without Meshes), the root and dummy have empty AABBs so that no Ray can intersect them
+		builder.bvh.indices.clear();
+		builder.bvh.nodes.resize(2);
+		builder.bvh.nodes[0] = { };
+		builder.bvh.nodes[1] = { };
+		builder.bvh.nodes[0].aabb = AABB::create_empty();
+		builder.bvh.nodes[1].aabb = AABB::create_empty();
+		return;
+	}
+
+	Morton::sort_primitives(primitives, builder.morton_primitives);
+
+	// Every primitive starts out as its own cluster
+	for (int i = 0; i < primitive_count; i++) {
+		int index = builder.morton_primitives[i].index;
+
+		builder.nodes[i].aabb  = primitives[index].get_aabb();
+		builder.nodes[i].left  = INVALID;
+		builder.nodes[i].right = index;
+
+		builder.clusters[i] = i;
+	}
+
+	bool parallel =
+		cpu_config.enable_parallel_bvh_build &&
+		ThreadPool::get_thread_count() > 0;
+
+	int node_count    = primitive_count;
+	int cluster_count = primitive_count;
+
+	while (cluster_count > 1) {
+		int chunk_count = Math::divide_round_up(cluster_count, PLOCBuilder::PARALLEL_CHUNK_SIZE);
+
+		if (parallel && chunk_count > 1) {
+			ThreadPool::parallel_for(chunk_count, [&builder, cluster_count](int chunk) {
+				int first = chunk * PLOCBuilder::PARALLEL_CHUNK_SIZE;
+				int last  = Math::min(first + PLOCBuilder::PARALLEL_CHUNK_SIZE, cluster_count);
+
+				find_nearest_neighbours(builder, cluster_count, first, last);
+			});
+		} else {
+			find_nearest_neighbours(builder, cluster_count, 0, cluster_count);
+		}
+
+		// Merge clusters that are each other's nearest neighbour, the merged cluster takes the place of the leftmost one.
+		// The globally closest pair is always mutual, so every iteration makes progress
+		int cluster_count_next = 0;
+
+		for (int i = 0; i < cluster_count; i++) {
+			int neighbour = builder.nearest_neighbours[i];
+
+			if (builder.nearest_neighbours[neighbour] != i) {
+				builder.clusters_next[cluster_count_next++] = builder.clusters[i];
+			} else if (i < neighbour) {
+				int left  = builder.clusters[i];
+				int right = builder.clusters[neighbour];
+
+				PLOCBuilder::Node & node = builder.nodes[node_count];
+				node.aabb  = AABB::unify(builder.nodes[left].aabb, builder.nodes[right].aabb);
+				node.left  = left;
+				node.right = right;
+
+				builder.clusters_next[cluster_count_next++] = node_count++;
+			}
+		}
+
+		ASSERT(cluster_count_next < cluster_count);
+
+		Util::swap(builder.clusters, builder.clusters_next);
+		cluster_count = cluster_count_next;
+	}
+
+	ASSERT(node_count == 2 * primitive_count - 1);
+
+	// Convert to the standard BVH2 layout: root at index 0, a dummy at index 1,
+	// siblings stored next to each other and exactly one primitive per leaf
+	builder.bvh.indices.resize(primitive_count);
+	builder.bvh.nodes  .resize(2 * primitive_count);
+	builder.bvh.nodes[1] = { }; // Dummy
+
+	struct StackEntry {
+		int node_index;
+		int node_index_bvh;
+	};
+	Array<StackEntry> stack;
+	stack.emplace_back(builder.clusters[0], 0);
+
+	int bvh_node_count  = 2;
+	int bvh_index_count = 0;
+
+	while (stack.size() > 0) {
+		StackEntry entry = stack.back();
+		stack.pop_back();
+
+		const PLOCBuilder::Node & node = builder.nodes[entry.node_index];
+		BVHNode2 & node_bvh = builder.bvh.nodes[entry.node_index_bvh];
+
+		node_bvh.aabb = node.aabb;
+
+		if (node.left == INVALID) {
+			builder.bvh.indices[bvh_index_count] = node.right;
+
+			node_bvh.first = bvh_index_count++;
+			node_bvh.count = 1;
+			node_bvh.axis  = 0;
+		} else {
+			node_bvh.left  = bvh_node_count;
+			node_bvh.count = 0;
+			node_bvh.axis  = get_split_axis(builder.nodes[node.left].aabb, builder.nodes[node.right].aabb);
+
+			// Push right first, so that the left subtree is laid out first
+			stack.emplace_back(node.right, bvh_node_count + 1);
+			stack.emplace_back(node.left,  bvh_node_count);
+
+			bvh_node_count += 2;
+		}
+	}
+
+	ASSERT(bvh_node_count  == 2 * primitive_count);
+	ASSERT(bvh_index_count == primitive_count);
+}
+
+void PLOCBuilder::build(const Array<Triangle> & triangles) {
+	return build_bvh_impl(*this, triangles);
+}
+
+void PLOCBuilder::build(const Array<Mesh> & meshes) {
+	return build_bvh_impl(*this, meshes);
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "BVHBuilder.h"
+#include "Morton.h"
+
+// Parallel Locally-Ordered Clustering, see Meister and Bittner 2018
+// Builds the hierarchy bottom up by repeatedly merging clusters that are each other's nearest neighbour,
+// where neighbours are searched within a small window along the Morton curve.
+// Results in trees that are close to SAHBuilder in quality, while being much faster to build
+struct PLOCBuilder final : BVHBuilder {
+	BVH2 & bvh;
+
+	// Node of the intermediate tree, which is converted into the standard BVH2 layout at the end
+	struct Node {
+		AABB aabb;
+		int  left;  // INVALID for leaves
+		int  right; // Primitive index for leaves
+	};
+	Array<Node> nodes;
+
+	Array<Morton::Primitive> morton_primitives;
+
+	// Scratch memory, one entry per cluster
+	Array<int> clusters;
+	Array<int> clusters_next;
+	Array<int> nearest_neighbours;
+
+	// Number of neighbours searched on either side of a cluster along the Morton curve
+	static constexpr int SEARCH_RADIUS = 16;
+
+	// Clusters are divided over the ThreadPool in chunks of this size
+	static constexpr int PARALLEL_CHUNK_SIZE = 1024;
+
+	PLOCBuilder(BVH2 & bvh, size_t primitive_count) :
+		bvh(bvh),
+		nodes(2 * primitive_count),
+		clusters(primitive_count),
+		clusters_next(primitive_count),
+		nearest_neighbours(primitive_count)
+	{ }
+
+	void build(const Array<Triangle> & triangles) override;
+	void build(const Array<Mesh>     & meshes)    override;
+};
@@ -1,43 +1,85 @@
 #include "SAHBuilder.h"
 
 #include <new>
+#include <atomic>
+
+#include "Config.h"
 
 #include "Core/Sort.h"
 
 #include "BVH/BVH.h"
+#include "BVH/BVHReorderer.h"
 #include "BVHPartitions.h"
 
 #include "Renderer/Mesh.h"
-
+#include "Renderer/Curve.h"
+
+#include "Util/ThreadPool.h"
+
+// Scratch memory used during recursion
+// Subtrees that are built concurrently each use their own scratch memory
+struct SAHBuilderScratch {
+	char     * scratch;
+	BitArray & indices_going_left;
+};
+
+// Subtree whose construction is deferred, so that it can be built on any thread of the ThreadPool
+struct SAHBuilderTask {
+	int node_index;
+	int child_offset;
+	int first_index;
+	int index_count;
+};
+
+// Nodes are laid out in depth first order, with the two children of a Node stored next to each other.
+// A subtree over n primitives consists of at most 2n - 1 Nodes (exactly when every leaf contains one primitive).
+// This means the location of every subtree in the Node array is known upfront ('child_offset' is the
+// location of the children of the current Node) and independent subtrees can be built in any order.
+// Subtrees that terminate early using the SAH leave unused Nodes behind, which are removed afterwards.
 template<typename Primitive>
-static void build_bvh_recursive(SAHBuilder & builder, BVHNode2 & node, const Array<Primitive> & primitives, int * indices[3], int first_index, int index_count) {
+static void build_bvh_recursive(SAHBuilder & builder, SAHBuilderScratch & scratch, const Array<Primitive> & primitives, int * indices[3], int node_index, int child_offset, int first_index, int index_count, Array<SAHBuilderTask> * tasks, int task_size) {
+	BVHNode2 & node = builder.bvh.nodes[node_index];
+
 	if (index_count == 1) {
 		// Leaf Node, terminate recursion
-		// We do not terminate based on the SAH termination criterion, so that the
-		// BVHs that are cached to disk have a standard layout (1 triangle per leaf node)
-		// If desired these trees can be collapsed based on the SAH cost using BVHCollapser::collapse
 		node.first = first_index;
 		node.count = index_count;
+		node.axis  = 0;
+
+		return;
+	}
 
+	// When building in parallel, small enough subtrees are deferred so that they can be distributed over the ThreadPool
+	if (tasks && index_count <= task_size) {
+		tasks->emplace_back(node_index, child_offset, first_index, index_count);
 		return;
 	}
 
-	ObjectSplit split = BVHPartitions::partition_sah(primitives, indices, first_index, index_count, new(builder.scratch.data()) float[index_count]);
+	ObjectSplit split = BVHPartitions::partition_sah(primitives, indices, first_index, index_count, new(scratch.scratch) float[index_count]);
+
+	if (index_count <= builder.max_primitives_in_leaf && BVHPartitions::sah_prefers_leaf(split.cost, node.aabb, index_count)) {
+		// Leaf Node, terminated based on the SAH
+		node.first = first_index;
+		node.count = index_count;
+		node.axis  = 0;
+
+		return;
+	}
 
-	for (int i = first_index; i < split.index;               i++) builder.indices_going_left[indices[split.dimension][i]] = true;
-	for (int i = split.index; i < first_index + index_count; i++) builder.indices_going_left[indices[split.dimension][i]] = false;
+	for (int i = first_index; i < split.index;               i++) scratch.indices_going_left[indices[split.dimension][i]] = true;
+	for (int i = split.index; i < first_index + index_count; i++) scratch.indices_going_left[indices[split.dimension][i]] = false;
 
 	for (int dim = 0; dim < 3; dim++) {
 		if (dim == split.dimension) continue;
 
 		int left  = 0;
 		int right = split.index - first_index;
-		int * temp = new(builder.scratch.data()) int[index_count];
+		int * temp = new(scratch.scratch) int[index_count];
 
 		for (int i = first_index; i < first_index + index_count; i++) {
 			int index = indices[dim][i];
 
-			bool goes_left = builder.indices_going_left[index];
+			bool goes_left = scratch.indices_going_left[index];
 			if (goes_left) {
 				temp[left++] = index;
 			} else {
@@ -50,28 +92,45 @@ static void build_bvh_recursive(SAHBuilder & builder, BVHNode2 & node, const Arr
 		memcpy(indices[dim] + first_index, temp, index_count * sizeof(int));
 	}
 
-	node.left = builder.bvh.nodes.size();
+	node.left  = child_offset;
 	node.count = 0;
 	node.axis  = split.dimension;
 
-	BVHNode2 & node_left  = builder.bvh.nodes.emplace_back();
-	BVHNode2 & node_right = builder.bvh.nodes.emplace_back();
+	BVHNode2 & node_left  = builder.bvh.nodes[child_offset];
+	BVHNode2 & node_right = builder.bvh.nodes[child_offset + 1];
 	node_left .aabb = split.aabb_left;
 	node_right.aabb = split.aabb_right;
 
 	int num_left  = split.index - first_index;
 	int num_right = first_index + index_count - split.index;
 
-	build_bvh_recursive(builder, node_left,  primitives, indices, first_index,            num_left);
-	build_bvh_recursive(builder, node_right, primitives, indices, first_index + num_left, num_right);
+	build_bvh_recursive(builder, scratch, primitives, indices, child_offset,     child_offset + 2,            first_index,            num_left,  tasks, task_size);
+	build_bvh_recursive(builder, scratch, primitives, indices, child_offset + 1, child_offset + 2 * num_left, first_index + num_left, num_right, tasks, task_size);
 }
 
 template<typename Primitive>
 static void build_bvh_impl(SAHBuilder & builder, const Array<Primitive> & primitives) {
+	int primitive_count = int(primitives.size());
+
+	bool parallel =
+		cpu_config.enable_parallel_bvh_build &&
+		ThreadPool::get_thread_count() > 0 &&
+		primitive_count >= SAHBuilder::PARALLEL_BUILD_MIN_PRIMITIVES;
+
 	builder.bvh.indices.clear();
-	builder.bvh.nodes.clear();
-	builder.bvh.nodes.emplace_back(); // Root
-	builder.bvh.nodes.emplace_back(); // Dummy
+
+	if (primitive_count == 0) {
+		// Empty BVH (e.g. a TLAS without Meshes), the root and dummy have empty AABBs so that no Ray can intersect them
+		builder.bvh.nodes.resize(2);
+		builder.bvh.nodes[0] = { };
+		builder.bvh.nodes[1] = { };
+		builder.bvh.nodes[0].aabb = AABB::create_empty();
+		builder.bvh.nodes[1].aabb = AABB::create_empty();
+		return;
+	}
+
+	builder.bvh.nodes.resize(2 * primitive_count);
+	builder.bvh.nodes[1] = { }; // Dummy
 
 	AABB root_aabb = AABB::create_empty();
 	for (size_t i = 0; i < primitives.size(); i++) {
@@ -79,20 +138,78 @@ static void build_bvh_impl(SAHBuilder & builder, const Array<Primitive> & primit
 	}
 	builder.bvh.nodes[0].aabb = root_aabb;
 
-	{
-		Array<int> radix_sort_tmp = Array<int>(primitives.size());
+	int * indices[3] = { builder.indices_x.data(), builder.indices_y.data(), builder.indices_z.data() };
 
-		Sort::radix_sort(builder.indices_x.begin(), builder.indices_x.end(), radix_sort_tmp.data(), [&primitives](int index) { return Sort::RadixSortAdapter<float>()(primitives[index].get_center().x); });
-		Sort::radix_sort(builder.indices_y.begin(), builder.indices_y.end(), radix_sort_tmp.data(), [&primitives](int index) { return Sort::RadixSortAdapter<float>()(primitives[index].get_center().y); });
-		Sort::radix_sort(builder.indices_z.begin(), builder.indices_z.end(), radix_sort_tmp.data(), [&primitives](int index) { return Sort::RadixSortAdapter<float>()(primitives[index].get_center().z); });
-	}
+	auto sort_indices = [&primitives, &indices](int dimension, int * radix_sort_tmp) {
+		Sort::radix_sort(indices[dimension], indices[dimension] + primitives.size(), radix_sort_tmp, [&primitives, dimension](int index) {
+			return Sort::RadixSortAdapter<float>()(primitives[index].get_center()[dimension]);
+		});
+	};
 
-	int * indices[3] = { builder.indices_x.data(), builder.indices_y.data(), builder.indices_z.data() };
+	SAHBuilderScratch scratch = { builder.scratch.data(), builder.indices_going_left };
+
+	if (!parallel) {
+		{
+			Array<int> radix_sort_tmp = Array<int>(primitive_count);
+
+			sort_indices(0, radix_sort_tmp.data());
+			sort_indices(1, radix_sort_tmp.data());
+			sort_indices(2, radix_sort_tmp.data());
+		}
+
+		build_bvh_recursive(builder, scratch, primitives, indices, 0, 2, 0, primitive_count, nullptr, 0);
+	} else {
+		{
+			Array<int> radix_sort_tmp = Array<int>(3 * primitive_count);
+
+			ThreadPool::parallel_for(3, [&sort_indices, &radix_sort_tmp, primitive_count](int dimension) {
+				sort_indices(dimension, radix_sort_tmp.data() + dimension * primitive_count);
+			});
+		}
+
+		int thread_count = ThreadPool::get_thread_count() + 1;
+		int task_size    = Math::max(primitive_count / (8 * thread_count), SAHBuilder::PARALLEL_BUILD_MIN_TASK_SIZE);
+
+		// Build the top of the tree on the calling thread until the remaining subtrees are small enough
+		Array<SAHBuilderTask> tasks;
+		build_bvh_recursive(builder, scratch, primitives, indices, 0, 2, 0, primitive_count, &tasks, task_size);
+
+		// Start with the largest subtrees for better load balancing
+		Sort::quick_sort(tasks.begin(), tasks.end(), [](const SAHBuilderTask & a, const SAHBuilderTask & b) {
+			return a.index_count > b.index_count;
+		});
+
+		int max_task_size = 0;
+		for (size_t i = 0; i < tasks.size(); i++) {
+			max_task_size = Math::max(max_task_size, tasks[i].index_count);
+		}
+
+		// Every participating thread allocates its scratch memory once and then keeps pulling tasks
+		std::atomic<int> next_task = 0;
+
+		ThreadPool::parallel_for(Math::min(int(tasks.size()), thread_count), [&](int) {
+			Array<char> task_scratch(max_task_size * Math::max(sizeof(float), sizeof(int)));
+			BitArray    task_indices_going_left(primitive_count);
+
+			SAHBuilderScratch scratch = { task_scratch.data(), task_indices_going_left };
+
+			while (true) {
+				int task_index = next_task++;
+				if (task_index >= tasks.size()) break;
+
+				const SAHBuilderTask & task = tasks[task_index];
+				build_bvh_recursive(builder, scratch, primitives, indices, task.node_index, task.child_offset, task.first_index, task.index_count, nullptr, 0);
+			}
+		});
+	}
 
-	build_bvh_recursive(builder, builder.bvh.nodes[0], primitives, indices, 0, primitives.size());
 	ASSERT(builder.bvh.nodes.size() <= 2 * primitives.size());
 
 	builder.bvh.indices = builder.indices_x; // NOTE: copy!
+
+	if (builder.max_primitives_in_leaf > 1) {
+		BVHReorderer::compact(builder.bvh);
+	}
 }
 
 void SAHBuilder::build(const Array<Triangle> & triangles) {
@@ -102,3 +219,15 @@ void SAHBuilder::build(const Array<Triangle> & triangles) {
 void SAHBuilder::build(const Array<Mesh> & meshes) {
 	return build_bvh_impl(*this, meshes);
 }
+
+void SAHBuilder::build(const Array<PrimitiveRef> & refs) {
+	build_bvh_impl(*this, refs);
+
+	for (size_t i = 0; i < bvh.indices.size(); i++) {
+		bvh.indices[i] = refs[bvh.indices[i]].index;
+	}
+}
+
+void SAHBuilder::build(const Array<CurveSegment> & curves) {
+	build_bvh_impl(*this, curves);
+}
@@ -1,12 +1,9 @@
 #pragma once
 #include "Core/BitArray.h"
 
-#include "BVH/BVH.h"
+#include "BVHBuilder.h"
 
-struct Triangle;
-struct Mesh;
-
-struct SAHBuilder {
+struct SAHBuilder final : BVHBuilder {
 	BVH2 & bvh;
 
 	Array<int> indices_x;
@@ -16,6 +13,11 @@ struct SAHBuilder {
 	Array<char> scratch; // Used to store intermediate SAH results and reorder indices
 	BitArray indices_going_left;
 
+	// Meshes with fewer primitives than this are always built on a single thread
+	static constexpr int PARALLEL_BUILD_MIN_PRIMITIVES = 16 * 1024;
+	// Subtrees are handed off to the ThreadPool once they contain fewer primitives than this
+	static constexpr int PARALLEL_BUILD_MIN_TASK_SIZE = 4 * 1024;
+
 	SAHBuilder(BVH2 & bvh, size_t primitive_count) :
 		bvh(bvh),
 		indices_x(primitive_count),
@@ -29,10 +31,13 @@ struct SAHBuilder {
 			indices_y[i] = i;
 			indices_z[i] = i;
 		}
-
-		bvh.nodes.reserve(2 * primitive_count);
 	}
 
-	void build(const Array<Triangle> & triangles);
-	void build(const Array<Mesh>     & meshes);
+	void build(const Array<Triangle> & triangles) override;
+	void build(const Array<Mesh>     & meshes)    override;
+
+	// Builds over (pre-split) references to Triangles, the indices of the resulting BVH refer to the Triangles
+	void build(const Array<PrimitiveRef> & refs);
+
+	void build(const Array<CurveSegment> & curves);
 };
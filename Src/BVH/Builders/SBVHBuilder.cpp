@@ -1,5 +1,7 @@
 #include "SBVHBuilder.h"
 
+#include <atomic>
+
 #include "Config.h"
 
 #include "Core/IO.h"
@@ -9,75 +11,63 @@
 
 #include "BVHPartitions.h"
 
-void SBVHBuilder::build(const Array<Triangle> & triangles) {
-	IO::print("Construcing SBVH, this may take a few seconds for large Meshes...\n"_sv);
-
-	AABB root_aabb = AABB::create_empty();
-
-	indices[0].resize(triangles.size());
-	indices[1].resize(triangles.size());
-	indices[2].resize(triangles.size());
+#include "Util/ThreadPool.h"
 
-	for (size_t i = 0; i < triangles.size(); i++) {
-		indices[0][i].index = int(i);
-		indices[1][i].index = int(i);
-		indices[2][i].index = int(i);
+// Subtree whose construction is deferred, so that it can be built on any thread of the ThreadPool
+// Since spatial splits duplicate references, the size of a subtree is not known upfront.
+// Every task therefore builds into its own Node array, which is stitched into the final SBVH afterwards.
+struct SBVHBuilderTask {
+	int node_index; // Index of the root of the subtree in the top level Node array
+	int duplication_budget;
 
-		Vector3 vertices[3] = {
-			triangles[i].position_0,
-			triangles[i].position_1,
-			triangles[i].position_2
-		};
-		AABB aabb = AABB::from_points(vertices, 3);
+	Array<PrimitiveRef> indices[3];
 
-		indices[0][i].aabb = aabb;
-		indices[1][i].aabb = aabb;
-		indices[2][i].aabb = aabb;
+	Array<BVHNode2> nodes;
+	Array<int>      leaf_indices;
+};
 
-		root_aabb.expand(aabb);
+// Grows the Array geometrically, so that repeated growth does not reallocate every time
+template<typename T>
+static void ensure_size(Array<T> & array, size_t size) {
+	if (array.size() < size) {
+		array.resize(Math::max(size, array.size() + array.size() / 2));
 	}
+}
 
-	inv_root_surface_area = 1.0f / root_aabb.surface_area();
+static void radix_sort_refs(PrimitiveRef * refs, int count, PrimitiveRef * radix_sort_tmp, int dimension) {
+	Sort::radix_sort(refs, refs + count, radix_sort_tmp, [dimension](const PrimitiveRef & prim) { return Sort::RadixSortAdapter<float>()(prim.aabb.get_center()[dimension]); });
+}
 
-	{
-		Array<PrimitiveRef> radix_sort_tmp = Array<PrimitiveRef>(triangles.size());
+// Returns the number of references used by the leaves of the subtree
+// Spatial Splits in the subtree may create at most 'duplication_budget' duplicate references in total. What remains of the
+// budget after splitting a Node is divided over its children proportional to their size, so that the result is deterministic
+static int build_sbvh(SBVHBuilder & builder, SBVHBuilderContext & context, Array<BVHNode2> & nodes, const Array<Triangle> & triangles, int node_index, int first_index, int index_count, int duplication_budget, Array<SBVHBuilderTask> * tasks, int task_size) {
+	if (index_count == 1) {
+		// Leaf Node, terminate recursion
+		nodes[node_index].first = first_index;
+		nodes[node_index].count = index_count;
 
-		Sort::radix_sort(indices[0].begin(), indices[0].end(), radix_sort_tmp.data(), [](const PrimitiveRef & prim) { return Sort::RadixSortAdapter<float>()(prim.aabb.get_center().x); });
-		Sort::radix_sort(indices[1].begin(), indices[1].end(), radix_sort_tmp.data(), [](const PrimitiveRef & prim) { return Sort::RadixSortAdapter<float>()(prim.aabb.get_center().y); });
-		Sort::radix_sort(indices[2].begin(), indices[2].end(), radix_sort_tmp.data(), [](const PrimitiveRef & prim) { return Sort::RadixSortAdapter<float>()(prim.aabb.get_center().z); });
+		return index_count;
 	}
 
-	sbvh.nodes.clear();
-	sbvh.nodes.reserve(2 * triangles.size());
-	sbvh.nodes.emplace_back(); // Root
-	sbvh.nodes.emplace_back(); // Dummy
-	sbvh.nodes[0].aabb = root_aabb;
-
-	int index_count = build_sbvh(0, triangles, 0, triangles.size());
-
-	sbvh.indices.resize(index_count);
-	for (int i = 0; i < index_count; i++) {
-		int index = indices[0][i].index;
-		ASSERT(index >= 0 && index < triangles.size());
-
-		sbvh.indices[i] = index;
-	}
-}
+	// When building in parallel, small enough subtrees are deferred so that they can be distributed over the ThreadPool
+	if (tasks && index_count <= task_size) {
+		SBVHBuilderTask & task = tasks->emplace_back();
+		task.node_index         = node_index;
+		task.duplication_budget = duplication_budget;
 
-int SBVHBuilder::build_sbvh(int node_index, const Array<Triangle> & triangles, int first_index, int index_count) {
-	if (index_count == 1) {
-		// Leaf Node, terminate recursion
-		// We do not terminate based on the SAH termination criterion, so that the
-		// BVHs that are cached to disk have a standard layout (1 triangle per leaf node)
-		// If desired these trees can be collapsed based on the SAH cost using BVHCollapser::collapse
-		sbvh.nodes[node_index].first = first_index;
-		sbvh.nodes[node_index].count = index_count;
+		for (int dimension = 0; dimension < 3; dimension++) {
+			task.indices[dimension].push_back(context.indices[dimension].data() + first_index, index_count);
+		}
 
+		// The leaves of the deferred subtree are not stored here, the value returned only needs to reserve space
 		return index_count;
 	}
 
+	ensure_size(context.sah, index_count);
+
 	// Object Split information
-	ObjectSplit object_split = BVHPartitions::partition_sah(indices, first_index, index_count, sah.data());
+	ObjectSplit object_split = BVHPartitions::partition_sah(context.indices, first_index, index_count, context.sah.data());
 	ASSERT(object_split.index != INVALID);
 
 	// Calculate the overlap between the child bounding boxes resulting from the Object Split
@@ -85,64 +75,104 @@ int SBVHBuilder::build_sbvh(int node_index, const Array<Triangle> & triangles, i
 	float lamba = overlap.is_valid() ? overlap.surface_area() : 0.0f;
 
 	// Divide by the surface area of the bounding box of the root Node
-	float ratio = lamba * inv_root_surface_area;
+	float ratio = lamba * builder.inv_root_surface_area;
 	ASSERT(ratio >= 0.0f && ratio <= 1.0f);
 
 	SpatialSplit spatial_split;
 
+	// The top level of a parallel build runs on a single thread, so large Nodes distribute their work over the ThreadPool instead
+	bool parallel = tasks && index_count >= BVHPartitions::SBVH_PARALLEL_MIN_PRIMITIVES;
+
 	// If ratio between overlap area and root area is large enough, consider a Spatial Split
-	if (ratio > cpu_config.sbvh_alpha) {
-		spatial_split = BVHPartitions::partition_spatial(triangles, indices, first_index, index_count, sah.data(), sbvh.nodes[node_index].aabb);
+	// Spatial Splits are no longer considered once the duplication budget has been used up
+	if (ratio > cpu_config.sbvh_alpha && duplication_budget > 0) {
+		spatial_split = BVHPartitions::partition_spatial(triangles, context.indices, first_index, index_count, context.sah.data(), nodes[node_index].aabb, parallel);
 	} else {
 		spatial_split.cost = INFINITY;
 	}
 
 	ASSERT(isfinite(object_split.cost) || isfinite(spatial_split.cost));
 
-	sbvh.nodes[node_index].left = int(sbvh.nodes.size());
-	sbvh.nodes.emplace_back(); // Left child
-	sbvh.nodes.emplace_back(); // Right child
+	bool use_object_split = object_split.cost <= spatial_split.cost;
 
-	Array<PrimitiveRef> children_left [3];
-	Array<PrimitiveRef> children_right[3];
-	for (int i = 0; i < 3; i++) {
-		children_left [i].reserve(index_count);
-		children_right[i].reserve(index_count);
+	// Fall back to the Object Split if the worst case number of duplicates (when no references are unsplit) exceeds the budget
+	if (!use_object_split && spatial_split.num_left + spatial_split.num_right - index_count > duplication_budget) {
+		use_object_split = true;
 	}
 
-	int n_left, n_right;
+	if (index_count <= builder.max_primitives_in_leaf) {
+		// Compare against the cost of the split that will actually be used
+		float split_cost = use_object_split ? object_split.cost : spatial_split.cost;
+
+		if (BVHPartitions::sah_prefers_leaf(split_cost, nodes[node_index].aabb, index_count)) {
+			// Leaf Node, terminated based on the SAH
+			nodes[node_index].first = first_index;
+			nodes[node_index].count = index_count;
+
+			return index_count;
+		}
+	}
+
+	// Reserve space on the stack for the child references in every dimension.
+	// The left children are on top, so that they can be popped before recursing.
+	// For Spatial Splits the number of references per side is an upper bound, as references may be unsplit.
+	int capacity_left  = use_object_split ? object_split.index - first_index               : spatial_split.num_left;
+	int capacity_right = use_object_split ? first_index + index_count - object_split.index : spatial_split.num_right;
+	int capacity_tmp   = use_object_split ? 0 : parallel ? 3 * (capacity_left + capacity_right) : Math::max(capacity_left, capacity_right);
+
+	size_t offset_right = context.stack_offset;
+	size_t offset_left  = offset_right + 3 * capacity_right;
+	size_t offset_tmp   = offset_left  + 3 * capacity_left;
+
+	ensure_size(context.stack, offset_tmp + capacity_tmp);
+
+	PrimitiveRef * children_left [3];
+	PrimitiveRef * children_right[3];
+	for (int dimension = 0; dimension < 3; dimension++) {
+		children_left [dimension] = context.stack.data() + offset_left  + dimension * capacity_left;
+		children_right[dimension] = context.stack.data() + offset_right + dimension * capacity_right;
+	}
+
+	int n_left  = 0;
+	int n_right = 0;
 
 	AABB child_aabb_left;
 	AABB child_aabb_right;
 
-	// The two temp arrays will be used as lookup tables
-	if (object_split.cost <= spatial_split.cost) {
+	nodes[node_index].left = int(nodes.size());
+	nodes.emplace_back(); // Left child
+	nodes.emplace_back(); // Right child
+
+	if (use_object_split) {
 		// Perform Object Split
 
-		sbvh.nodes[node_index].count = 0;
-		sbvh.nodes[node_index].axis  = object_split.dimension;
+		nodes[node_index].count = 0;
+		nodes[node_index].axis  = object_split.dimension;
 
-		for (int i = first_index;        i < object_split.index;        i++) indices_going_left[indices[object_split.dimension][i].index] = true;
-		for (int i = object_split.index; i < first_index + index_count; i++) indices_going_left[indices[object_split.dimension][i].index] = false;
+		for (int i = first_index;        i < object_split.index;        i++) context.indices_going_left[context.indices[object_split.dimension][i].index] = true;
+		for (int i = object_split.index; i < first_index + index_count; i++) context.indices_going_left[context.indices[object_split.dimension][i].index] = false;
 
 		for (int dimension = 0; dimension < 3; dimension++) {
+			int left  = 0;
+			int right = 0;
+
 			for (int i = first_index; i < first_index + index_count; i++) {
-				bool goes_left = indices_going_left[indices[dimension][i].index];
+				bool goes_left = context.indices_going_left[context.indices[dimension][i].index];
 
 				if (goes_left) {
-					children_left[dimension].push_back(indices[dimension][i]);
+					children_left[dimension][left++] = context.indices[dimension][i];
 				} else {
-					children_right[dimension].push_back(indices[dimension][i]);
+					children_right[dimension][right++] = context.indices[dimension][i];
 				}
 			}
-		}
 
-		// We should have made the same decision (going left/right) in every dimension
-		ASSERT(children_left [0].size() == children_left [1].size() && children_left [1].size() == children_left [2].size());
-		ASSERT(children_right[0].size() == children_right[1].size() && children_right[1].size() == children_right[2].size());
+			// We should have made the same decision (going left/right) in every dimension
+			ASSERT(left  == capacity_left);
+			ASSERT(right == capacity_right);
+		}
 
-		n_left  = int(children_left [0].size());
-		n_right = int(children_right[0].size());
+		n_left  = capacity_left;
+		n_right = capacity_right;
 
 		// Using object split, no duplicates can occur.
 		// Thus, left + right should equal the total number of triangles
@@ -154,8 +184,8 @@ int SBVHBuilder::build_sbvh(int node_index, const Array<Triangle> & triangles, i
 	} else {
 		// Perform Spatial Split
 
-		sbvh.nodes[node_index].count = 0;
-		sbvh.nodes[node_index].axis  = spatial_split.dimension;
+		nodes[node_index].count = 0;
+		nodes[node_index].axis  = spatial_split.dimension;
 
 		// Keep track of amount of rejected references on both sides for debugging purposes
 		int rejected_left  = 0;
@@ -164,16 +194,16 @@ int SBVHBuilder::build_sbvh(int node_index, const Array<Triangle> & triangles, i
 		float n_1 = float(spatial_split.num_left);
 		float n_2 = float(spatial_split.num_right);
 
-		float bounds_min  = sbvh.nodes[node_index].aabb.min[spatial_split.dimension] - 0.001f;
-		float bounds_max  = sbvh.nodes[node_index].aabb.max[spatial_split.dimension] + 0.001f;
+		float bounds_min  = nodes[node_index].aabb.min[spatial_split.dimension] - 0.001f;
+		float bounds_max  = nodes[node_index].aabb.max[spatial_split.dimension] + 0.001f;
 
 		float inv_bounds_delta = 1.0f / (bounds_max - bounds_min);
 
 		for (int i = first_index; i < first_index + index_count; i++) {
-			int index = indices[spatial_split.dimension][i].index;
+			int index = context.indices[spatial_split.dimension][i].index;
 			const Triangle & triangle = triangles[index];
 
-			AABB triangle_aabb = indices[spatial_split.dimension][i].aabb;
+			AABB triangle_aabb = context.indices[spatial_split.dimension][i].aabb;
 
 			Vector3 vertices[3] = {
 				triangle.position_0,
@@ -273,49 +303,54 @@ int SBVHBuilder::build_sbvh(int node_index, const Array<Triangle> & triangles, i
 				spatial_split.aabb_left .expand(aabb_left);
 				spatial_split.aabb_right.expand(aabb_right);
 
-				children_left[0].emplace_back(indices[spatial_split.dimension][i].index, aabb_left);
-				children_left[1].emplace_back(indices[spatial_split.dimension][i].index, aabb_left);
-				children_left[2].emplace_back(indices[spatial_split.dimension][i].index, aabb_left);
+				PrimitiveRef ref_left  = { index, aabb_left  };
+				PrimitiveRef ref_right = { index, aabb_right };
 
-				children_right[0].emplace_back(indices[spatial_split.dimension][i].index, aabb_right);
-				children_right[1].emplace_back(indices[spatial_split.dimension][i].index, aabb_right);
-				children_right[2].emplace_back(indices[spatial_split.dimension][i].index, aabb_right);
+				for (int dimension = 0; dimension < 3; dimension++) {
+					children_left [dimension][n_left]  = ref_left;
+					children_right[dimension][n_right] = ref_right;
+				}
+				n_left++;
+				n_right++;
 			} else if (goes_left) {
 				spatial_split.aabb_left.expand(triangle_aabb);
 
-				children_left[0].push_back(indices[spatial_split.dimension][i]);
-				children_left[1].push_back(indices[spatial_split.dimension][i]);
-				children_left[2].push_back(indices[spatial_split.dimension][i]);
+				for (int dimension = 0; dimension < 3; dimension++) {
+					children_left[dimension][n_left] = context.indices[spatial_split.dimension][i];
+				}
+				n_left++;
 			} else if (goes_right) {
 				spatial_split.aabb_right.expand(triangle_aabb);
 
-				children_right[0].push_back(indices[spatial_split.dimension][i]);
-				children_right[1].push_back(indices[spatial_split.dimension][i]);
-				children_right[2].push_back(indices[spatial_split.dimension][i]);
+				for (int dimension = 0; dimension < 3; dimension++) {
+					children_right[dimension][n_right] = context.indices[spatial_split.dimension][i];
+				}
+				n_right++;
 			} else {
 				ASSERT_UNREACHABLE();
 			}
 		}
 
-		{
-			Array<PrimitiveRef> radix_sort_tmp = Array<PrimitiveRef>(index_count);
+		PrimitiveRef * radix_sort_tmp = context.stack.data() + offset_tmp;
 
-			Sort::radix_sort(children_left[0].begin(), children_left[0].end(), radix_sort_tmp.data(), [](const PrimitiveRef & prim) { return Sort::RadixSortAdapter<float>()(prim.aabb.get_center().x); });
-			Sort::radix_sort(children_left[1].begin(), children_left[1].end(), radix_sort_tmp.data(), [](const PrimitiveRef & prim) { return Sort::RadixSortAdapter<float>()(prim.aabb.get_center().y); });
-			Sort::radix_sort(children_left[2].begin(), children_left[2].end(), radix_sort_tmp.data(), [](const PrimitiveRef & prim) { return Sort::RadixSortAdapter<float>()(prim.aabb.get_center().z); });
+		if (parallel) {
+			// Every sort gets its own temporary memory, so that all six can run at the same time
+			ThreadPool::parallel_for(6, [&](int i) {
+				int dimension = i % 3;
 
-			Sort::radix_sort(children_right[0].begin(), children_right[0].end(), radix_sort_tmp.data(), [](const PrimitiveRef & prim) { return Sort::RadixSortAdapter<float>()(prim.aabb.get_center().x); });
-			Sort::radix_sort(children_right[1].begin(), children_right[1].end(), radix_sort_tmp.data(), [](const PrimitiveRef & prim) { return Sort::RadixSortAdapter<float>()(prim.aabb.get_center().y); });
-			Sort::radix_sort(children_right[2].begin(), children_right[2].end(), radix_sort_tmp.data(), [](const PrimitiveRef & prim) { return Sort::RadixSortAdapter<float>()(prim.aabb.get_center().z); });
+				if (i < 3) {
+					radix_sort_refs(children_left [dimension], n_left,  radix_sort_tmp + dimension * capacity_left, dimension);
+				} else {
+					radix_sort_refs(children_right[dimension], n_right, radix_sort_tmp + 3 * capacity_left + dimension * capacity_right, dimension);
+				}
+			});
+		} else {
+			for (int dimension = 0; dimension < 3; dimension++) {
+				radix_sort_refs(children_left [dimension], n_left,  radix_sort_tmp, dimension);
+				radix_sort_refs(children_right[dimension], n_right, radix_sort_tmp, dimension);
+			}
 		}
 
-		// We should have made the same decision (going left/right) in every dimension
-		ASSERT(children_left [0].size() == children_left [1].size() && children_left [1].size() == children_left [2].size());
-		ASSERT(children_right[0].size() == children_right[1].size() && children_right[1].size() == children_right[2].size());
-
-		n_left  = int(children_left [0].size());
-		n_right = int(children_right[0].size());
-
 		// The actual number of references going left/right should match the numbers calculated during spatial splitting
 		ASSERT(n_left  == spatial_split.num_left  - rejected_left);
 		ASSERT(n_right == spatial_split.num_right - rejected_right);
@@ -328,39 +363,253 @@ int SBVHBuilder::build_sbvh(int node_index, const Array<Triangle> & triangles, i
 		ASSERT(n_left + n_right >= index_count);
 		ASSERT(n_left + n_right <= index_count * 2);
 
+		duplication_budget -= n_left + n_right - index_count;
+
 		child_aabb_left  = spatial_split.aabb_left;
 		child_aabb_right = spatial_split.aabb_right;
 	}
 
-	sbvh.nodes[sbvh.nodes[node_index].left    ].aabb = child_aabb_left;
-	sbvh.nodes[sbvh.nodes[node_index].left + 1].aabb = child_aabb_right;
+	int node_index_left = nodes[node_index].left;
 
-	indices[0].resize_if_smaller(first_index + n_left);
-	indices[1].resize_if_smaller(first_index + n_left);
-	indices[2].resize_if_smaller(first_index + n_left);
+	nodes[node_index_left    ].aabb = child_aabb_left;
+	nodes[node_index_left + 1].aabb = child_aabb_right;
 
-	memcpy(indices[0].data() + first_index, children_left[0].data(), n_left * sizeof(PrimitiveRef));
-	memcpy(indices[1].data() + first_index, children_left[1].data(), n_left * sizeof(PrimitiveRef));
-	memcpy(indices[2].data() + first_index, children_left[2].data(), n_left * sizeof(PrimitiveRef));
+	for (int dimension = 0; dimension < 3; dimension++) {
+		ensure_size(context.indices[dimension], first_index + n_left);
+		memcpy(context.indices[dimension].data() + first_index, children_left[dimension], n_left * sizeof(PrimitiveRef));
+	}
 
-	children_left[0] = { };
-	children_left[1] = { };
-	children_left[2] = { };
+	// Pop the left children, only the right children need to stay alive during the recursion
+	context.stack_offset = offset_left;
 
 	// Do a depth first traversal, so that we know the amount of indices that were recursively created by the left child
-	int num_leaves_left = build_sbvh(sbvh.nodes[node_index].left, triangles, first_index, n_left);
+	int duplication_budget_left  = int(int64_t(duplication_budget) * n_left / (n_left + n_right));
+	int duplication_budget_right = duplication_budget - duplication_budget_left;
+
+	int num_leaves_left = build_sbvh(builder, context, nodes, triangles, node_index_left, first_index, n_left, duplication_budget_left, tasks, task_size);
 
-	indices[0].resize_if_smaller(first_index + num_leaves_left + n_right);
-	indices[1].resize_if_smaller(first_index + num_leaves_left + n_right);
-	indices[2].resize_if_smaller(first_index + num_leaves_left + n_right);
+	// The stack may have been reallocated during recursion
+	for (int dimension = 0; dimension < 3; dimension++) {
+		children_right[dimension] = context.stack.data() + offset_right + dimension * capacity_right;
+	}
 
 	// Using the depth first offset, we can now copy over the right references
-	memcpy(indices[0].data() + first_index + num_leaves_left, children_right[0].data(), n_right * sizeof(PrimitiveRef));
-	memcpy(indices[1].data() + first_index + num_leaves_left, children_right[1].data(), n_right * sizeof(PrimitiveRef));
-	memcpy(indices[2].data() + first_index + num_leaves_left, children_right[2].data(), n_right * sizeof(PrimitiveRef));
+	for (int dimension = 0; dimension < 3; dimension++) {
+		ensure_size(context.indices[dimension], first_index + num_leaves_left + n_right);
+		memcpy(context.indices[dimension].data() + first_index + num_leaves_left, children_right[dimension], n_right * sizeof(PrimitiveRef));
+	}
+
+	context.stack_offset = offset_right;
 
 	// Now recurse on the right side
-	int num_leaves_right = build_sbvh(sbvh.nodes[node_index].left + 1, triangles, first_index + num_leaves_left, n_right);
+	int num_leaves_right = build_sbvh(builder, context, nodes, triangles, node_index_left + 1, first_index + num_leaves_left, n_right, duplication_budget_right, tasks, task_size);
 
 	return num_leaves_left + num_leaves_right;
 }
+
+// Builds an SBVH over the references in context.indices, with the root Node and a dummy Node already present in 'nodes'
+// Returns the number of references used by the leaves, these are stored in context.indices[0]
+static int build_sbvh_root(SBVHBuilder & builder, SBVHBuilderContext & context, Array<BVHNode2> & nodes, const Array<Triangle> & triangles, int index_count, int duplication_budget, Array<SBVHBuilderTask> * tasks, int task_size) {
+	ASSERT(nodes.size() == 2);
+	ASSERT(context.stack_offset == 0);
+
+	return build_sbvh(builder, context, nodes, triangles, 0, 0, index_count, duplication_budget, tasks, task_size);
+}
+
+// Copies Nodes of a subtree into the final SBVH in depth first order.
+// This is the same order in which a single threaded build allocates Nodes and leaf indices,
+// so the result is identical regardless of how the tree was divided into tasks.
+struct SBVHStitch {
+	BVH2 & sbvh;
+
+	int node_count;
+	int index_count;
+
+	const Array<SBVHBuilderTask> & tasks;
+	const Array<int>             & node_task; // For every Node in the top level tree the index of the task that built it, or INVALID
+};
+
+static void stitch_sbvh(SBVHStitch & stitch, const Array<BVHNode2> & nodes, const Array<int> & leaf_indices, bool is_top_level, int node_index, int node_index_stitched) {
+	if (is_top_level && stitch.node_task[node_index] != INVALID) {
+		const SBVHBuilderTask & task = stitch.tasks[stitch.node_task[node_index]];
+		stitch_sbvh(stitch, task.nodes, task.leaf_indices, false, 0, node_index_stitched);
+		return;
+	}
+
+	const BVHNode2 & node = nodes[node_index];
+	BVHNode2 & node_stitched = stitch.sbvh.nodes[node_index_stitched];
+
+	node_stitched = node;
+
+	if (node.is_leaf()) {
+		node_stitched.first = stitch.index_count;
+
+		for (unsigned i = 0; i < node.count; i++) {
+			stitch.sbvh.indices[stitch.index_count++] = leaf_indices[node.first + i];
+		}
+	} else {
+		int left = stitch.node_count;
+		stitch.node_count += 2;
+
+		node_stitched.left = left;
+
+		stitch_sbvh(stitch, nodes, leaf_indices, is_top_level, node.left,     left);
+		stitch_sbvh(stitch, nodes, leaf_indices, is_top_level, node.left + 1, left + 1);
+	}
+}
+
+void SBVHBuilder::build(const Array<Triangle> & triangles) {
+	IO::print("Construcing SBVH, this may take a few seconds for large Meshes...\n"_sv);
+
+	AABB root_aabb = AABB::create_empty();
+
+	SBVHBuilderContext context(triangles.size());
+
+	for (int dimension = 0; dimension < 3; dimension++) {
+		context.indices[dimension].resize(triangles.size());
+	}
+
+	for (size_t i = 0; i < triangles.size(); i++) {
+		Vector3 vertices[3] = {
+			triangles[i].position_0,
+			triangles[i].position_1,
+			triangles[i].position_2
+		};
+		AABB aabb = AABB::from_points(vertices, 3);
+
+		for (int dimension = 0; dimension < 3; dimension++) {
+			context.indices[dimension][i].index = int(i);
+			context.indices[dimension][i].aabb  = aabb;
+		}
+
+		root_aabb.expand(aabb);
+	}
+
+	inv_root_surface_area = 1.0f / root_aabb.surface_area();
+
+	// Bounds memory usage on Meshes where Spatial Splits would otherwise duplicate many large overlapping Triangles
+	int duplication_budget = int(float(triangles.size()) * Math::max(cpu_config.sbvh_max_duplication, 0.0f));
+
+	bool parallel =
+		cpu_config.enable_parallel_bvh_build &&
+		ThreadPool::get_thread_count() > 0 &&
+		triangles.size() >= PARALLEL_BUILD_MIN_PRIMITIVES;
+
+	if (!parallel) {
+		Array<PrimitiveRef> radix_sort_tmp = Array<PrimitiveRef>(triangles.size());
+
+		for (int dimension = 0; dimension < 3; dimension++) {
+			radix_sort_refs(context.indices[dimension].data(), int(triangles.size()), radix_sort_tmp.data(), dimension);
+		}
+	} else {
+		Array<PrimitiveRef> radix_sort_tmp = Array<PrimitiveRef>(3 * triangles.size());
+
+		ThreadPool::parallel_for(3, [&context, &radix_sort_tmp, &triangles](int dimension) {
+			radix_sort_refs(context.indices[dimension].data(), int(triangles.size()), radix_sort_tmp.data() + dimension * triangles.size(), dimension);
+		});
+	}
+
+	sbvh.nodes.clear();
+	sbvh.nodes.reserve(2 * triangles.size());
+	sbvh.nodes.emplace_back(); // Root
+	sbvh.nodes.emplace_back(); // Dummy
+	sbvh.nodes[0].aabb = root_aabb;
+
+	if (!parallel) {
+		int index_count = build_sbvh_root(*this, context, sbvh.nodes, triangles, triangles.size(), duplication_budget, nullptr, 0);
+
+		sbvh.indices.resize(index_count);
+		for (int i = 0; i < index_count; i++) {
+			int index = context.indices[0][i].index;
+			ASSERT(index >= 0 && index < triangles.size());
+
+			sbvh.indices[i] = index;
+		}
+		return;
+	}
+
+	int thread_count = ThreadPool::get_thread_count() + 1;
+	int task_size    = Math::max(int(triangles.size()) / (8 * thread_count), PARALLEL_BUILD_MIN_TASK_SIZE);
+
+	// Build the top of the tree on the calling thread until the remaining subtrees are small enough
+	Array<SBVHBuilderTask> tasks;
+	Array<BVHNode2>        top_level_nodes = std::move(sbvh.nodes);
+	int top_level_index_count = build_sbvh_root(*this, context, top_level_nodes, triangles, triangles.size(), duplication_budget, &tasks, task_size);
+
+	Array<int> top_level_leaf_indices(top_level_index_count);
+	for (int i = 0; i < top_level_index_count; i++) {
+		top_level_leaf_indices[i] = context.indices[0][i].index;
+	}
+
+	// Start with the largest subtrees for better load balancing
+	Array<int> task_order(tasks.size());
+	for (size_t i = 0; i < tasks.size(); i++) {
+		task_order[i] = int(i);
+	}
+	Sort::quick_sort(task_order.begin(), task_order.end(), [&tasks](int a, int b) {
+		return tasks[a].indices[0].size() > tasks[b].indices[0].size();
+	});
+
+	// Every participating thread reuses a single SBVHBuilderContext for all tasks it picks up
+	std::atomic<int> next_task = 0;
+
+	ThreadPool::parallel_for(Math::min(int(tasks.size()), thread_count), [&](int) {
+		SBVHBuilderContext task_context(triangles.size());
+
+		while (true) {
+			int task_index = next_task++;
+			if (task_index >= tasks.size()) break;
+
+			SBVHBuilderTask & task = tasks[task_order[task_index]];
+			int task_index_count = int(task.indices[0].size());
+
+			for (int dimension = 0; dimension < 3; dimension++) {
+				ensure_size(task_context.indices[dimension], task_index_count);
+				memcpy(task_context.indices[dimension].data(), task.indices[dimension].data(), task_index_count * sizeof(PrimitiveRef));
+
+				task.indices[dimension] = { };
+			}
+
+			task.nodes.reserve(2 * task_index_count);
+			task.nodes.emplace_back(); // Root
+			task.nodes.emplace_back(); // Dummy
+			task.nodes[0].aabb = top_level_nodes[task.node_index].aabb;
+
+			int leaf_index_count = build_sbvh_root(*this, task_context, task.nodes, triangles, task_index_count, task.duplication_budget, nullptr, 0);
+
+			task.leaf_indices.resize(leaf_index_count);
+			for (int i = 0; i < leaf_index_count; i++) {
+				task.leaf_indices[i] = task_context.indices[0][i].index;
+			}
+		}
+	});
+
+	// Stitch the top level tree and the subtrees together
+	Array<int> node_task(top_level_nodes.size());
+	for (size_t i = 0; i < top_level_nodes.size(); i++) {
+		node_task[i] = INVALID;
+	}
+
+	size_t total_node_count  = top_level_nodes.size();
+	size_t total_index_count = 0;
+
+	for (size_t i = 0; i < top_level_nodes.size(); i++) {
+		if (top_level_nodes[i].is_leaf()) total_index_count += top_level_nodes[i].count;
+	}
+	for (size_t i = 0; i < tasks.size(); i++) {
+		node_task[tasks[i].node_index] = int(i);
+
+		total_node_count  += tasks[i].nodes.size() - 2; // The root of the subtree replaces a top level Node and the dummy is dropped
+		total_index_count += tasks[i].leaf_indices.size();
+	}
+
+	sbvh.nodes  .resize(total_node_count);
+	sbvh.indices.resize(total_index_count);
+	sbvh.nodes[1] = { }; // Dummy
+
+	SBVHStitch stitch = { sbvh, 2, 0, tasks, node_task };
+	stitch_sbvh(stitch, top_level_nodes, top_level_leaf_indices, true, 0, 0);
+
+	ASSERT(stitch.node_count  == total_node_count);
+	ASSERT(stitch.index_count == total_index_count);
+}
@@ -7,21 +7,38 @@
 
 struct PrimitiveRef;
 
-struct SBVHBuilder {
-	BVH2 & sbvh;
-
-	Array<PrimitiveRef> indices[3];
+// State used while building (part of) an SBVH on a single thread
+// All memory is reused between Nodes, and grows only when a larger subtree is encountered
+struct SBVHBuilderContext {
+	Array<PrimitiveRef> indices[3]; // References sorted along each dimension
 
 	// Scatch memory
 	Array<float> sah;
 	BitArray indices_going_left;
 
+	// Stack of child references, these need to outlive the recursion into the left child
+	Array<PrimitiveRef> stack;
+	size_t              stack_offset = 0;
+
+	SBVHBuilderContext(size_t triangle_count) : indices_going_left(triangle_count) { }
+};
+
+struct SBVHBuilder {
+	BVH2 & sbvh;
+
+	size_t triangle_count;
+
 	float inv_root_surface_area;
 
-	SBVHBuilder(BVH2 & sbvh, size_t triangle_count) : sbvh(sbvh), sah(triangle_count), indices_going_left(triangle_count) { }
+	// Nodes with at most this many references become a leaf if that is cheaper in terms of the SAH than splitting them further
+	int max_primitives_in_leaf = 1;
 
-	void build(const Array<Triangle> & triangles); // SAH-based object + spatial splits, Stich et al. 2009 (Triangles only)
+	// Meshes with fewer triangles than this are always built on a single thread
+	static constexpr int PARALLEL_BUILD_MIN_PRIMITIVES = 16 * 1024;
+	// Subtrees are handed off to the ThreadPool once they contain fewer references than this
+	static constexpr int PARALLEL_BUILD_MIN_TASK_SIZE = 4 * 1024;
+
+	SBVHBuilder(BVH2 & sbvh, size_t triangle_count) : sbvh(sbvh), triangle_count(triangle_count) { }
 
-private:
-	int build_sbvh(int node_index, const Array<Triangle> & triangles, int first_index, int index_count);
+	void build(const Array<Triangle> & triangles); // SAH-based object + spatial splits, Stich et al. 2009 (Triangles only)
 };
@@ -1,153 +1,250 @@
 #include "BVH4Converter.h"
+
+#include "Config.h"
+
 #include "Core/IO.h"
 
+#include "BVH/BVHQuantizer.h"
+
+// Collapses the binary BVH into a 4-wide BVH using the same SAH-optimal dynamic programming as BVH8Converter
+// (Ylitie et al. 2017), and stores only the Nodes that are actually used
 void BVH4Converter::convert() {
-	bvh4.nodes.resize(bvh2.nodes.size());
+	decisions.resize(bvh2.nodes.size() * 3);
 
-	for (size_t i = 0; i < bvh4.nodes.size(); i++) {
-		// We use index 1 as a starting point, such that it points to the first child of the root
-		if (i == 1) {
-			bvh4.nodes[i].get_index(0) = 0;
-			bvh4.nodes[i].get_count(0) = 0;
-			continue;
+	// Fill cost table using dynamic programming (bottom up)
+	Cost cost_root;
+	calculate_cost(0, cost_root);
+
+	bvh4.indices.clear();
+	bvh4.nodes  .clear();
+	bvh4.nodes.emplace_back(); // Root
+	bvh4.nodes.emplace_back(); // Dummy
+
+	// We use index 1 as a starting point, such that it points to the first child of the root
+	BVHNode4 & node_dummy = bvh4.nodes[1];
+	node_dummy.get_index(0) = 0;
+	node_dummy.get_count(0) = 0;
+
+	for (int i = 1; i < 4; i++) {
+		node_dummy.get_index(i) = INVALID;
+		node_dummy.get_count(i) = INVALID;
+	}
+
+	// Collapse binary tree into 4-way tree (top down)
+	collapse(0, 0);
+	ASSERT(bvh4.indices.size() == bvh2.indices.size());
+}
+
+void BVH4Converter::calculate_cost(int node_index, Cost & cost) {
+	const BVHNode2 & node = bvh2.nodes[node_index];
+
+	Decision * decisions_node = &decisions[node_index * 3];
+
+	float area = node.aabb.surface_area();
+
+	if (node.is_leaf()) {
+		float cost_leaf = cpu_config.sah_cost_leaf * area * float(node.count);
+
+		for (int i = 0; i < 3; i++) {
+			decisions_node[i].type = Decision::Type::LEAF;
+			cost.cost[i] = cost_leaf;
 		}
+		cost.primitive_count = node.count;
 
-		// Converting the binary tree to a quaternary tree (Nothing else is done here)
-		if (!bvh2.nodes[i].is_leaf()) {
-			const BVHNode2 & child_left  = bvh2.nodes[bvh2.nodes[i].left];
-			const BVHNode2 & child_right = bvh2.nodes[bvh2.nodes[i].left + 1];
-
-			bvh4.nodes[i].aabb_min_x[0] = child_left.aabb.min.x;
-			bvh4.nodes[i].aabb_min_y[0] = child_left.aabb.min.y;
-			bvh4.nodes[i].aabb_min_z[0] = child_left.aabb.min.z;
-			bvh4.nodes[i].aabb_max_x[0] = child_left.aabb.max.x;
-			bvh4.nodes[i].aabb_max_y[0] = child_left.aabb.max.y;
-			bvh4.nodes[i].aabb_max_z[0] = child_left.aabb.max.z;
-			bvh4.nodes[i].aabb_min_x[1] = child_right.aabb.min.x;
-			bvh4.nodes[i].aabb_min_y[1] = child_right.aabb.min.y;
-			bvh4.nodes[i].aabb_min_z[1] = child_right.aabb.min.z;
-			bvh4.nodes[i].aabb_max_x[1] = child_right.aabb.max.x;
-			bvh4.nodes[i].aabb_max_y[1] = child_right.aabb.max.y;
-			bvh4.nodes[i].aabb_max_z[1] = child_right.aabb.max.z;
-
-			if (child_left.is_leaf()) {
-				bvh4.nodes[i].get_index(0) = child_left.first;
-				bvh4.nodes[i].get_count(0) = child_left.count;
-			} else {
-				bvh4.nodes[i].get_index(0) = bvh2.nodes[i].left;
-				bvh4.nodes[i].get_count(0) = 0;
-			}
+		return;
+	}
 
-			if (child_right.is_leaf()) {
-				bvh4.nodes[i].get_index(1) = child_right.first;
-				bvh4.nodes[i].get_count(1) = child_right.count;
-			} else {
-				bvh4.nodes[i].get_index(1) = bvh2.nodes[i].left + 1;
-				bvh4.nodes[i].get_count(1) = 0;
-			}
+	Cost cost_left;
+	Cost cost_right;
+	calculate_cost(node.left,     cost_left);
+	calculate_cost(node.left + 1, cost_right);
+
+	int num_primitives = cost_left.primitive_count + cost_right.primitive_count;
 
-			// For now the tree is binary,
-			// so make the rest of the indices invalid
-			for (int j = 2; j < 4; j++) {
-				bvh4.nodes[i].get_index(j) = INVALID;
-				bvh4.nodes[i].get_count(j) = INVALID;
+	// Separate case: i=0, either make a leaf or an internal Node that distributes its 4 slots over both children
+	{
+		float cost_leaf = num_primitives <= max_primitives_in_leaf ? cpu_config.sah_cost_leaf * area * float(num_primitives) : INFINITY;
+
+		float cost_distribute = INFINITY;
+
+		int distribute_left  = 0;
+		int distribute_right = 0;
+
+		for (int k = 0; k < 3; k++) {
+			float c = cost_left.cost[k] + cost_right.cost[2 - k];
+
+			if (c < cost_distribute) {
+				cost_distribute = c;
+
+				distribute_left  =     k;
+				distribute_right = 2 - k;
 			}
 		}
+
+		float cost_internal = cost_distribute + cpu_config.sah_cost_node * area;
+
+		if (cost_leaf < cost_internal) {
+			decisions_node[0].type = Decision::Type::LEAF;
+			cost.cost[0] = cost_leaf;
+		} else {
+			decisions_node[0].type = Decision::Type::INTERNAL;
+			cost.cost[0] = cost_internal;
+		}
+
+		decisions_node[0].distribute_left  = distribute_left;
+		decisions_node[0].distribute_right = distribute_right;
 	}
 
-	// Handle the special case where the root is a leaf
-	if (bvh2.nodes[0].is_leaf()) {
-		bvh4.nodes[0].aabb_min_x[0] = bvh2.nodes[0].aabb.min.x;
-		bvh4.nodes[0].aabb_min_y[0] = bvh2.nodes[0].aabb.min.y;
-		bvh4.nodes[0].aabb_min_z[0] = bvh2.nodes[0].aabb.min.z;
-		bvh4.nodes[0].aabb_max_x[0] = bvh2.nodes[0].aabb.max.x;
-		bvh4.nodes[0].aabb_max_y[0] = bvh2.nodes[0].aabb.max.y;
-		bvh4.nodes[0].aabb_max_z[0] = bvh2.nodes[0].aabb.max.z;
-
-		bvh4.nodes[0].get_index(0) = bvh2.nodes[0].first;
-		bvh4.nodes[0].get_count(0) = bvh2.nodes[0].count;
-
-		for (int i = 1; i < 4; i++) {
-			bvh4.nodes[0].get_index(i) = INVALID;
-			bvh4.nodes[0].get_count(i) = INVALID;
+	// Distribute i+1 slots over both children, or use fewer slots if that is cheaper
+	for (int i = 1; i < 3; i++) {
+		float cost_distribute = cost.cost[i - 1];
+
+		int distribute_left  = INVALID;
+		int distribute_right = INVALID;
+
+		for (int k = 0; k < i; k++) {
+			float c = cost_left.cost[k] + cost_right.cost[i - k - 1];
+
+			if (c < cost_distribute) {
+				cost_distribute = c;
+
+				distribute_left  =     k;
+				distribute_right = i - k - 1;
+			}
 		}
+
+		cost.cost[i] = cost_distribute;
+
+		if (distribute_left != INVALID) {
+			decisions_node[i].type = Decision::Type::DISTRIBUTE;
+			decisions_node[i].distribute_left  = distribute_left;
+			decisions_node[i].distribute_right = distribute_right;
+		} else {
+			decisions_node[i] = decisions_node[i - 1];
+		}
+	}
+
+	cost.primitive_count = num_primitives;
+}
+
+void BVH4Converter::get_children(int node_index, int children[4], int & child_count, int i) {
+	const BVHNode2 & node = bvh2.nodes[node_index];
+
+	if (node.is_leaf()) {
+		children[child_count++] = node_index;
+		return;
+	}
+
+	int distribute_left  = decisions[node_index * 3 + i].distribute_left;
+	int distribute_right = decisions[node_index * 3 + i].distribute_right;
+
+	// Recurse on left child if it needs to distribute
+	if (decisions[node.left * 3 + distribute_left].type == Decision::Type::DISTRIBUTE) {
+		get_children(node.left, children, child_count, distribute_left);
 	} else {
-		// Collapse tree top-down, starting from the root
-		collapse(0);
-		// Possible optimization, remove recursion from collapse() as well -Herdi
-		//for (size_t i = 0; i < bvh4.nodes.size(); i++) {
-		//	collapse(i);
-		//}
+		children[child_count++] = node.left;
 	}
 
-	bvh4.indices = bvh2.indices; // NOTE: copy
+	// Recurse on right child if it needs to distribute
+	if (decisions[(node.left + 1) * 3 + distribute_right].type == Decision::Type::DISTRIBUTE) {
+		get_children(node.left + 1, children, child_count, distribute_right);
+	} else {
+		children[child_count++] = node.left + 1;
+	}
 }
-// SAH collapsing based only on merging a child node into its parent -Herdi
-void BVH4Converter::collapse(int node_index) {
-   	BVHNode4 & node = bvh4.nodes[node_index];
-	while (true) {
-		int child_count = node.get_child_count();
-
-		// Look for adoptable child with the largest surface area
-		float max_area  = -INFINITY;
-		int   max_index = INVALID;
-
-		for (int i = 0; i < child_count; i++) {
-			if (!node.is_leaf(i)) {
-				int child_i_child_count = bvh4.nodes[node.get_index(i)].get_child_count();
-
-				// Check if the current Node can adopt the children of child Node i
-				if (child_count + child_i_child_count - 1 <= 4) {
-					float diff_x = node.aabb_max_x[i] - node.aabb_min_x[i];
-					float diff_y = node.aabb_max_y[i] - node.aabb_min_y[i];
-					float diff_z = node.aabb_max_z[i] - node.aabb_min_z[i];
-
-					float half_area = diff_x * diff_y + diff_y * diff_z + diff_z * diff_x;
-
-					if (half_area > max_area) {
-						max_area  = half_area;
-						max_index = i;
-					}
-				}
-			}
+
+// Recursively appends the primitives in subtree of the given Node to the indices buffer of the BVH4
+int BVH4Converter::write_primitives(int node_index) {
+	const BVHNode2 & node = bvh2.nodes[node_index];
+
+	if (node.is_leaf()) {
+		for (unsigned i = 0; i < node.count; i++) {
+			bvh4.indices.push_back(bvh2.indices[node.first + i]);
 		}
 
-		// No merge possible anymore, stop trying
-		if (max_index == INVALID) break;
-
-		const BVHNode4 & max_child = bvh4.nodes[node.get_index(max_index)];
-
-		// Replace max child Node with its first child
-		node.aabb_min_x[max_index] = max_child.aabb_min_x[0];
-		node.aabb_min_y[max_index] = max_child.aabb_min_y[0];
-		node.aabb_min_z[max_index] = max_child.aabb_min_z[0];
-		node.aabb_max_x[max_index] = max_child.aabb_max_x[0];
-		node.aabb_max_y[max_index] = max_child.aabb_max_y[0];
-		node.aabb_max_z[max_index] = max_child.aabb_max_z[0];
-		node.get_index(max_index) = max_child.get_index(0);
-		node.get_count(max_index) = max_child.get_count(0);
-
-		int max_child_child_count = max_child.get_child_count();
-
-		// Add the rest of max child Node's children after the current Node's own children
-		for (int i = 1; i < max_child_child_count; i++) {
-			node.aabb_min_x[child_count + i - 1] = max_child.aabb_min_x[i];
-			node.aabb_min_y[child_count + i - 1] = max_child.aabb_min_y[i];
-			node.aabb_min_z[child_count + i - 1] = max_child.aabb_min_z[i];
-			node.aabb_max_x[child_count + i - 1] = max_child.aabb_max_x[i];
-			node.aabb_max_y[child_count + i - 1] = max_child.aabb_max_y[i];
-			node.aabb_max_z[child_count + i - 1] = max_child.aabb_max_z[i];
-			node.get_index(child_count + i - 1) = max_child.get_index(i);
-			node.get_count(child_count + i - 1) = max_child.get_count(i);
+		return node.count;
+	}
+
+	return
+		write_primitives(node.left) +
+		write_primitives(node.left + 1);
+}
+
+void BVH4Converter::collapse(int node_index_bvh4, int node_index_bvh2) {
+	int child_count = 0;
+	int children[4] = { INVALID, INVALID, INVALID, INVALID };
+	get_children(node_index_bvh2, children, child_count, 0);
+	ASSERT(child_count <= 4);
+
+	// Internal children are placed next to each other
+	int child_nodes[4] = { INVALID, INVALID, INVALID, INVALID };
+
+	for (int i = 0; i < child_count; i++) {
+		if (decisions[children[i] * 3].type == Decision::Type::INTERNAL) {
+			child_nodes[i] = int(bvh4.nodes.size());
+			bvh4.nodes.emplace_back();
 		}
-	};
+	}
+
+	BVHNode4 & node = bvh4.nodes[node_index_bvh4]; // NOTE: obtained after emplace_back, which may invalidate references
 
 	for (int i = 0; i < 4; i++) {
-		if (node.get_count(i) == INVALID) break;
+		if (i >= child_count) {
+			node.get_index(i) = INVALID;
+			node.get_count(i) = INVALID;
+			continue;
+		}
+
+		const AABB & aabb = bvh2.nodes[children[i]].aabb;
+		node.aabb_min_x[i] = aabb.min.x;
+		node.aabb_min_y[i] = aabb.min.y;
+		node.aabb_min_z[i] = aabb.min.z;
+		node.aabb_max_x[i] = aabb.max.x;
+		node.aabb_max_y[i] = aabb.max.y;
+		node.aabb_max_z[i] = aabb.max.z;
+
+		if (child_nodes[i] == INVALID) {
+			node.get_index(i) = int(bvh4.indices.size());
+			node.get_count(i) = write_primitives(children[i]);
+			ASSERT(node.get_count(i) > 0);
+		} else {
+			node.get_index(i) = child_nodes[i];
+			node.get_count(i) = 0;
+		}
+	}
+
+	// Recurse on Internal Nodes
+	for (int i = 0; i < child_count; i++) {
+		if (child_nodes[i] != INVALID) {
+			collapse(child_nodes[i], children[i]);
+		}
+	}
+}
+
+BVHNode4Quantized BVH4Converter::quantize(const BVHNode4 & node) {
+	BVHNode4Quantized result = { };
 
-		// If child Node i is an internal node, recurse
-		if (node.get_count(i) == 0) {
-			collapse(node.get_index(i));
+	int child_count = node.get_child_count();
+
+	AABB aabb = AABB::create_empty();
+	for (int i = 0; i < child_count; i++) {
+		aabb.expand(node.get_child_aabb(i));
+	}
+
+	Vector3 one_over_e = BVHQuantizer::quantize_node(result, aabb);
+
+	for (int i = 0; i < 4; i++) {
+		if (i < child_count) {
+			BVHQuantizer::quantize_child(result, i, node.get_child_aabb(i), one_over_e);
+
+			ASSERT(node.get_count(i) < 256);
+			result.index[i] = node.get_index(i);
+			result.count[i] = byte(node.get_count(i));
+		} else {
+			result.index[i] = INVALID;
+			result.count[i] = 0;
 		}
 	}
+
+	return result;
 }
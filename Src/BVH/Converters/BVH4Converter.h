@@ -5,13 +5,50 @@ struct BVH4Converter final : BVHConverter {
 	      BVH4 & bvh4;
 	const BVH2 & bvh2;
 
-	BVH4Converter(BVH4 & bvh4, const BVH2 & bvh2) : bvh4(bvh4), bvh2(bvh2) {
-		bvh4.indices = bvh2.indices;
-		bvh4.nodes.resize(bvh2.nodes.size());
+	// Maximum number of primitives that can be collapsed into a single leaf
+	// The TLAS requires 1, since the GPU traversal treats leaves as a single Mesh
+	int max_primitives_in_leaf;
+
+	static constexpr int MAX_PRIMITIVES_IN_LEAF = 4;
+
+	BVH4Converter(BVH4 & bvh4, const BVH2 & bvh2, int max_primitives_in_leaf = MAX_PRIMITIVES_IN_LEAF) : bvh4(bvh4), bvh2(bvh2), max_primitives_in_leaf(max_primitives_in_leaf) {
+		bvh4.indices.reserve(bvh2.indices.size());
+		bvh4.nodes  .reserve(bvh2.nodes  .size() / 2);
 	}
 
 	void convert() override;
 
+	// Compresses a Node into the 64 byte format, child AABBs are rounded outwards
+	static BVHNode4Quantized quantize(const BVHNode4 & node);
+
 private:
-	void collapse(int node_index);
+	// One byte per BVH2 Node per number of allowed children (1..3)
+	struct Decision {
+		enum struct Type : unsigned char {
+			LEAF,
+			INTERNAL,
+			DISTRIBUTE
+		};
+
+		Type          type             : 2;
+		unsigned char distribute_left  : 2;
+		unsigned char distribute_right : 2;
+	};
+	static_assert(sizeof(Decision) == 1);
+
+	// Result of the dynamic programming for a subtree, only needed by the parent of the subtree
+	struct Cost {
+		float cost[3];
+		int   primitive_count;
+	};
+
+	Array<Decision> decisions;
+
+	void calculate_cost(int node_index, Cost & cost);
+
+	void get_children(int node_index, int children[4], int & child_count, int i);
+
+	int write_primitives(int node_index);
+
+	void collapse(int node_index_bvh4, int node_index_bvh2);
 };
@@ -2,151 +2,283 @@
 
 #include <string.h>
 
+#include "Config.h"
+
 #include "Core/IO.h"
+#include "Core/Sort.h"
+
+#include "BVH/BVHQuantizer.h"
+
+#include "Util/ThreadPool.h"
 
 void BVH8Converter::convert() {
-	bvh8.indices.clear();
-	bvh8.indices.reserve(bvh2.indices.size());
+	size_t node_count = bvh2.nodes.size();
 
-	bvh8.nodes.clear();
-	bvh8.nodes.emplace_back(); // Root
+	decisions       .resize(node_count * 7);
+	bvh8_node_counts.resize(node_count);
+	primitive_counts.resize(node_count);
 
-	decisions.resize(bvh2.nodes.size() * 7);
+	bool parallel =
+		cpu_config.enable_parallel_bvh_build &&
+		ThreadPool::get_thread_count() > 0 &&
+		node_count >= PARALLEL_CONVERT_MIN_NODES;
 
 	// Fill cost table using dynamic programming (bottom up)
-	calculate_cost(0, bvh2.nodes);
+	Cost cost_root;
 
-	// Collapse SBVH into 8-way tree (top down)
-	collapse(bvh2.nodes, bvh2.indices, 0, 0);
+	if (!parallel) {
+		calculate_cost(0, cost_root);
+	} else {
+		// Subtrees below a fixed depth of the BVH2 are processed in parallel, there should be enough of them to balance the load
+		int thread_count = ThreadPool::get_thread_count() + 1;
+		int task_depth   = 1;
+		while ((1 << task_depth) < 32 * thread_count) task_depth++;
+
+		Array<CostTask> tasks;
+		collect_cost_tasks(0, 0, task_depth, tasks);
+
+		ThreadPool::parallel_for(int(tasks.size()), [this, &tasks](int i) {
+			calculate_cost(tasks[i].node_index, tasks[i].cost);
+		});
+
+		// Finish the top of the tree on the calling thread
+		size_t task_offset = 0;
+		calculate_cost_top(0, cost_root, 0, task_depth, tasks, task_offset);
+		ASSERT(task_offset == tasks.size());
+	}
+
+	// The BVH8 Nodes and indices of every subtree go to a known location, so they can be allocated up front
+	bvh8.nodes  .clear();
+	bvh8.indices.clear();
+	bvh8.nodes  .resize(bvh8_node_counts[0]);
+	bvh8.indices.resize(primitive_counts[0]);
 	ASSERT(bvh8.indices.size() == bvh2.indices.size());
+
+	// Collapse SBVH into 8-way tree (top down)
+	if (!parallel) {
+		collapse(0, 0, 1, 0, nullptr, 0);
+	} else {
+		// Collapse the top of the tree on the calling thread, deeper subtrees are deferred
+		int thread_count = ThreadPool::get_thread_count() + 1;
+		int task_depth   = 1;
+		while ((1 << (3 * task_depth)) < 16 * thread_count) task_depth++;
+
+		Array<CollapseTask> tasks;
+		collapse(0, 0, 1, 0, &tasks, task_depth);
+
+		// Start with the largest subtrees for better load balancing
+		Sort::quick_sort(tasks.begin(), tasks.end(), [this](const CollapseTask & a, const CollapseTask & b) {
+			return bvh8_node_counts[a.node_index_bvh2] > bvh8_node_counts[b.node_index_bvh2];
+		});
+
+		// Subtrees write to disjoint ranges of Nodes and indices, so no synchronization is needed
+		ThreadPool::parallel_for(int(tasks.size()), [this, &tasks](int i) {
+			const CollapseTask & task = tasks[i];
+			collapse(task.node_index_bvh8, task.node_index_bvh2, task.base_index_child, task.base_index_triangle, nullptr, 0);
+		});
+	}
 }
 
-int BVH8Converter::calculate_cost(int node_index, const Array<BVHNode2> & nodes) {
-	const BVHNode2 & node = nodes[node_index];
+void BVH8Converter::calculate_cost_leaf(int node_index, Cost & cost) {
+	const BVHNode2 & node = bvh2.nodes[node_index];
 
-	int num_primitives;
+	int num_primitives = node.count;
+	if (num_primitives != 1) {
+		IO::print("ERROR: BVH8 Builder expects BVH with leaf Nodes containing only 1 primitive!\n"_sv);
+		IO::exit(1);
+	}
 
-	if (node.is_leaf()) {
-		num_primitives = node.count;
-		if (num_primitives != 1) {
-			IO::print("ERROR: BVH8 Builder expects BVH with leaf Nodes containing only 1 primitive!\n"_sv);
-			IO::exit(1);
-		}
+	// SAH cost
+	float cost_leaf = node.aabb.surface_area() * float(num_primitives);
 
-		// SAH cost
-		float cost_leaf = node.aabb.surface_area() * float(num_primitives);
+	for (int i = 0; i < 7; i++) {
+		decisions[node_index * 7 + i].type = Decision::Type::LEAF;
 
-		for (int i = 0; i < 7; i++) {
-			decisions[node_index * 7 + i].type = Decision::Type::LEAF;
-			decisions[node_index * 7 + i].cost = cost_leaf;
-		}
-	} else {
-		num_primitives =
-			calculate_cost(node.left,     nodes) +
-			calculate_cost(node.left + 1, nodes);
+		cost.cost       [i] = cost_leaf;
+		cost.node_counts[i] = 0;
+	}
+	cost.primitive_count = num_primitives;
 
-		// Separate case: i=0 (i=1 in the paper)
-		{
-			float cost_leaf = num_primitives <= 3 ? float(num_primitives) * node.aabb.surface_area() : INFINITY;
+	bvh8_node_counts[node_index] = 1;
+	primitive_counts[node_index] = num_primitives;
+}
 
-			float cost_distribute = INFINITY;
+void BVH8Converter::calculate_cost_internal(int node_index, const Cost & cost_left, const Cost & cost_right, Cost & cost) {
+	const BVHNode2 & node = bvh2.nodes[node_index];
 
-			char distribute_left  = INVALID;
-			char distribute_right = INVALID;
+	Decision * decisions_node = &decisions[node_index * 7];
 
-			for (int k = 0; k < 7; k++) {
-				float c =
-					decisions[(node.left)     * 7 +     k].cost +
-					decisions[(node.left + 1) * 7 + 6 - k].cost;
+	int num_primitives = cost_left.primitive_count + cost_right.primitive_count;
 
-				if (c < cost_distribute) {
-					cost_distribute = c;
+	// Separate case: i=0 (i=1 in the paper)
+	{
+		float cost_leaf = num_primitives <= 3 ? float(num_primitives) * node.aabb.surface_area() : INFINITY;
 
-					distribute_left  =     k;
-					distribute_right = 6 - k;
-				}
-			}
+		float cost_distribute = INFINITY;
+
+		int distribute_left  = INVALID;
+		int distribute_right = INVALID;
+
+		for (int k = 0; k < 7; k++) {
+			float c = cost_left.cost[k] + cost_right.cost[6 - k];
 
-			float cost_internal = cost_distribute + node.aabb.surface_area();
+			if (c < cost_distribute) {
+				cost_distribute = c;
 
-			if (cost_leaf < cost_internal) {
-				decisions[node_index * 7].type = Decision::Type::LEAF;
-				decisions[node_index * 7].cost = cost_leaf;
-			} else {
-				decisions[node_index * 7].type = Decision::Type::INTERNAL;
-				decisions[node_index * 7].cost = cost_internal;
+				distribute_left  =     k;
+				distribute_right = 6 - k;
 			}
+		}
+		ASSERT(distribute_left != INVALID);
+
+		float cost_internal = cost_distribute + node.aabb.surface_area();
 
-			decisions[node_index * 7].distribute_left  = distribute_left;
-			decisions[node_index * 7].distribute_right = distribute_right;
+		if (cost_leaf < cost_internal) {
+			decisions_node[0].type = Decision::Type::LEAF;
+			cost.cost[0] = cost_leaf;
+		} else {
+			decisions_node[0].type = Decision::Type::INTERNAL;
+			cost.cost[0] = cost_internal;
 		}
 
-		// In the paper i=2..7
-		for (int i = 1; i < 7; i++) {
-			float cost_distribute = decisions[node_index * 7 + i - 1].cost;
+		decisions_node[0].distribute_left  = distribute_left;
+		decisions_node[0].distribute_right = distribute_right;
+	}
 
-			char distribute_left  = INVALID;
-			char distribute_right = INVALID;
+	// In the paper i=2..7
+	for (int i = 1; i < 7; i++) {
+		float cost_distribute = cost.cost[i - 1];
 
-			for (int k = 0; k < i; k++) {
-				float c =
-					decisions[(node.left)     * 7 +     k    ].cost +
-					decisions[(node.left + 1) * 7 + i - k - 1].cost;
+		int distribute_left  = INVALID;
+		int distribute_right = INVALID;
 
-				if (c < cost_distribute) {
-					cost_distribute = c;
+		for (int k = 0; k < i; k++) {
+			float c = cost_left.cost[k] + cost_right.cost[i - k - 1];
 
-					distribute_left  =     k;
-					distribute_right = i - k - 1;
-				}
+			if (c < cost_distribute) {
+				cost_distribute = c;
+
+				distribute_left  =     k;
+				distribute_right = i - k - 1;
 			}
+		}
 
-			decisions[node_index * 7 + i].cost = cost_distribute;
+		cost.cost[i] = cost_distribute;
 
-			if (distribute_left != INVALID) {
-				decisions[node_index * 7 + i].type = Decision::Type::DISTRIBUTE;
-				decisions[node_index * 7 + i].distribute_left  = distribute_left;
-				decisions[node_index * 7 + i].distribute_right = distribute_right;
-			} else {
-				decisions[node_index * 7 + i] = decisions[node_index * 7 + i - 1];
-			}
+		if (distribute_left != INVALID) {
+			decisions_node[i].type = Decision::Type::DISTRIBUTE;
+			decisions_node[i].distribute_left  = distribute_left;
+			decisions_node[i].distribute_right = distribute_right;
+		} else {
+			decisions_node[i] = decisions_node[i - 1];
 		}
 	}
 
-	return num_primitives;
+	// Count the BVH8 Nodes that collapse() will generate, mirroring get_children()
+	auto get_node_count = [this](int child_index, const Cost & child_cost, int i) {
+		if (decisions[child_index * 7 + i].type == Decision::Type::DISTRIBUTE) {
+			return child_cost.node_counts[i];
+		} else if (decisions[child_index * 7].type == Decision::Type::INTERNAL) {
+			return 1 + child_cost.node_counts[0];
+		} else {
+			return 0;
+		}
+	};
+
+	for (int i = 0; i < 7; i++) {
+		cost.node_counts[i] =
+			get_node_count(node.left,     cost_left,  decisions_node[i].distribute_left) +
+			get_node_count(node.left + 1, cost_right, decisions_node[i].distribute_right);
+	}
+	cost.primitive_count = num_primitives;
+
+	bvh8_node_counts[node_index] = 1 + cost.node_counts[0];
+	primitive_counts[node_index] = num_primitives;
 }
 
-void BVH8Converter::get_children(int node_index, const Array<BVHNode2> & nodes, int children[8], int & child_count, int i) {
-	const BVHNode2 & node = nodes[node_index];
+void BVH8Converter::calculate_cost(int node_index, Cost & cost) {
+	const BVHNode2 & node = bvh2.nodes[node_index];
+
+	if (node.is_leaf()) {
+		calculate_cost_leaf(node_index, cost);
+	} else {
+		Cost cost_left;
+		Cost cost_right;
+		calculate_cost(node.left,     cost_left);
+		calculate_cost(node.left + 1, cost_right);
+
+		calculate_cost_internal(node_index, cost_left, cost_right, cost);
+	}
+}
+
+// Same as calculate_cost(), but takes the costs of subtrees at the task depth from the already processed tasks
+void BVH8Converter::calculate_cost_top(int node_index, Cost & cost, int depth, int task_depth, Array<CostTask> & tasks, size_t & task_offset) {
+	if (depth == task_depth) {
+		ASSERT(tasks[task_offset].node_index == node_index);
+		cost = tasks[task_offset++].cost;
+		return;
+	}
+
+	const BVHNode2 & node = bvh2.nodes[node_index];
+
+	if (node.is_leaf()) {
+		calculate_cost_leaf(node_index, cost);
+	} else {
+		Cost cost_left;
+		Cost cost_right;
+		calculate_cost_top(node.left,     cost_left,  depth + 1, task_depth, tasks, task_offset);
+		calculate_cost_top(node.left + 1, cost_right, depth + 1, task_depth, tasks, task_offset);
+
+		calculate_cost_internal(node_index, cost_left, cost_right, cost);
+	}
+}
+
+// Collects the subtrees at the task depth, in the same order in which calculate_cost_top() visits them
+void BVH8Converter::collect_cost_tasks(int node_index, int depth, int task_depth, Array<CostTask> & tasks) {
+	if (depth == task_depth) {
+		tasks.emplace_back(node_index);
+		return;
+	}
+
+	const BVHNode2 & node = bvh2.nodes[node_index];
+
+	if (!node.is_leaf()) {
+		collect_cost_tasks(node.left,     depth + 1, task_depth, tasks);
+		collect_cost_tasks(node.left + 1, depth + 1, task_depth, tasks);
+	}
+}
+
+void BVH8Converter::get_children(int node_index, int children[8], int & child_count, int i) {
+	const BVHNode2 & node = bvh2.nodes[node_index];
 
 	if (node.is_leaf()) {
 		children[child_count++] = node_index;
 		return;
 	}
 
-	char distribute_left  = decisions[node_index * 7 + i].distribute_left;
-	char distribute_right = decisions[node_index * 7 + i].distribute_right;
+	int distribute_left  = decisions[node_index * 7 + i].distribute_left;
+	int distribute_right = decisions[node_index * 7 + i].distribute_right;
 
 	ASSERT(distribute_left  >= 0 && distribute_left  < 7);
 	ASSERT(distribute_right >= 0 && distribute_right < 7);
 
 	// Recurse on left child if it needs to distribute
 	if (decisions[node.left * 7 + distribute_left].type == Decision::Type::DISTRIBUTE) {
-		get_children(node.left, nodes, children, child_count, distribute_left);
+		get_children(node.left, children, child_count, distribute_left);
 	} else {
 		children[child_count++] = node.left;
 	}
 
 	// Recurse on right child if it needs to distribute
 	if (decisions[(node.left + 1) * 7 + distribute_right].type == Decision::Type::DISTRIBUTE) {
-		get_children(node.left + 1, nodes, children, child_count, distribute_right);
+		get_children(node.left + 1, children, child_count, distribute_right);
 	} else {
 		children[child_count++] = node.left + 1;
 	}
 }
 
-void BVH8Converter::order_children(int node_index, const Array<BVHNode2> & nodes, int children[8], int child_count) {
-	Vector3 p = nodes[node_index].aabb.get_center();
+void BVH8Converter::order_children(int node_index, int children[8], int child_count) {
+	Vector3 p = bvh2.nodes[node_index].aabb.get_center();
 
 	float cost[8][8] = { };
 
@@ -159,7 +291,7 @@ void BVH8Converter::order_children(int node_index, const Array<BVHNode2> & nodes
 				(s & 0b001) ? -1.0f : +1.0f
 			);
 
-			cost[c][s] = Vector3::dot(nodes[children[c]].aabb.get_center() - p, direction);
+			cost[c][s] = Vector3::dot(bvh2.nodes[children[c]].aabb.get_center() - p, direction);
 		}
 	}
 
@@ -207,68 +339,50 @@ void BVH8Converter::order_children(int node_index, const Array<BVHNode2> & nodes
 	}
 }
 
-// Recursively count triangles in subtree of the given Node
-// Simultaneously fills the indices buffer of the BVH8
-int BVH8Converter::count_primitives(int node_index, const Array<BVHNode2> & nodes, const Array<int> & indices) {
-	const BVHNode2 & node = nodes[node_index];
+// Recursively writes the primitives in subtree of the given Node to the indices buffer of the BVH8
+int BVH8Converter::write_primitives(int node_index, int index_offset) {
+	const BVHNode2 & node = bvh2.nodes[node_index];
 
 	if (node.is_leaf()) {
 		ASSERT(node.count == 1);
 
 		for (unsigned i = 0; i < node.count; i++) {
-			bvh8.indices.push_back(indices[node.first + i]);
+			bvh8.indices[index_offset + i] = bvh2.indices[node.first + i];
 		}
 
 		return node.count;
 	}
 
-	return
-		count_primitives(node.left,     nodes, indices) +
-		count_primitives(node.left + 1, nodes, indices);
+	int count_left = write_primitives(node.left, index_offset);
+	return count_left + write_primitives(node.left + 1, index_offset + count_left);
 }
 
-void BVH8Converter::collapse(const Array<BVHNode2> & nodes_bvh, const Array<int> & indices_bvh, int node_index_bvh8, int node_index_bvh2) {
-	BVHNode8 & node = bvh8.nodes[node_index_bvh8];
-	const AABB & aabb = nodes_bvh[node_index_bvh2].aabb;
-
-	node.p = aabb.min;
-
-	constexpr int Nq = 8;
-	constexpr float denom = 1.0f / float((1 << Nq) - 1);
-
-	Vector3 e(
-		exp2f(ceilf(log2f((aabb.max.x - aabb.min.x) * denom))),
-		exp2f(ceilf(log2f((aabb.max.y - aabb.min.y) * denom))),
-		exp2f(ceilf(log2f((aabb.max.z - aabb.min.z) * denom)))
-	);
-
-	Vector3 one_over_e(1.0f / e.x, 1.0f / e.y, 1.0f / e.z);
-
-	unsigned u_ex = Util::bit_cast<unsigned>(e.x);
-	unsigned u_ey = Util::bit_cast<unsigned>(e.y);
-	unsigned u_ez = Util::bit_cast<unsigned>(e.z);
+// Collapses the subtree of the given BVH2 Node into the given BVH8 Node
+// The children of the BVH8 Node are placed at base_index_child, followed by the subtrees of these children in order.
+// This results in the same depth first layout as appending Nodes during a serial traversal would
+void BVH8Converter::collapse(int node_index_bvh8, int node_index_bvh2, int base_index_child, int base_index_triangle, Array<CollapseTask> * tasks, int task_depth) {
+	// When collapsing in parallel, subtrees at the task depth are deferred so that they can be distributed over the ThreadPool
+	if (tasks && task_depth == 0) {
+		tasks->emplace_back(node_index_bvh8, node_index_bvh2, base_index_child, base_index_triangle);
+		return;
+	}
 
-	// Only the exponent bits can be non-zero
-	ASSERT((u_ex & 0b10000000011111111111111111111111) == 0);
-	ASSERT((u_ey & 0b10000000011111111111111111111111) == 0);
-	ASSERT((u_ez & 0b10000000011111111111111111111111) == 0);
+	BVHNode8 & node = bvh8.nodes[node_index_bvh8];
+	const AABB & aabb = bvh2.nodes[node_index_bvh2].aabb;
 
-	// Store only 8 bit exponent
-	node.e[0] = u_ex >> 23;
-	node.e[1] = u_ey >> 23;
-	node.e[2] = u_ez >> 23;
+	Vector3 one_over_e = BVHQuantizer::quantize_node(node, aabb);
 
 	int child_count = 0;
 	int children[8] = { INVALID, INVALID, INVALID, INVALID, INVALID, INVALID, INVALID, INVALID };
-	get_children(node_index_bvh2, nodes_bvh, children, child_count, 0);
+	get_children(node_index_bvh2, children, child_count, 0);
 	ASSERT(child_count <= 8);
 
-	order_children(node_index_bvh2, nodes_bvh, children, child_count);
+	order_children(node_index_bvh2, children, child_count);
 
 	node.imask = 0;
 
-	node.base_index_triangle = unsigned(bvh8.indices.size());
-	node.base_index_child    = unsigned(bvh8.nodes  .size());
+	node.base_index_triangle = unsigned(base_index_triangle);
+	node.base_index_child    = unsigned(base_index_child);
 
 	int num_internal_nodes = 0;
 	int num_triangles      = 0;
@@ -277,19 +391,11 @@ void BVH8Converter::collapse(const Array<BVHNode2> & nodes_bvh, const Array<int>
 		int child_index = children[i];
 		if (child_index == INVALID) continue; // Empty slot
 
-		const AABB & child_aabb = nodes_bvh[child_index].aabb;
-
-		node.quantized_min_x[i] = byte(floorf((child_aabb.min.x - node.p.x) * one_over_e.x));
-		node.quantized_min_y[i] = byte(floorf((child_aabb.min.y - node.p.y) * one_over_e.y));
-		node.quantized_min_z[i] = byte(floorf((child_aabb.min.z - node.p.z) * one_over_e.z));
-
-		node.quantized_max_x[i] = byte(ceilf((child_aabb.max.x - node.p.x) * one_over_e.x));
-		node.quantized_max_y[i] = byte(ceilf((child_aabb.max.y - node.p.y) * one_over_e.y));
-		node.quantized_max_z[i] = byte(ceilf((child_aabb.max.z - node.p.z) * one_over_e.z));
+		BVHQuantizer::quantize_child(node, i, bvh2.nodes[child_index].aabb, one_over_e);
 
 		switch (decisions[child_index * 7].type) {
 			case Decision::Type::LEAF: {
-				int triangle_count = count_primitives(child_index, nodes_bvh, indices_bvh);
+				int triangle_count = write_primitives(child_index, base_index_triangle + num_triangles);
 				ASSERT(triangle_count > 0 && triangle_count <= 3);
 
 				// Three highest bits contain unary representation of triangle count
@@ -314,22 +420,21 @@ void BVH8Converter::collapse(const Array<BVHNode2> & nodes_bvh, const Array<int>
 		}
 	}
 
-	for (int i = 0; i < num_internal_nodes; i++) {
-		bvh8.nodes.emplace_back();
-	}
-	node = bvh8.nodes[node_index_bvh8]; // NOTE: 'node' may have been invalidated by emplace_back on previous line
-
-	ASSERT(node.base_index_child    + num_internal_nodes == bvh8.nodes  .size());
-	ASSERT(node.base_index_triangle + num_triangles      == bvh8.indices.size());
+	// Recurse on Internal Nodes, their subtrees follow each other after the children of the current Node
+	int offset_child    = base_index_child    + num_internal_nodes;
+	int offset_triangle = base_index_triangle + num_triangles;
 
-	// Recurse on Internal Nodes
 	int offset = 0;
 	for (int i = 0; i < 8; i++) {
 		int child_index = children[i];
 		if (child_index == INVALID) continue;
 
 		if (node.imask & (1 << i)) {
-			collapse(nodes_bvh, indices_bvh, node.base_index_child + offset++, child_index);
+			collapse(base_index_child + offset++, child_index, offset_child, offset_triangle, tasks, task_depth - 1);
+
+			offset_child    += bvh8_node_counts[child_index] - 1;
+			offset_triangle += primitive_counts[child_index];
 		}
 	}
+	ASSERT(offset_child == base_index_child + bvh8_node_counts[node_index_bvh2] - 1);
 }
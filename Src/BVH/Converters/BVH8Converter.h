@@ -12,28 +12,65 @@ struct BVH8Converter final : BVHConverter {
 
 	void convert() override;
 
+	// BVHs with fewer Nodes than this are always converted on a single thread
+	static constexpr int PARALLEL_CONVERT_MIN_NODES = 64 * 1024;
+
 private:
+	// One byte per BVH2 Node per number of allowed children (1..7)
 	struct Decision {
-		enum struct Type : char {
+		enum struct Type : unsigned char {
 			LEAF,
 			INTERNAL,
 			DISTRIBUTE
-		} type;
+		};
 
-		char distribute_left;
-		char distribute_right;
+		Type          type             : 2;
+		unsigned char distribute_left  : 3;
+		unsigned char distribute_right : 3;
+	};
+	static_assert(sizeof(Decision) == 1);
 
-		float cost;
+	// Result of the dynamic programming for a subtree, only needed by the parent of the subtree,
+	// so that it lives on the stack instead of in the decision table
+	struct Cost {
+		float cost       [7];
+		int   node_counts[7]; // Number of BVH8 Nodes generated by the children that are collected when distributing over i+1 children
+		int   primitive_count;
+	};
+
+	// Subtree whose cost calculation is deferred, so that it can be processed on any thread of the ThreadPool
+	struct CostTask {
+		int  node_index;
+		Cost cost;
+	};
+
+	// Subtree whose collapse is deferred, so that it can be processed on any thread of the ThreadPool
+	struct CollapseTask {
+		int node_index_bvh8;
+		int node_index_bvh2;
+		int base_index_child;
+		int base_index_triangle;
 	};
 
 	Array<Decision> decisions;
 
-	int calculate_cost(int node_index, const Array<BVHNode2> & nodes);
+	// Size of the BVH8 subtree resp. number of primitives under every BVH2 Node,
+	// allows subtrees to be collapsed directly into their final location
+	Array<int> bvh8_node_counts;
+	Array<int> primitive_counts;
+
+	void calculate_cost_leaf    (int node_index, Cost & cost);
+	void calculate_cost_internal(int node_index, const Cost & cost_left, const Cost & cost_right, Cost & cost);
+
+	void calculate_cost    (int node_index, Cost & cost);
+	void calculate_cost_top(int node_index, Cost & cost, int depth, int task_depth, Array<CostTask> & tasks, size_t & task_offset);
+
+	void collect_cost_tasks(int node_index, int depth, int task_depth, Array<CostTask> & tasks);
 
-	void get_children  (int node_index, const Array<BVHNode2> & nodes, int children[8], int & child_count, int i);
-	void order_children(int node_index, const Array<BVHNode2> & nodes, int children[8], int   child_count);
+	void get_children  (int node_index, int children[8], int & child_count, int i);
+	void order_children(int node_index, int children[8], int   child_count);
 
-	int count_primitives(int node_index, const Array<BVHNode2> & nodes, const Array<int> & indices_sbvh);
+	int write_primitives(int node_index, int index_offset);
 
-	void collapse(const Array<BVHNode2> & nodes_bvh, const Array<int> & indices_bvh, int node_index_bvh8, int node_index_bvh2);
+	void collapse(int node_index_bvh8, int node_index_bvh2, int base_index_child, int base_index_triangle, Array<CollapseTask> * tasks, int task_depth);
 };
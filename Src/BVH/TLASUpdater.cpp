@@ -0,0 +1,367 @@
+#include "TLASUpdater.h"
+
+#include "Config.h"
+
+#include "Core/Sort.h"
+
+#include "BVH/BVHRefitter.h"
+#include "BVH/Builders/BVHBuilder.h"
+#include "BVH/Builders/BVHPartitions.h"
+
+#include "Renderer/Mesh.h"
+
+void TLASUpdater::full_rebuild(const Array<Mesh> & meshes) {
+	size_t mesh_count = meshes.size();
+
+	builder.build(meshes);
+
+	mesh_aabbs    .resize(mesh_count);
+	mesh_centers  .resize(mesh_count);
+	mesh_leaves   .resize(mesh_count);
+	parent_indices.resize(tlas.nodes.size());
+
+	for (size_t i = 0; i < mesh_count; i++) {
+		mesh_aabbs  [i] = meshes[i].get_aabb();
+		mesh_centers[i] = meshes[i].get_center();
+	}
+
+	parent_indices[0] = INVALID;
+
+	subtree_root_flags = BitArray(tlas.nodes.size());
+	subtree_root_flags.set_all(false);
+
+	for (size_t i = 0; i < tlas.nodes.size(); i++) {
+		if (i == 1) continue; // Dummy
+
+		const BVHNode2 & node = tlas.nodes[i];
+		if (node.is_leaf()) {
+			ASSERT(node.count == 1);
+			mesh_leaves[tlas.indices[node.first]] = int(i);
+		} else {
+			parent_indices[node.left    ] = int(i);
+			parent_indices[node.left + 1] = int(i);
+		}
+	}
+
+	sah_cost_build = BVHRefitter::calc_sah_cost(tlas);
+}
+
+// Recomputes AABBs from the given Node up to the root, stops early once an AABB no longer changes
+void TLASUpdater::refit_bottom_up(int node_index) {
+	while (node_index != INVALID) {
+		BVHNode2 & node = tlas.nodes[node_index];
+
+		AABB aabb = AABB::unify(tlas.nodes[node.left].aabb, tlas.nodes[node.left + 1].aabb);
+		if (aabb.min == node.aabb.min && aabb.max == node.aabb.max) break;
+
+		node.aabb  = aabb;
+		node_index = parent_indices[node_index];
+	}
+}
+
+// Gathers the Meshes, index positions, and Nodes (as sibling pairs) that make up the given subtree
+void TLASUpdater::collect_subtree(int node_index) {
+	const BVHNode2 & node = tlas.nodes[node_index];
+
+	if (node.is_leaf()) {
+		subtree_meshes         .push_back(tlas.indices[node.first]);
+		subtree_index_positions.push_back(node.first);
+	} else {
+		subtree_node_pairs.push_back(node.left);
+
+		collect_subtree(node.left);
+		collect_subtree(node.left + 1);
+	}
+}
+
+// Rebuilds a subtree using binned SAH, reusing the Nodes and index positions that the subtree occupied before
+void TLASUpdater::rebuild_subtree(int node_index, int first_index, int index_count) {
+	BVHNode2 & node = tlas.nodes[node_index];
+
+	if (index_count == 1) {
+		int mesh_index     = subtree_meshes[first_index];
+		int index_position = subtree_index_positions[first_index];
+
+		tlas.indices[index_position] = mesh_index;
+		mesh_leaves[mesh_index] = node_index;
+
+		node.aabb  = mesh_aabbs[mesh_index];
+		node.first = index_position;
+		node.count = 1;
+		node.axis  = 0;
+
+		return;
+	}
+
+	ObjectSplit split = BVHPartitions::partition_binned_sah(mesh_aabbs, mesh_centers, subtree_meshes.data(), first_index, index_count, PARTIAL_REBUILD_BIN_COUNT);
+
+	int child_left = subtree_node_pairs.back();
+	subtree_node_pairs.pop_back();
+
+	node.aabb  = AABB::unify(split.aabb_left, split.aabb_right);
+	node.left  = child_left;
+	node.count = 0;
+	node.axis  = split.dimension;
+
+	parent_indices[child_left    ] = node_index;
+	parent_indices[child_left + 1] = node_index;
+
+	int num_left  = split.index - first_index;
+	int num_right = first_index + index_count - split.index;
+
+	rebuild_subtree(child_left,     first_index,            num_left);
+	rebuild_subtree(child_left + 1, first_index + num_left, num_right);
+}
+
+// Counts the Meshes in the given subtree, stops counting once the limit is exceeded
+int TLASUpdater::count_subtree(int node_index, int limit) const {
+	const BVHNode2 & node = tlas.nodes[node_index];
+
+	if (node.is_leaf()) return 1;
+
+	int count = count_subtree(node.left, limit);
+	if (count > limit) return count;
+
+	return count + count_subtree(node.left + 1, limit - count);
+}
+
+// Removes the leaf of the given Mesh from the tree, its sibling takes the place of their parent
+// Returns the pair of Nodes that is no longer in use
+int TLASUpdater::remove_leaf(int mesh_index) {
+	int leaf_index = mesh_leaves[mesh_index];
+	int parent     = parent_indices[leaf_index];
+	int sibling    = leaf_index ^ 1;
+
+	BVHNode2 & node_parent = tlas.nodes[parent];
+	node_parent = tlas.nodes[sibling];
+
+	if (node_parent.is_leaf()) {
+		mesh_leaves[tlas.indices[node_parent.first]] = parent;
+	} else {
+		parent_indices[node_parent.left    ] = parent;
+		parent_indices[node_parent.left + 1] = parent;
+	}
+
+	if (parent_indices[parent] != INVALID) {
+		refit_bottom_up(parent_indices[parent]);
+	}
+
+	return leaf_index & ~1;
+}
+
+// Inserts the leaf of the given Mesh as the sibling of the Node where it increases the SAH cost the least,
+// which is found using Branch and Bound (same as in BVHOptimizer)
+void TLASUpdater::insert_leaf(int mesh_index, int index_position, int node_pair) {
+	const AABB & aabb = mesh_aabbs[mesh_index];
+	float aabb_area = aabb.surface_area();
+
+	float min_cost  = INFINITY;
+	int   min_index = INVALID;
+
+	priority_queue.data.clear();
+	priority_queue.emplace(0, 0.0f);
+
+	while (priority_queue.size() > 0) {
+		auto [node_index, induced_cost] = priority_queue.pop();
+
+		if (induced_cost + aabb_area >= min_cost) break; // Not possible to reduce min_cost, terminate
+
+		const BVHNode2 & node = tlas.nodes[node_index];
+
+		float cost = induced_cost + AABB::unify(node.aabb, aabb).surface_area();
+		if (cost < min_cost) {
+			min_cost  = cost;
+			min_index = node_index;
+		}
+
+		if (!node.is_leaf()) {
+			float child_induced_cost = cost - node.aabb.surface_area();
+
+			if (child_induced_cost + aabb_area < min_cost) {
+				priority_queue.emplace(node.left,     child_induced_cost);
+				priority_queue.emplace(node.left + 1, child_induced_cost);
+			}
+		}
+	}
+
+	// The Node at the insertion point moves down to become the left child of a new internal Node
+	BVHNode2 & node_left = tlas.nodes[node_pair];
+	node_left = tlas.nodes[min_index];
+
+	if (node_left.is_leaf()) {
+		mesh_leaves[tlas.indices[node_left.first]] = node_pair;
+	} else {
+		parent_indices[node_left.left    ] = node_pair;
+		parent_indices[node_left.left + 1] = node_pair;
+	}
+
+	BVHNode2 & node_right = tlas.nodes[node_pair + 1];
+	node_right.aabb  = aabb;
+	node_right.first = index_position;
+	node_right.count = 1;
+	node_right.axis  = 0;
+
+	mesh_leaves[mesh_index] = node_pair + 1;
+
+	BVHNode2 & node = tlas.nodes[min_index];
+	node.aabb  = AABB::unify(node_left.aabb, aabb);
+	node.left  = node_pair;
+	node.count = 0;
+	node.axis  = 0;
+
+	parent_indices[node_pair    ] = min_index;
+	parent_indices[node_pair + 1] = min_index;
+
+	if (parent_indices[min_index] != INVALID) {
+		refit_bottom_up(parent_indices[min_index]);
+	}
+}
+
+TLASUpdater::UpdateType TLASUpdater::update(const Array<Mesh> & meshes) {
+	size_t mesh_count = meshes.size();
+
+	if (!cpu_config.enable_tlas_update || mesh_aabbs.size() != mesh_count || mesh_count <= 2) {
+		full_rebuild(meshes);
+		return UpdateType::FULL_REBUILD;
+	}
+
+	int max_partial_rebuild_count = int(PARTIAL_REBUILD_MAX_FRACTION * float(mesh_count));
+	int partial_rebuild_count = 0;
+
+	changed_meshes .clear();
+	reinsert_meshes.clear();
+	subtree_roots  .clear();
+
+	// Determine for every Mesh that moved how to update the TLAS, based on the AABBs before the update:
+	// - If refitting inflates the parent of the Mesh only slightly, the Mesh is refitted
+	// - If there is a small subtree that can accommodate the Mesh at its new location, that subtree is rebuilt
+	// - Otherwise, the Mesh is removed from the tree and inserted again at its new location
+	for (size_t i = 0; i < mesh_count; i++) {
+		AABB aabb = meshes[i].get_aabb();
+
+		if (aabb.min == mesh_aabbs[i].min && aabb.max == mesh_aabbs[i].max) continue;
+
+		mesh_aabbs  [i] = aabb;
+		mesh_centers[i] = meshes[i].get_center();
+
+		auto inflation = [this, &aabb](int node_index) {
+			const AABB & node_aabb = tlas.nodes[node_index].aabb;
+			return AABB::unify(node_aabb, aabb).surface_area() / node_aabb.surface_area();
+		};
+
+		int node_index = parent_indices[mesh_leaves[i]];
+
+		if (inflation(node_index) <= REFIT_MAX_INFLATION) {
+			changed_meshes.push_back(int(i));
+			continue;
+		}
+
+		while (node_index != 0 && inflation(node_index) > REFIT_MAX_INFLATION) {
+			node_index = parent_indices[node_index];
+		}
+
+		if (node_index != 0 && count_subtree(node_index, PARTIAL_REBUILD_MAX_SUBTREE_SIZE) <= PARTIAL_REBUILD_MAX_SUBTREE_SIZE) {
+			changed_meshes.push_back(int(i));
+			subtree_roots .push_back(node_index);
+		} else {
+			reinsert_meshes.push_back(int(i));
+			partial_rebuild_count++;
+		}
+
+		if (partial_rebuild_count > max_partial_rebuild_count) {
+			full_rebuild(meshes);
+			return UpdateType::FULL_REBUILD;
+		}
+	}
+
+	if (changed_meshes.size() == 0 && reinsert_meshes.size() == 0) return UpdateType::NONE;
+
+	// Refit
+	for (size_t i = 0; i < changed_meshes.size(); i++) {
+		int leaf_index = mesh_leaves[changed_meshes[i]];
+
+		tlas.nodes[leaf_index].aabb = mesh_aabbs[changed_meshes[i]];
+		refit_bottom_up(parent_indices[leaf_index]);
+	}
+
+	UpdateType update_type = UpdateType::REFIT;
+
+	// Rebuild subtrees
+	if (subtree_roots.size() > 0) {
+		// Subtrees that are contained in another subtree that is rebuilt can be skipped
+		Sort::quick_sort(subtree_roots.begin(), subtree_roots.end());
+
+		for (size_t i = 0; i < subtree_roots.size(); i++) {
+			subtree_root_flags[subtree_roots[i]] = true;
+		}
+
+		size_t unique_root_count = 0;
+
+		for (size_t i = 0; i < subtree_roots.size(); i++) {
+			int root = subtree_roots[i];
+			if (unique_root_count > 0 && subtree_roots[unique_root_count - 1] == root) continue; // Duplicate
+
+			bool nested = false;
+			for (int ancestor = parent_indices[root]; ancestor != INVALID; ancestor = parent_indices[ancestor]) {
+				if (subtree_root_flags[ancestor]) {
+					nested = true;
+					break;
+				}
+			}
+
+			if (!nested) {
+				subtree_roots[unique_root_count++] = root;
+			}
+		}
+		while (subtree_roots.size() > unique_root_count) {
+			subtree_roots.pop_back();
+		}
+		subtree_root_flags.set_all(false);
+
+		for (size_t i = 0; i < subtree_roots.size(); i++) {
+			int root = subtree_roots[i];
+
+			subtree_meshes         .clear();
+			subtree_index_positions.clear();
+			subtree_node_pairs     .clear();
+
+			collect_subtree(root);
+
+			partial_rebuild_count += int(subtree_meshes.size());
+			if (partial_rebuild_count > max_partial_rebuild_count) {
+				full_rebuild(meshes);
+				return UpdateType::FULL_REBUILD;
+			}
+
+			// Leaves are assigned the index positions that the subtree already occupied, in depth first order
+			Sort::quick_sort(subtree_index_positions.begin(), subtree_index_positions.end());
+
+			rebuild_subtree(root, 0, int(subtree_meshes.size()));
+			ASSERT(subtree_node_pairs.size() == 0);
+
+			refit_bottom_up(parent_indices[root]);
+		}
+
+		update_type = UpdateType::PARTIAL_REBUILD;
+	}
+
+	// Reinsert Meshes that moved far
+	for (size_t i = 0; i < reinsert_meshes.size(); i++) {
+		int mesh_index     = reinsert_meshes[i];
+		int index_position = tlas.nodes[mesh_leaves[mesh_index]].first;
+
+		int node_pair = remove_leaf(mesh_index);
+		insert_leaf(mesh_index, index_position, node_pair);
+
+		update_type = UpdateType::PARTIAL_REBUILD;
+	}
+
+	// Fall back to a full rebuild once the quality of the TLAS has degraded too much
+	float threshold = cpu_config.bvh_refit_rebuild_threshold;
+	if (threshold > 0.0f && BVHRefitter::calc_sah_cost(tlas) > threshold * sah_cost_build) {
+		full_rebuild(meshes);
+		return UpdateType::FULL_REBUILD;
+	}
+
+	return update_type;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include "BVH.h"
+
+#include "Core/BitArray.h"
+#include "Core/MinHeap.h"
+
+struct Mesh;
+struct BVHBuilder;
+
+// Keeps the binary TLAS up to date when Meshes move, instead of rebuilding it from scratch on every change.
+// Depending on how many Meshes moved and how far, the TLAS is refitted, locally restructured, or rebuilt completely
+struct TLASUpdater {
+	enum struct UpdateType {
+		NONE,            // No Mesh moved, the TLAS is unchanged
+		REFIT,           // Only AABBs were updated, the topology is unchanged
+		PARTIAL_REBUILD, // Subtrees around Meshes that moved were rebuilt and/or Meshes were reinserted
+		FULL_REBUILD
+	};
+
+	BVH2       & tlas;
+	BVHBuilder & builder;
+
+	Array<AABB>    mesh_aabbs;   // AABB of every Mesh as of the last update
+	Array<Vector3> mesh_centers;
+	Array<int>     mesh_leaves;  // Leaf Node of every Mesh
+	Array<int>     parent_indices;
+
+	float sah_cost_build = 0.0f; // SAH cost of the TLAS right after the last full rebuild
+
+	// Meshes are refitted if that increases the surface area of their parent by at most this factor
+	static constexpr float REFIT_MAX_INFLATION = 1.5f;
+
+	// A full rebuild is performed if more than this fraction of all Meshes would be involved in partial rebuilds
+	static constexpr float PARTIAL_REBUILD_MAX_FRACTION     = 0.25f;
+	static constexpr int   PARTIAL_REBUILD_MAX_SUBTREE_SIZE = 256;
+	static constexpr int   PARTIAL_REBUILD_BIN_COUNT        = 16;
+
+	TLASUpdater(BVH2 & tlas, BVHBuilder & builder) : tlas(tlas), builder(builder) { }
+
+	NON_COPYABLE(TLASUpdater);
+	NON_MOVEABLE(TLASUpdater);
+
+	UpdateType update(const Array<Mesh> & meshes);
+
+private:
+	// Scratch memory, reused between updates
+	Array<int> changed_meshes;
+	Array<int> reinsert_meshes;
+	Array<int> subtree_roots;
+	Array<int> subtree_meshes;
+	Array<int> subtree_index_positions;
+	Array<int> subtree_node_pairs;
+
+	BitArray subtree_root_flags;
+
+	struct InsertionCandidate {
+		int   node_index;
+		float induced_cost;
+
+		bool operator<(InsertionCandidate other) const {
+			return induced_cost < other.induced_cost;
+		}
+	};
+	MinHeap<InsertionCandidate> priority_queue = MinHeap<InsertionCandidate>(nullptr);
+
+	void full_rebuild(const Array<Mesh> & meshes);
+
+	void refit_bottom_up(int node_index);
+
+	int count_subtree(int node_index, int limit) const;
+
+	void collect_subtree(int node_index);
+	void rebuild_subtree(int node_index, int first_index, int index_count);
+
+	int  remove_leaf(int mesh_index);
+	void insert_leaf(int mesh_index, int index_position, int node_pair);
+};
@@ -116,13 +116,14 @@ extern "C" __global__ void kernel_ambient_occlusion(int sample_index, float ao_r
 	}
 
 	// Obtain hit point and normal
-	TrianglePosNor hit_triangle = triangle_get_positions_and_normals(hit.triangle_id);
+	float hit_u, hit_v;
+	TrianglePosNor hit_triangle = triangle_get_hit_positions_and_normals(hit, hit_u, hit_v);
 
 	float3 geometric_normal = normalize(cross(hit_triangle.position_edge_1, hit_triangle.position_edge_2));
 
 	float3 hit_point;
 	float3 hit_normal;
-	triangle_barycentric(hit_triangle, hit.u, hit.v, hit_point, hit_normal);
+	triangle_barycentric(hit_triangle, hit_u, hit_v, hit_point, hit_normal);
 
 	// Transform into world space
 	Matrix3x4 world = mesh_get_transform(hit.mesh_id);
@@ -353,11 +353,12 @@ extern "C" __global__ void kernel_sort(int bounce, int sample_index) {
 
 	if (material_type == MaterialType::LIGHT) {
 		// Obtain the Light's position and normal
-		TrianglePosNor light = triangle_get_positions_and_normals(hit.triangle_id);
+		float light_u, light_v;
+		TrianglePosNor light = triangle_get_hit_positions_and_normals(hit, light_u, light_v);
 
 		float3 light_point;
 		float3 light_normal;
-		triangle_barycentric(light, hit.u, hit.v, light_point, light_normal);
+		triangle_barycentric(light, light_u, light_v, light_point, light_normal);
 
 		float3 light_point_prev = light_point;
 
@@ -377,7 +378,8 @@ extern "C" __global__ void kernel_sort(int bounce, int sample_index) {
 
 		MaterialLight material_light = material_as_light(material_id);
 
-		bool should_count_light_contribution = config.enable_next_event_estimation ? !allow_nee : true;
+		// Curves are never sampled by NEE (see Pathtracer::calc_light_power), so their emission is always counted in full
+		bool should_count_light_contribution = config.enable_next_event_estimation ? !allow_nee || triangle_is_curve(hit.triangle_id) : true;
 		if (should_count_light_contribution) {
 			float3 illumination = throughput * material_light.emission;
 
@@ -602,12 +604,13 @@ __device__ void shade_material(int bounce, int sample_index, int buffer_size) {
 	}
 
 	// Obtain hit Triangle position, normal, and texture coordinates
-	TrianglePosNorTex hit_triangle = triangle_get_positions_normals_and_tex_coords(hit.triangle_id);
+	float hit_u, hit_v;
+	TrianglePosNorTex hit_triangle = triangle_get_hit_positions_normals_and_tex_coords(hit, hit_u, hit_v);
 
 	float3 hit_point;
 	float3 normal;
 	float2 tex_coord;
-	triangle_barycentric(hit_triangle, hit.u, hit.v, hit_point, normal, tex_coord);
+	triangle_barycentric(hit_triangle, hit_u, hit_v, hit_point, normal, tex_coord);
 
 	float3 hit_point_local = hit_point; // Keep copy of the untransformed hit point in local space
 
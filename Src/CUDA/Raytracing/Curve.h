@@ -0,0 +1,87 @@
+#pragma once
+#include "Raytracing/Ray.h"
+
+// Control points of all Curves, xyz contains the position and w the radius
+// A CurveSegment is referenced through the triangles array, its first index refers to its first control point
+// (the second control point directly follows it) and its third index is INVALID
+__device__ __constant__ const float4 * curve_points;
+
+__device__ inline float4 curve_point_get(int index) {
+	return __ldg(&curve_points[index]);
+}
+
+// Intersects the Ray with a CurveSegment, modelled as a capsule whose radius varies linearly along its axis.
+// The distance is computed at the point of closest approach between the Ray and the axis: away from the ends this is
+// a cylinder with the local radius, at the ends it is a sphere. This is exact for a constant radius and a close fit for tapering hair
+__device__ inline bool curve_intersect_distance(int index, const Ray & ray, float max_distance, float & t) {
+	float4 point_0 = curve_point_get(index);
+	float4 point_1 = curve_point_get(index + 1);
+
+	float3 position_0 = make_float3(point_0);
+	float3 axis       = make_float3(point_1) - position_0;
+	float3 w          = ray.origin - position_0;
+
+	float a = dot(ray.direction, ray.direction);
+	float b = dot(ray.direction, axis);
+	float c = dot(axis, axis);
+	float d = dot(ray.direction, w);
+	float e = dot(axis, w);
+
+	// Parameter along the axis of the point of closest approach, for (nearly) parallel Rays the start of the axis is used
+	float denom    = a * c - b * b;
+	bool  parallel = denom <= 1e-8f * a * c;
+
+	float s_unclamped = parallel ? 0.0f : (a * e - b * d) / denom;
+	float s = __saturatef(s_unclamped);
+
+	float t_closest = (b * s - d) / a;
+
+	float3 offset = w + t_closest * ray.direction - s * axis;
+	float  radius = lerp(point_0.w, point_1.w, s);
+
+	float distance_squared = dot(offset, offset);
+	if (distance_squared > radius * radius) return false;
+
+	// Squared length of the part of the Ray direction perpendicular to the axis (cylinder) or the full direction (sphere at the ends)
+	bool  on_cylinder = !parallel && s == s_unclamped;
+	float a_perpendicular = on_cylinder ? denom / c : a;
+
+	t = t_closest - sqrtf((radius * radius - distance_squared) / a_perpendicular);
+
+	return t > 0.0f && t < max_distance;
+}
+
+// Returns the parameter along the axis (u) and the angle around the axis (v, normalized to [0, 1]) of a point on the CurveSegment
+__device__ inline float2 curve_get_uv(int index, const float3 & point) {
+	float3 position_0 = make_float3(curve_point_get(index));
+	float3 position_1 = make_float3(curve_point_get(index + 1));
+
+	float3 axis = position_1 - position_0;
+	float  u    = __saturatef(dot(point - position_0, axis) / dot(axis, axis));
+
+	float3 tangent, binormal;
+	orthonormal_basis(normalize(axis), tangent, binormal);
+
+	float3 direction = point - (position_0 + u * axis);
+	float  v = 0.5f + atan2f(dot(direction, binormal), dot(direction, tangent)) * ONE_OVER_TWO_PI;
+
+	return make_float2(u, v);
+}
+
+__device__ inline void curve_intersect(int mesh_id, int triangle_id, int index, const Ray & ray, RayHit & ray_hit) {
+	float t;
+	if (curve_intersect_distance(index, ray, ray_hit.t, t)) {
+		float2 uv = curve_get_uv(index, ray.origin + t * ray.direction);
+
+		ray_hit.t = t;
+		ray_hit.u = uv.x;
+		ray_hit.v = uv.y;
+		ray_hit.mesh_id     = mesh_id;
+		ray_hit.triangle_id = triangle_id;
+	}
+}
+
+__device__ inline bool curve_intersect_shadow(int index, const Ray & ray, float max_distance) {
+	float t;
+	return curve_intersect_distance(index, ray, max_distance, t);
+}
@@ -1,33 +1,64 @@
 #pragma once
 #include "Raytracing/Ray.h"
+#include "Raytracing/Curve.h"
 
+// Geometry is indexed, Vertices shared between Triangles are only stored once
+// Positions are stored separately from the other attributes, so that intersection only touches positions
+// and normals and texture coordinates are only fetched once a hit has been found
+__device__ __constant__ const float3 * vertex_positions;
+__device__ __constant__ const float3 * vertex_normals;
+__device__ __constant__ const float2 * vertex_tex_coords;
+
+// NOTE: Also used to reference CurveSegments, see Curve.h
 struct Triangle {
-	float4 part_0; // position_0       xyz and position_edge_1  x
-	float4 part_1; // position_edge_1   yz and position_edge_2  xy
-	float4 part_2; // position_edge_2    z and normal_0         xyz
-	float4 part_3; // normal_edge_1    xyz and normal_edge_2    x
-	float4 part_4; // normal_edge_2     yz and tex_coord_0      xy
-	float4 part_5; // tex_coord_edge_1 xy  and tex_coord_edge_2 xy
+	int index_0;
+	int index_1;
+	int index_2;
 };
 
 __device__ __constant__ const Triangle * triangles;
 
+__device__ inline int3 triangle_get_indices(int index) {
+	return make_int3(
+		__ldg(&triangles[index].index_0),
+		__ldg(&triangles[index].index_1),
+		__ldg(&triangles[index].index_2)
+	);
+}
+
+// CurveSegments are marked by an INVALID third index
+__device__ inline bool triangle_is_curve(int index) {
+	return __ldg(&triangles[index].index_2) == INVALID;
+}
+
+__device__ inline float3 vertex_get_position(int index) {
+	return make_float3(__ldg(&vertex_positions[index].x), __ldg(&vertex_positions[index].y), __ldg(&vertex_positions[index].z));
+}
+
+__device__ inline float3 vertex_get_normal(int index) {
+	return make_float3(__ldg(&vertex_normals[index].x), __ldg(&vertex_normals[index].y), __ldg(&vertex_normals[index].z));
+}
+
+__device__ inline float2 vertex_get_tex_coord(int index) {
+	return __ldg(&vertex_tex_coords[index]);
+}
+
 struct TrianglePos {
 	float3 position_0;
 	float3 position_edge_1;
 	float3 position_edge_2;
 };
 
-__device__ inline TrianglePos triangle_get_positions(int index) {
-	float4 part_0 = __ldg(&triangles[index].part_0);
-	float4 part_1 = __ldg(&triangles[index].part_1);
-	float4 part_2 = __ldg(&triangles[index].part_2);
+__device__ inline TrianglePos triangle_get_positions(const int3 & indices) {
+	float3 position_0 = vertex_get_position(indices.x);
+	float3 position_1 = vertex_get_position(indices.y);
+	float3 position_2 = vertex_get_position(indices.z);
 
 	TrianglePos triangle;
 
-	triangle.position_0      = make_float3(part_0.x, part_0.y, part_0.z);
-	triangle.position_edge_1 = make_float3(part_0.w, part_1.x, part_1.y);
-	triangle.position_edge_2 = make_float3(part_1.z, part_1.w, part_2.x);
+	triangle.position_0      = position_0;
+	triangle.position_edge_1 = position_1 - position_0;
+	triangle.position_edge_2 = position_2 - position_0;
 
 	return triangle;
 }
@@ -43,21 +74,25 @@ struct TrianglePosNor {
 };
 
 __device__ inline TrianglePosNor triangle_get_positions_and_normals(int index) {
-	float4 part_0 = __ldg(&triangles[index].part_0);
-	float4 part_1 = __ldg(&triangles[index].part_1);
-	float4 part_2 = __ldg(&triangles[index].part_2);
-	float4 part_3 = __ldg(&triangles[index].part_3);
-	float4 part_4 = __ldg(&triangles[index].part_4);
+	int3 indices = triangle_get_indices(index);
+
+	float3 position_0 = vertex_get_position(indices.x);
+	float3 position_1 = vertex_get_position(indices.y);
+	float3 position_2 = vertex_get_position(indices.z);
+
+	float3 normal_0 = vertex_get_normal(indices.x);
+	float3 normal_1 = vertex_get_normal(indices.y);
+	float3 normal_2 = vertex_get_normal(indices.z);
 
 	TrianglePosNor triangle;
 
-	triangle.position_0      = make_float3(part_0.x, part_0.y, part_0.z);
-	triangle.position_edge_1 = make_float3(part_0.w, part_1.x, part_1.y);
-	triangle.position_edge_2 = make_float3(part_1.z, part_1.w, part_2.x);
+	triangle.position_0      = position_0;
+	triangle.position_edge_1 = position_1 - position_0;
+	triangle.position_edge_2 = position_2 - position_0;
 
-	triangle.normal_0      = make_float3(part_2.y, part_2.z, part_2.w);
-	triangle.normal_edge_1 = make_float3(part_3.x, part_3.y, part_3.z);
-	triangle.normal_edge_2 = make_float3(part_3.w, part_4.x, part_4.y);
+	triangle.normal_0      = normal_0;
+	triangle.normal_edge_1 = normal_1 - normal_0;
+	triangle.normal_edge_2 = normal_2 - normal_0;
 
 	return triangle;
 };
@@ -77,26 +112,33 @@ struct TrianglePosNorTex {
 };
 
 __device__ inline TrianglePosNorTex triangle_get_positions_normals_and_tex_coords(int index) {
-	float4 part_0 = __ldg(&triangles[index].part_0);
-	float4 part_1 = __ldg(&triangles[index].part_1);
-	float4 part_2 = __ldg(&triangles[index].part_2);
-	float4 part_3 = __ldg(&triangles[index].part_3);
-	float4 part_4 = __ldg(&triangles[index].part_4);
-	float4 part_5 = __ldg(&triangles[index].part_5);
+	int3 indices = triangle_get_indices(index);
+
+	float3 position_0 = vertex_get_position(indices.x);
+	float3 position_1 = vertex_get_position(indices.y);
+	float3 position_2 = vertex_get_position(indices.z);
+
+	float3 normal_0 = vertex_get_normal(indices.x);
+	float3 normal_1 = vertex_get_normal(indices.y);
+	float3 normal_2 = vertex_get_normal(indices.z);
+
+	float2 tex_coord_0 = vertex_get_tex_coord(indices.x);
+	float2 tex_coord_1 = vertex_get_tex_coord(indices.y);
+	float2 tex_coord_2 = vertex_get_tex_coord(indices.z);
 
 	TrianglePosNorTex triangle;
 
-	triangle.position_0      = make_float3(part_0.x, part_0.y, part_0.z);
-	triangle.position_edge_1 = make_float3(part_0.w, part_1.x, part_1.y);
-	triangle.position_edge_2 = make_float3(part_1.z, part_1.w, part_2.x);
+	triangle.position_0      = position_0;
+	triangle.position_edge_1 = position_1 - position_0;
+	triangle.position_edge_2 = position_2 - position_0;
 
-	triangle.normal_0      = make_float3(part_2.y, part_2.z, part_2.w);
-	triangle.normal_edge_1 = make_float3(part_3.x, part_3.y, part_3.z);
-	triangle.normal_edge_2 = make_float3(part_3.w, part_4.x, part_4.y);
+	triangle.normal_0      = normal_0;
+	triangle.normal_edge_1 = normal_1 - normal_0;
+	triangle.normal_edge_2 = normal_2 - normal_0;
 
-	triangle.tex_coord_0      = make_float2(part_4.z, part_4.w);
-	triangle.tex_coord_edge_1 = make_float2(part_5.x, part_5.y);
-	triangle.tex_coord_edge_2 = make_float2(part_5.z, part_5.w);
+	triangle.tex_coord_0      = tex_coord_0;
+	triangle.tex_coord_edge_1 = tex_coord_1 - tex_coord_0;
+	triangle.tex_coord_edge_2 = tex_coord_2 - tex_coord_0;
 
 	return triangle;
 }
@@ -141,8 +183,90 @@ __device__ inline void triangle_barycentric(const TrianglePosNorTex & triangle,
 	tex_coord = barycentric(u, v, triangle.tex_coord_0, triangle.tex_coord_edge_1, triangle.tex_coord_edge_2);
 }
 
+// Hits on CurveSegments are shaded as hits on a Triangle tangent to the CurveSegment, with the hit point at its first vertex.
+// The first edge follows the axis and the second edge goes around the circumference, so that texture coordinates wrap around the Curve
+__device__ inline TrianglePosNorTex curve_get_tangent_triangle(int index, float u, float v) {
+	float4 point_0 = curve_point_get(index);
+	float4 point_1 = curve_point_get(index + 1);
+
+	float3 position_0 = make_float3(point_0);
+	float3 axis       = make_float3(point_1) - position_0;
+	float3 axis_unit  = normalize(axis);
+
+	float3 tangent, binormal;
+	orthonormal_basis(axis_unit, tangent, binormal);
+
+	float sin_phi, cos_phi;
+	__sincosf((v - 0.5f) * TWO_PI, &sin_phi, &cos_phi);
+
+	float3 normal = cos_phi * tangent + sin_phi * binormal;
+	float  radius = fmaxf(lerp(point_0.w, point_1.w, u), EPSILON);
+
+	TrianglePosNorTex triangle;
+
+	triangle.position_0      = position_0 + u * axis + radius * normal;
+	triangle.position_edge_1 = axis;
+	triangle.position_edge_2 = cross(normal, axis_unit) * (TWO_PI * radius);
+
+	triangle.normal_0      = normal;
+	triangle.normal_edge_1 = make_float3(0.0f);
+	triangle.normal_edge_2 = make_float3(0.0f);
+
+	triangle.tex_coord_0      = make_float2(u, v);
+	triangle.tex_coord_edge_1 = make_float2(1.0f, 0.0f);
+	triangle.tex_coord_edge_2 = make_float2(0.0f, 1.0f);
+
+	return triangle;
+}
+
+// Returns the Triangle that was hit, 'u' and 'v' receive the barycentric coordinates of the hit point on that Triangle
+__device__ inline TrianglePosNorTex triangle_get_hit_positions_normals_and_tex_coords(const RayHit & hit, float & u, float & v) {
+	int3 indices = triangle_get_indices(hit.triangle_id);
+
+	if (indices.z == INVALID) {
+		u = 0.0f;
+		v = 0.0f;
+		return curve_get_tangent_triangle(indices.x, hit.u, hit.v);
+	}
+
+	u = hit.u;
+	v = hit.v;
+	return triangle_get_positions_normals_and_tex_coords(hit.triangle_id);
+}
+
+__device__ inline TrianglePosNor triangle_get_hit_positions_and_normals(const RayHit & hit, float & u, float & v) {
+	int3 indices = triangle_get_indices(hit.triangle_id);
+
+	if (indices.z == INVALID) {
+		TrianglePosNorTex curve_triangle = curve_get_tangent_triangle(indices.x, hit.u, hit.v);
+
+		TrianglePosNor triangle;
+		triangle.position_0      = curve_triangle.position_0;
+		triangle.position_edge_1 = curve_triangle.position_edge_1;
+		triangle.position_edge_2 = curve_triangle.position_edge_2;
+		triangle.normal_0        = curve_triangle.normal_0;
+		triangle.normal_edge_1   = curve_triangle.normal_edge_1;
+		triangle.normal_edge_2   = curve_triangle.normal_edge_2;
+
+		u = 0.0f;
+		v = 0.0f;
+		return triangle;
+	}
+
+	u = hit.u;
+	v = hit.v;
+	return triangle_get_positions_and_normals(hit.triangle_id);
+}
+
 __device__ inline void triangle_intersect(int mesh_id, int triangle_id, const Ray & ray, RayHit & ray_hit) {
-	TrianglePos triangle = triangle_get_positions(triangle_id);
+	int3 indices = triangle_get_indices(triangle_id);
+
+	if (indices.z == INVALID) {
+		curve_intersect(mesh_id, triangle_id, indices.x, ray, ray_hit);
+		return;
+	}
+
+	TrianglePos triangle = triangle_get_positions(indices);
 
 	float3 h = cross(ray.direction, triangle.position_edge_2);
 	float  a = dot(triangle.position_edge_1, h);
@@ -170,7 +294,13 @@ __device__ inline void triangle_intersect(int mesh_id, int triangle_id, const Ra
 }
 
 __device__ inline bool triangle_intersect_shadow(int triangle_id, const Ray & ray, float max_distance) {
-	TrianglePos triangle = triangle_get_positions(triangle_id);
+	int3 indices = triangle_get_indices(triangle_id);
+
+	if (indices.z == INVALID) {
+		return curve_intersect_shadow(indices.x, ray, max_distance);
+	}
+
+	TrianglePos triangle = triangle_get_positions(indices);
 
 	float3 h = cross(ray.direction, triangle.position_edge_2);
 	float  a = dot(triangle.position_edge_1, h);
@@ -29,6 +29,20 @@ enum struct BVHType {
 	BVH8  // Compressed Wide BVH (8 way), constructed by collapsing the binary BVH
 };
 
+enum struct BVHBuilderType {
+	SAH,    // Full sweep SAH over presorted primitives, highest quality
+	BINNED, // Binned SAH, faster to build at the cost of slightly lower quality
+	LBVH,   // Linear BVH based on Morton codes, fastest to build but lowest quality
+	PLOC    // Parallel Locally-Ordered Clustering, close to SAH quality at a fraction of the build time
+};
+
+enum struct BVHNodeOrder {
+	NONE,        // Keep the order in which the Nodes were constructed
+	DFS,         // Depth first, visiting the child with the largest surface area first
+	BFS_TREELET, // Small breadth first treelets that fit in a few cache lines, treelets are ordered depth first
+	VEB          // Cache oblivious van Emde Boas layout, recursively splits the tree at half its height
+};
+
 struct CPUConfig {
 	int initial_width  = 1024;
 	int initial_height = 768;
@@ -44,24 +58,43 @@ struct CPUConfig {
 	String output_filename     = "render.ppm"_sv;
 
 	bool bvh_force_rebuild        = false;
+	bool bvh_cache_compression    = false; // Uncompressed BVH files are loaded using memory mapping without copies, compressed files are smaller
+	String bvh_cache_directory;            // If set, BVH files are stored here instead of next to their source file. Can be shared between machines
 	bool enable_bvh_optimization  = false;
 	bool enable_block_compression = true; // Focused on texture, not important for us
 	bool enable_scene_update      = false;
-	bool enable_bvh_collapse	  = false;
+	bool enable_parallel_bvh_build    = true;
+	bool enable_parallel_mesh_parsing = true; // Splits OBJ and binary PLY files into chunks that are parsed on multiple threads
+	bool enable_tlas_update           = true; // Refit or partially rebuild the TLAS when Meshes move, instead of always rebuilding it
 
 	MipmapFilterType mipmap_filter = MipmapFilterType::BOX;
 	int max_frames = -1;
 
 	BVHType bvh_type = BVHType::BVH8;
 
-	// Only used for collapsing and optimization
+	BVHBuilderType bvh_builder   = BVHBuilderType::SAH; // Builder used for the binary BVH, unless SBVH is selected
+	BVHBuilderType tlas_builder  = BVHBuilderType::SAH; // Builder used for the TLAS, which is rebuilt every frame
+	int            bvh_bin_count = 32;                  // Number of bins used by the binned SAH builder
+
+	BVHNodeOrder bvh_node_order = BVHNodeOrder::DFS; // Memory layout of the BLAS Nodes, applied after construction
+
+	float bvh_presplit_budget = 0.0f; // Additional references created by pre-splitting large Triangles (SAH and binned builders only), as a fraction of the number of Triangles. 0 disables
+
+	int bvh_max_primitives_in_leaf = 1; // BLAS builders create leaves of up to this many primitives when the SAH prefers it, 1 means one primitive per leaf
+
+	// Used for SAH termination, collapsing and optimization
 	float sah_cost_node = 4.0f;
 	float sah_cost_leaf = 1.0f;
 
 	float sbvh_alpha = 10e-5f; // Alpha parameter for SBVH construction, alpha == 1 means regular BVH, alpha == 0 means full SBVH
+	float sbvh_max_duplication = 0.3f; // Maximum number of references created by Spatial Splits, as a fraction of the number of Triangles
 
 	int bvh_optimizer_max_time        = 60000; // Time limit in milliseconds
 	int bvh_optimizer_max_num_batches = 1000;
+
+	float bvh_refit_rebuild_threshold = 1.5f; // Refitted BVHs and the TLAS are rebuilt once their SAH cost exceeds this factor times the cost at build time, <= 0 disables
+
+	String bvh_stats_filename; // If set, a quality report of all BVHs is written to this file (JSON, or CSV if it ends in .csv)
 };
 
 inline CPUConfig cpu_config = { };
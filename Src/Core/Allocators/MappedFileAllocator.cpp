@@ -0,0 +1,58 @@
+#include "MappedFileAllocator.h"
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+
+#include "Core/IO.h"
+
+OwnPtr<MappedFileAllocator> MappedFileAllocator::map(const String & filename) {
+	OwnPtr<MappedFileAllocator> allocator = OwnPtr<MappedFileAllocator>(new MappedFileAllocator());
+
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		IO::print("WARNING: Failed to open file '{}' for mapping!\n"_sv, filename);
+		return nullptr;
+	}
+	allocator->file_handle = file;
+
+	LARGE_INTEGER file_size = { };
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+		return nullptr;
+	}
+
+	// PAGE_WRITECOPY allows the view to be modified without affecting the file
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	if (!mapping) {
+		IO::print("WARNING: Failed to map file '{}'!\n"_sv, filename);
+		return nullptr;
+	}
+	allocator->mapping_handle = mapping;
+
+	void * view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	if (!view) {
+		IO::print("WARNING: Failed to map view of file '{}'!\n"_sv, filename);
+		return nullptr;
+	}
+	allocator->view      = static_cast<char *>(view);
+	allocator->view_size = size_t(file_size.QuadPart);
+
+	return allocator;
+}
+
+MappedFileAllocator::~MappedFileAllocator() {
+	if (view)           UnmapViewOfFile(view);
+	if (mapping_handle) CloseHandle(mapping_handle);
+	if (file_handle)    CloseHandle(file_handle);
+}
+
+char * MappedFileAllocator::alloc(size_t num_bytes) {
+	return static_cast<char *>(_aligned_malloc(num_bytes, 64));
+}
+
+void MappedFileAllocator::free(void * ptr) {
+	// Adopted memory is released when the file is unmapped
+	if (!is_mapped(ptr)) {
+		_aligned_free(ptr);
+	}
+}
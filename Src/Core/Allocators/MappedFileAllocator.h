@@ -0,0 +1,52 @@
+#pragma once
+#include "Allocator.h"
+
+#include "Core/Array.h"
+#include "Core/OwnPtr.h"
+#include "Core/String.h"
+
+// Maps a file into memory, so that Arrays can refer directly to its contents without any copies (see adopt()).
+// The mapping is copy-on-write: modifying an adopted Array (e.g. when refitting a BVH) only affects the current process, never the file.
+// Arrays that grow beyond their adopted memory fall back to regular 64 byte aligned heap allocations
+// NOTE: Has to outlive all Arrays that use it
+struct MappedFileAllocator final : Allocator {
+	// Returns nullptr if the file could not be mapped
+	static OwnPtr<MappedFileAllocator> map(const String & filename);
+
+	~MappedFileAllocator();
+
+	const char * data() const { return view; }
+	size_t       size() const { return view_size; }
+
+	// Creates an Array that refers to 'count' elements at the given byte offset into the file, without copying them
+	template<typename T>
+	Array<T> adopt(size_t offset, size_t count) {
+		static_assert(std::is_trivially_copyable_v<T>);
+		ASSERT(offset + count * sizeof(T) <= view_size);
+		ASSERT(offset % alignof(T) == 0);
+
+		Array<T> array = Array<T>(this);
+		if (count > 0) {
+			array.buffer   = view + offset;
+			array.count    = count;
+			array.capacity = count;
+		}
+		return array;
+	}
+
+private:
+	MappedFileAllocator() = default;
+
+	char * view      = nullptr;
+	size_t view_size = 0;
+
+	void * file_handle    = nullptr;
+	void * mapping_handle = nullptr;
+
+	bool is_mapped(const void * ptr) const {
+		return ptr >= view && ptr < view + view_size;
+	}
+
+	char * alloc(size_t num_bytes) override;
+	void   free (void * ptr)       override;
+};
@@ -87,7 +87,7 @@ struct Array {
 	constexpr void push_back(const T * elements, size_t element_count) {
 		grow_if_needed(element_count);
 		if constexpr (std::is_trivially_copyable_v<T>) {
-			memcpy(buffer + count, elements, element_count * sizeof(T));
+			memcpy(data() + count, elements, element_count * sizeof(T));
 			count += element_count;
 		} else {
 			for (size_t i = 0; i < element_count; i++) {
@@ -1,4 +1,5 @@
 #pragma once
+#include <stdint.h>
 #include <string.h>
 
 namespace FNVHash {
@@ -26,3 +27,121 @@ struct Hash {
 		return FNVHash::hash(bytes, sizeof(T));
 	}
 };
+
+// Streaming 64 bit xxHash, much faster than FNV for large inputs such as the contents of files
+// Based on: https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+struct XXHash64 {
+	static constexpr uint64_t PRIME_1 = 11400714785074694791ull;
+	static constexpr uint64_t PRIME_2 = 14029467366897019727ull;
+	static constexpr uint64_t PRIME_3 =  1609587929392839161ull;
+	static constexpr uint64_t PRIME_4 =  9650029242287828579ull;
+	static constexpr uint64_t PRIME_5 =  2870177450012600261ull;
+
+	uint64_t accumulators[4];
+	uint64_t total_length = 0;
+
+	// Input that did not fill a whole stripe of 32 bytes yet
+	unsigned char buffer[32];
+	size_t        buffer_size = 0;
+
+	XXHash64(uint64_t seed = 0) {
+		accumulators[0] = seed + PRIME_1 + PRIME_2;
+		accumulators[1] = seed + PRIME_2;
+		accumulators[2] = seed;
+		accumulators[3] = seed - PRIME_1;
+	}
+
+	void update(const void * data, size_t length) {
+		const unsigned char * bytes = static_cast<const unsigned char *>(data);
+		total_length += length;
+
+		if (buffer_size > 0) {
+			size_t num_bytes = length < 32 - buffer_size ? length : 32 - buffer_size;
+			memcpy(buffer + buffer_size, bytes, num_bytes);
+			buffer_size += num_bytes;
+			bytes       += num_bytes;
+			length      -= num_bytes;
+
+			if (buffer_size < 32) return;
+
+			process_stripe(buffer);
+			buffer_size = 0;
+		}
+
+		while (length >= 32) {
+			process_stripe(bytes);
+			bytes  += 32;
+			length -= 32;
+		}
+
+		memcpy(buffer, bytes, length);
+		buffer_size = length;
+	}
+
+	template<typename T>
+	void update(const T & value) {
+		update(&value, sizeof(T));
+	}
+
+	uint64_t digest() const {
+		uint64_t hash;
+		if (total_length >= 32) {
+			hash = rotl(accumulators[0], 1) + rotl(accumulators[1], 7) + rotl(accumulators[2], 12) + rotl(accumulators[3], 18);
+			for (int i = 0; i < 4; i++) {
+				hash = (hash ^ round(0, accumulators[i])) * PRIME_1 + PRIME_4;
+			}
+		} else {
+			hash = accumulators[2] + PRIME_5;
+		}
+		hash += total_length;
+
+		const unsigned char * bytes = buffer;
+		size_t                length = buffer_size;
+
+		while (length >= 8) {
+			hash = rotl(hash ^ round(0, read<uint64_t>(bytes)), 27) * PRIME_1 + PRIME_4;
+			bytes  += 8;
+			length -= 8;
+		}
+		if (length >= 4) {
+			hash = rotl(hash ^ (read<unsigned>(bytes) * PRIME_1), 23) * PRIME_2 + PRIME_3;
+			bytes  += 4;
+			length -= 4;
+		}
+		while (length > 0) {
+			hash = rotl(hash ^ (*bytes * PRIME_5), 11) * PRIME_1;
+			bytes  += 1;
+			length -= 1;
+		}
+
+		// Avalanche
+		hash ^= hash >> 33;
+		hash *= PRIME_2;
+		hash ^= hash >> 29;
+		hash *= PRIME_3;
+		hash ^= hash >> 32;
+		return hash;
+	}
+
+private:
+	static uint64_t rotl(uint64_t x, int r) {
+		return (x << r) | (x >> (64 - r));
+	}
+
+	static uint64_t round(uint64_t accumulator, uint64_t input) {
+		return rotl(accumulator + input * PRIME_2, 31) * PRIME_1;
+	}
+
+	template<typename T>
+	static T read(const unsigned char * bytes) {
+		T result;
+		memcpy(&result, bytes, sizeof(T));
+		return result;
+	}
+
+	void process_stripe(const unsigned char * stripe) {
+		for (int i = 0; i < 4; i++) {
+			accumulators[i] = round(accumulators[i], read<uint64_t>(stripe + 8 * i));
+		}
+	}
+};
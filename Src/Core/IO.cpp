@@ -23,6 +23,23 @@ bool IO::file_is_newer(StringView filename_a, StringView filename_b) {
 	return last_write_time_filename_a < last_write_time_filename_b;
 }
 
+bool IO::file_move(StringView filename_from, StringView filename_to) {
+	std::error_code error;
+	std::filesystem::rename(stringview_to_path(filename_from), stringview_to_path(filename_to), error);
+	return !error;
+}
+
+bool IO::file_delete(StringView filename) {
+	std::error_code error;
+	return std::filesystem::remove(stringview_to_path(filename), error);
+}
+
+bool IO::create_directory(StringView path) {
+	std::error_code error;
+	std::filesystem::create_directories(stringview_to_path(path), error);
+	return !error;
+}
+
 String IO::file_read(const String & filename, Allocator * allocator) {
 	FILE * file = nullptr;
 	errno_t err = fopen_s(&file, filename.data(), "rb");
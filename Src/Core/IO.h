@@ -32,6 +32,13 @@ namespace IO {
 
 	bool file_is_newer(StringView filename_a, StringView filename_b);
 
+	// Replaces the destination if it exists. Within a single file system this is atomic
+	bool file_move  (StringView filename_from, StringView filename_to);
+	bool file_delete(StringView filename);
+
+	// Also creates all missing parent directories, succeeds if the directory already exists
+	bool create_directory(StringView path);
+
 	String file_read (const String & filename, Allocator * allocator);
 	bool   file_write(const String & filename, StringView data);
 }
@@ -505,6 +505,7 @@ static void draw_gui(Window & window, Integrator & integrator) {
 			ImGui::Text("Has Lights:      %s", integrator.scene.has_lights     ? "True" : "False");
 
 			size_t triangle_count       = 0;
+			size_t curve_count          = 0;
 			size_t light_mesh_count     = 0;
 			size_t light_triangle_count = 0;
 
@@ -513,6 +514,7 @@ static void draw_gui(Window & window, Integrator & integrator) {
 				const MeshData & mesh_data = integrator.scene.asset_manager.get_mesh_data(mesh.mesh_data_handle);
 
 				triangle_count += mesh_data.triangles.size();
+				curve_count    += mesh_data.curves.size();
 
 				if (mesh.light.weight > 0.0f) {
 					light_mesh_count++;
@@ -522,6 +524,7 @@ static void draw_gui(Window & window, Integrator & integrator) {
 
 			ImGui::Text("Meshes:          %zu", integrator.scene.meshes.size());
 			ImGui::Text("Triangles:       %zu", triangle_count);
+			ImGui::Text("Curve Segments:  %zu", curve_count);
 			ImGui::Text("Light Meshes:    %zu", light_mesh_count);
 			ImGui::Text("Light Triangles: %zu", light_triangle_count);
 			ImGui::Separator();
@@ -745,9 +748,10 @@ static void draw_gui(Window & window, Integrator & integrator) {
 		draw_line_clipped(aabb_corners[2], aabb_corners[6], aabb_colour);
 		draw_line_clipped(aabb_corners[3], aabb_corners[7], aabb_colour);
 
-		if (integrator.pixel_query.triangle_id != INVALID) {
-			const MeshData & mesh_data = integrator.scene.asset_manager.get_mesh_data(mesh.mesh_data_handle);
+		const MeshData & mesh_data = integrator.scene.asset_manager.get_mesh_data(mesh.mesh_data_handle);
 
+		// Only Triangles are outlined
+		if (integrator.pixel_query.triangle_id != INVALID && !mesh_data.has_curves()) {
 			int              index    = mesh_data.bvh->indices[integrator.pixel_query.triangle_id - integrator.mesh_data_triangle_offsets[mesh.mesh_data_handle.handle]];
 			const Triangle & triangle = mesh_data.triangles[index];
 
@@ -55,6 +55,17 @@ struct AABB {
 		max = Vector3::max(max, aabb.max);
 	}
 
+	// Slab test, a hit requires the entry distance to be strictly smaller than the exit distance (same as the GPU traversal)
+	inline bool intersect(const Vector3 & ray_origin, const Vector3 & ray_direction_inv, float max_distance, float & t_near) const {
+		Vector3 t0 = (min - ray_origin) * ray_direction_inv;
+		Vector3 t1 = (max - ray_origin) * ray_direction_inv;
+
+		t_near = fmaxf(fmaxf(fminf(t0.x, t1.x), fminf(t0.y, t1.y)), fmaxf(fminf(t0.z, t1.z), 0.0f));
+		float t_far = fminf(fminf(fmaxf(t0.x, t1.x), fmaxf(t0.y, t1.y)), fminf(fmaxf(t0.z, t1.z), max_distance));
+
+		return t_near < t_far;
+	}
+
 	inline Vector3 get_center() const {
 		return (min + max) * 0.5f;
 	}
@@ -0,0 +1,33 @@
+#pragma once
+#include "Math/Math.h"
+#include "Math/AABB.h"
+#include "Math/Vector3.h"
+
+// Control point of a Curve, the radius is interpolated linearly between two consecutive CurvePoints
+// NOTE: Layout matches a float4 on the GPU
+struct CurvePoint {
+	Vector3 position;
+	float   radius;
+};
+
+static_assert(sizeof(CurvePoint) == 4 * sizeof(float));
+
+// Straight segment of a Curve (e.g. a hair strand), a cylinder whose radius varies linearly from one end to the other
+struct CurveSegment {
+	Vector3 position_0;
+	float   radius_0;
+	Vector3 position_1;
+	float   radius_1;
+
+	Vector3 get_center() const {
+		return 0.5f * (position_0 + position_1);
+	}
+
+	// Bounds the spheres around both ends, which contain the whole segment
+	AABB get_aabb() const {
+		AABB aabb;
+		aabb.min = Vector3::min(position_0 - Vector3(radius_0), position_1 - Vector3(radius_1));
+		aabb.max = Vector3::max(position_0 + Vector3(radius_0), position_1 + Vector3(radius_1));
+		return aabb;
+	}
+};
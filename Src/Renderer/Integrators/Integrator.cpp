@@ -4,6 +4,8 @@
 
 #include <Imgui/imgui.h>
 
+#include "BVH/BVHRefitter.h"
+#include "BVH/BVHStatistics.h"
 #include "BVH/Converters/BVH4Converter.h"
 #include "BVH/Converters/BVH8Converter.h"
 
@@ -108,51 +110,94 @@ void Integrator::init_geometry() {
 	mesh_data_bvh_offsets     .resize(mesh_data_count);
 	mesh_data_triangle_offsets.resize(mesh_data_count);
 
-	Array<int> mesh_data_index_offsets(mesh_data_count);
+	Array<int> mesh_data_index_offsets      (mesh_data_count);
+	Array<int> mesh_data_vertex_offsets     (mesh_data_count);
+	Array<int> mesh_data_curve_point_offsets(mesh_data_count);
 
-	size_t aggregated_bvh_node_count = 2 * scene.meshes.size(); // Reserve 2 times Mesh count for TLAS
-	size_t aggregated_triangle_count = 0;
-	size_t aggregated_index_count    = 0;
+	size_t aggregated_bvh_node_count    = 2 * scene.meshes.size(); // Reserve 2 times Mesh count for TLAS
+	size_t aggregated_triangle_count    = 0; // Triangles and CurveSegments
+	size_t aggregated_index_count       = 0;
+	size_t aggregated_vertex_count      = 0;
+	size_t aggregated_curve_point_count = 0;
 
 	for (size_t i = 0; i < mesh_data_count; i++) {
-		mesh_data_bvh_offsets     [i] = aggregated_bvh_node_count;
-		mesh_data_triangle_offsets[i] = aggregated_triangle_count;
-		mesh_data_index_offsets   [i] = aggregated_index_count;
-
-		aggregated_bvh_node_count += scene.asset_manager.mesh_datas[i].bvh->node_count();
-		aggregated_triangle_count += scene.asset_manager.mesh_datas[i].triangles.size();
-		aggregated_index_count    += scene.asset_manager.mesh_datas[i].bvh->indices.size();;
+		mesh_data_bvh_offsets        [i] = aggregated_bvh_node_count;
+		mesh_data_triangle_offsets   [i] = aggregated_triangle_count;
+		mesh_data_index_offsets      [i] = aggregated_index_count;
+		mesh_data_vertex_offsets     [i] = aggregated_vertex_count;
+		mesh_data_curve_point_offsets[i] = aggregated_curve_point_count;
+
+		aggregated_bvh_node_count    += scene.asset_manager.mesh_datas[i].bvh->node_count();
+		aggregated_triangle_count    += scene.asset_manager.mesh_datas[i].primitive_count();
+		aggregated_index_count       += scene.asset_manager.mesh_datas[i].bvh->indices.size();
+		aggregated_vertex_count      += scene.asset_manager.mesh_datas[i].vertices.size();
+		aggregated_curve_point_count += scene.asset_manager.mesh_datas[i].curve_points.size();
 	}
 
-	Array<CUDATriangle> aggregated_triangles(aggregated_index_count);
+	Array<Vector3>      aggregated_vertex_positions (aggregated_vertex_count);
+	Array<Vector3>      aggregated_vertex_normals   (aggregated_vertex_count);
+	Array<Vector2>      aggregated_vertex_tex_coords(aggregated_vertex_count);
+	Array<CUDATriangle> aggregated_triangles        (aggregated_index_count);
+	Array<CurvePoint>   aggregated_curve_points     (aggregated_curve_point_count);
 	reverse_indices.resize(aggregated_triangle_count);
 
 	for (int m = 0; m < mesh_data_count; m++) {
 		const MeshData & mesh_data = scene.asset_manager.mesh_datas[m];
 
-		for (size_t i = 0; i < mesh_data.bvh->indices.size(); i++) {
-			int index = mesh_data.bvh->indices[i];
-			const Triangle & triangle = mesh_data.triangles[index];
+		int vertex_offset = mesh_data_vertex_offsets[m];
+
+		for (size_t i = 0; i < mesh_data.vertices.size(); i++) {
+			aggregated_vertex_positions [vertex_offset + i] = mesh_data.vertices[i].position;
+			aggregated_vertex_normals   [vertex_offset + i] = mesh_data.vertices[i].normal;
+			aggregated_vertex_tex_coords[vertex_offset + i] = mesh_data.vertices[i].tex_coord;
+		}
+
+		int curve_point_offset = mesh_data_curve_point_offsets[m];
 
-			aggregated_triangles[mesh_data_index_offsets[m] + i].position_0      = triangle.position_0;
-			aggregated_triangles[mesh_data_index_offsets[m] + i].position_edge_1 = triangle.position_1 - triangle.position_0;
-			aggregated_triangles[mesh_data_index_offsets[m] + i].position_edge_2 = triangle.position_2 - triangle.position_0;
+		for (size_t i = 0; i < mesh_data.curve_points.size(); i++) {
+			aggregated_curve_points[curve_point_offset + i] = mesh_data.curve_points[i];
+		}
 
-			aggregated_triangles[mesh_data_index_offsets[m] + i].normal_0      = triangle.normal_0;
-			aggregated_triangles[mesh_data_index_offsets[m] + i].normal_edge_1 = triangle.normal_1 - triangle.normal_0;
-			aggregated_triangles[mesh_data_index_offsets[m] + i].normal_edge_2 = triangle.normal_2 - triangle.normal_0;
+		for (size_t i = 0; i < mesh_data.bvh->indices.size(); i++) {
+			int index = mesh_data.bvh->indices[i];
 
-			aggregated_triangles[mesh_data_index_offsets[m] + i].tex_coord_0      = triangle.tex_coord_0;
-			aggregated_triangles[mesh_data_index_offsets[m] + i].tex_coord_edge_1 = triangle.tex_coord_1 - triangle.tex_coord_0;
-			aggregated_triangles[mesh_data_index_offsets[m] + i].tex_coord_edge_2 = triangle.tex_coord_2 - triangle.tex_coord_0;
+			CUDATriangle & triangle = aggregated_triangles[mesh_data_index_offsets[m] + i];
+
+			if (mesh_data.has_curves()) {
+				// CurveSegments are marked by an invalid third index, the first two indices refer to their CurvePoints
+				triangle.index_0 = curve_point_offset + mesh_data.curve_point_indices[index];
+				triangle.index_1 = curve_point_offset + mesh_data.curve_point_indices[index] + 1;
+				triangle.index_2 = INVALID;
+			} else {
+				triangle.index_0 = vertex_offset + mesh_data.vertex_indices[3 * index    ];
+				triangle.index_1 = vertex_offset + mesh_data.vertex_indices[3 * index + 1];
+				triangle.index_2 = vertex_offset + mesh_data.vertex_indices[3 * index + 2];
+			}
 
 			reverse_indices[mesh_data_triangle_offsets[m] + index] = mesh_data_index_offsets[m] + i;
 		}
 	}
 
+	// Scenes that only contain Curves have no indexed Vertices
+	if (aggregated_vertex_positions.size() > 0) {
+		ptr_vertex_positions  = CUDAMemory::malloc(aggregated_vertex_positions);
+		ptr_vertex_normals    = CUDAMemory::malloc(aggregated_vertex_normals);
+		ptr_vertex_tex_coords = CUDAMemory::malloc(aggregated_vertex_tex_coords);
+
+		cuda_module.get_global("vertex_positions") .set_value(ptr_vertex_positions);
+		cuda_module.get_global("vertex_normals")   .set_value(ptr_vertex_normals);
+		cuda_module.get_global("vertex_tex_coords").set_value(ptr_vertex_tex_coords);
+	}
+
 	ptr_triangles = CUDAMemory::malloc(aggregated_triangles);
 	cuda_module.get_global("triangles").set_value(ptr_triangles);
 
+	// Most Scenes do not contain any Curves
+	if (aggregated_curve_points.size() > 0) {
+		ptr_curve_points = CUDAMemory::malloc(aggregated_curve_points);
+		cuda_module.get_global("curve_points").set_value(ptr_curve_points);
+	}
+
 	pinned_mesh_bvh_root_indices             = CUDAMemory::malloc_pinned<int>      (scene.meshes.size());
 	pinned_mesh_material_ids                 = CUDAMemory::malloc_pinned<int>      (scene.meshes.size());
 	pinned_mesh_transforms                   = CUDAMemory::malloc_pinned<Matrix3x4>(scene.meshes.size());
@@ -176,7 +221,12 @@ void Integrator::init_geometry() {
 
 	tlas_raw.indices.resize(scene.meshes.size());
 	tlas_raw.nodes  .resize(scene.meshes.size() * 2);
-	tlas_builder = make_owned<SAHBuilder>(tlas_raw, scene.meshes.size());
+	tlas_builder = BVH::create_builder(tlas_raw, cpu_config.tlas_builder, scene.meshes.size());
+	tlas_updater = make_owned<TLASUpdater>(tlas_raw, *tlas_builder.get());
+
+	tlas_nodes_uploaded.clear();
+	tlas_mesh_changed = BitArray(scene.meshes.size());
+	tlas_uploaded     = false;
 
 	switch (cpu_config.bvh_type) {
 		case BVHType::BVH:
@@ -246,7 +296,7 @@ void Integrator::init_geometry() {
 			cuda_module.get_global("bvh4_nodes").set_value(ptr_bvh_nodes_4);
 
 			tlas           = make_owned<BVH4>(PinnedAllocator::instance());
-			tlas_converter = make_owned<BVH4Converter>(static_cast<BVH4 &>(*tlas.get()), tlas_raw);
+			tlas_converter = make_owned<BVH4Converter>(static_cast<BVH4 &>(*tlas.get()), tlas_raw, 1); // Leaves of the TLAS contain a single Mesh
 			break;
 		}
 		case BVHType::BVH8: {
@@ -352,7 +402,15 @@ void Integrator::free_geometry() {
 		case BVHType::BVH8: CUDAMemory::free(ptr_bvh_nodes_8); break;
 	}
 
+	if (ptr_vertex_positions.ptr) {
+		CUDAMemory::free(ptr_vertex_positions);
+		CUDAMemory::free(ptr_vertex_normals);
+		CUDAMemory::free(ptr_vertex_tex_coords);
+	}
 	CUDAMemory::free(ptr_triangles);
+	if (ptr_curve_points.ptr) {
+		CUDAMemory::free(ptr_curve_points);
+	}
 }
 
 void Integrator::free_sky() {
@@ -395,38 +453,157 @@ bool Integrator::aov_render_gui_checkbox(AOVType aov_type, const char * aov_name
 	return false;
 };
 
+// Uploads only the runs of Nodes that differ from the copy that was uploaded previously
+// Runs that are separated by only a few unchanged Nodes are merged to avoid many tiny copies
+template<typename Node>
+static void upload_changed_nodes(CUDAMemory::Ptr<Node> ptr_nodes, const Array<Node> & nodes, Array<char> & nodes_uploaded, CUstream stream) {
+	constexpr size_t MAX_GAP = 16;
+
+	if (nodes_uploaded.size() != nodes.size() * sizeof(Node)) {
+		nodes_uploaded.resize(nodes.size() * sizeof(Node));
+		memcpy(nodes_uploaded.data(), nodes.data(), nodes.size() * sizeof(Node));
+
+		CUDAMemory::memcpy_async(ptr_nodes, nodes.data(), nodes.size(), stream);
+		return;
+	}
+
+	Node * uploaded = reinterpret_cast<Node *>(nodes_uploaded.data());
+
+	auto node_changed = [&](size_t i) {
+		return memcmp(&nodes[i], &uploaded[i], sizeof(Node)) != 0;
+	};
+
+	size_t i = 0;
+	while (i < nodes.size()) {
+		if (!node_changed(i)) {
+			i++;
+			continue;
+		}
+
+		size_t first = i;
+		size_t last  = i + 1;
+
+		for (i = last; i < nodes.size() && i - last < MAX_GAP; i++) {
+			if (node_changed(i)) last = i + 1;
+		}
+		i = last;
+
+		memcpy(uploaded + first, nodes.data() + first, (last - first) * sizeof(Node));
+		CUDAMemory::memcpy_async(ptr_nodes + first, nodes.data() + first, last - first, stream);
+	}
+}
+
 // Construct Top Level Acceleration Structure (TLAS) over the Meshes in the Scene
+// Depending on how the Meshes moved since the last time, the TLAS is refitted, partially rebuilt, or fully rebuilt
 void Integrator::build_tlas() {
-	tlas_builder->build(scene.meshes);
-	tlas_converter->convert();
+	TLASUpdater::UpdateType update_type = tlas_updater->update(scene.meshes);
+
+	switch (update_type) {
+		case TLASUpdater::UpdateType::NONE: break;
+
+		case TLASUpdater::UpdateType::REFIT: {
+			// The topology is unchanged, so wide BVHs can be refitted in place instead of being converted again
+			switch (cpu_config.bvh_type) {
+				case BVHType::BVH:
+				case BVHType::SBVH: tlas_converter->convert(); break;
+				case BVHType::BVH4: BVHRefitter::refit(static_cast<BVH4 &>(*tlas.get()), scene.meshes); break;
+				case BVHType::BVH8: BVHRefitter::refit(static_cast<BVH8 &>(*tlas.get()), scene.meshes); break;
+				default: ASSERT_UNREACHABLE();
+			}
+			break;
+		}
+
+		case TLASUpdater::UpdateType::PARTIAL_REBUILD:
+		case TLASUpdater::UpdateType::FULL_REBUILD: tlas_converter->convert(); break;
 
-	switch (cpu_config.bvh_type) {
-		case BVHType::BVH:
-		case BVHType::SBVH: CUDAMemory::memcpy_async(ptr_bvh_nodes_2, static_cast<BVH2 *>(tlas.get())->nodes.data(), tlas->node_count(), memory_stream); break;
-		case BVHType::BVH4: CUDAMemory::memcpy_async(ptr_bvh_nodes_4, static_cast<BVH4 *>(tlas.get())->nodes.data(), tlas->node_count(), memory_stream); break;
-		case BVHType::BVH8: CUDAMemory::memcpy_async(ptr_bvh_nodes_8, static_cast<BVH8 *>(tlas.get())->nodes.data(), tlas->node_count(), memory_stream); break;
 		default: ASSERT_UNREACHABLE();
 	}
+
+	if (update_type != TLASUpdater::UpdateType::NONE || !tlas_uploaded) {
+		switch (cpu_config.bvh_type) {
+			case BVHType::BVH:
+			case BVHType::SBVH: upload_changed_nodes(ptr_bvh_nodes_2, static_cast<BVH2 *>(tlas.get())->nodes, tlas_nodes_uploaded, memory_stream); break;
+			case BVHType::BVH4: upload_changed_nodes(ptr_bvh_nodes_4, static_cast<BVH4 *>(tlas.get())->nodes, tlas_nodes_uploaded, memory_stream); break;
+			case BVHType::BVH8: upload_changed_nodes(ptr_bvh_nodes_8, static_cast<BVH8 *>(tlas.get())->nodes, tlas_nodes_uploaded, memory_stream); break;
+			default: ASSERT_UNREACHABLE();
+		}
+	}
 	ASSERT(tlas->indices.data());
 
+	// Update the per Mesh arrays, keeping track of which entries changed
 	for (int i = 0; i < scene.meshes.size(); i++) {
 		const Mesh & mesh = scene.meshes[tlas->indices[i]];
 
-		pinned_mesh_bvh_root_indices[i] = mesh_data_bvh_offsets[mesh.mesh_data_handle.handle] | (mesh.has_identity_transform() << 31);
+		int bvh_root_index = mesh_data_bvh_offsets[mesh.mesh_data_handle.handle] | (mesh.has_identity_transform() << 31);
 
 		ASSERT(mesh.material_handle.handle != INVALID);
-		pinned_mesh_material_ids[i] = mesh.material_handle.handle;
 
-		memcpy(pinned_mesh_transforms     [i].cells, mesh.transform     .cells, sizeof(Matrix3x4));
-		memcpy(pinned_mesh_transforms_inv [i].cells, mesh.transform_inv .cells, sizeof(Matrix3x4));
-		memcpy(pinned_mesh_transforms_prev[i].cells, mesh.transform_prev.cells, sizeof(Matrix3x4));
+		bool changed =
+			!tlas_uploaded ||
+			pinned_mesh_bvh_root_indices[i] != bvh_root_index ||
+			pinned_mesh_material_ids    [i] != mesh.material_handle.handle ||
+			memcmp(pinned_mesh_transforms     [i].cells, mesh.transform     .cells, sizeof(Matrix3x4)) != 0 ||
+			memcmp(pinned_mesh_transforms_inv [i].cells, mesh.transform_inv .cells, sizeof(Matrix3x4)) != 0 ||
+			memcmp(pinned_mesh_transforms_prev[i].cells, mesh.transform_prev.cells, sizeof(Matrix3x4)) != 0;
+
+		tlas_mesh_changed[i] = changed;
+
+		if (changed) {
+			pinned_mesh_bvh_root_indices[i] = bvh_root_index;
+			pinned_mesh_material_ids    [i] = mesh.material_handle.handle;
+
+			memcpy(pinned_mesh_transforms     [i].cells, mesh.transform     .cells, sizeof(Matrix3x4));
+			memcpy(pinned_mesh_transforms_inv [i].cells, mesh.transform_inv .cells, sizeof(Matrix3x4));
+			memcpy(pinned_mesh_transforms_prev[i].cells, mesh.transform_prev.cells, sizeof(Matrix3x4));
+		}
+	}
+
+	// Upload consecutive runs of changed entries
+	int i = 0;
+	while (i < scene.meshes.size()) {
+		if (!tlas_mesh_changed[i]) {
+			i++;
+			continue;
+		}
+
+		int first = i;
+		while (i < scene.meshes.size() && tlas_mesh_changed[i]) i++;
+		int count = i - first;
+
+		CUDAMemory::memcpy_async(ptr_mesh_bvh_root_indices + first, pinned_mesh_bvh_root_indices + first, count, memory_stream);
+		CUDAMemory::memcpy_async(ptr_mesh_material_ids     + first, pinned_mesh_material_ids     + first, count, memory_stream);
+		CUDAMemory::memcpy_async(ptr_mesh_transforms       + first, pinned_mesh_transforms       + first, count, memory_stream);
+		CUDAMemory::memcpy_async(ptr_mesh_transforms_inv   + first, pinned_mesh_transforms_inv   + first, count, memory_stream);
+		CUDAMemory::memcpy_async(ptr_mesh_transforms_prev  + first, pinned_mesh_transforms_prev  + first, count, memory_stream);
+	}
+
+	if (!tlas_uploaded && !cpu_config.bvh_stats_filename.is_empty()) {
+		write_bvh_statistics();
+	}
+
+	tlas_uploaded = true;
+}
+
+void Integrator::write_bvh_statistics() {
+	AssetManager & asset_manager = scene.asset_manager;
+
+	// MeshData has no name of its own, use the name of the first Mesh that instances it
+	Array<String> names(asset_manager.mesh_datas.size());
+	for (size_t i = 0; i < scene.meshes.size(); i++) {
+		String & name = names[scene.meshes[i].mesh_data_handle.handle];
+		if (name.is_empty()) {
+			name = scene.meshes[i].name;
+		}
+	}
+
+	Array<BVHStatistics> statistics;
+	for (size_t i = 0; i < asset_manager.mesh_datas.size(); i++) {
+		String name = names[i].is_empty() ? Format().format("MeshData {}"_sv, i) : std::move(names[i]);
+		statistics.push_back(BVHStatistics::calculate(std::move(name), asset_manager.mesh_datas[i]));
 	}
+	statistics.push_back(BVHStatistics::calculate("TLAS"_sv, *tlas.get(), scene.meshes));
 
-	CUDAMemory::memcpy_async(ptr_mesh_bvh_root_indices,  pinned_mesh_bvh_root_indices, scene.meshes.size(), memory_stream);
-	CUDAMemory::memcpy_async(ptr_mesh_material_ids,      pinned_mesh_material_ids,     scene.meshes.size(), memory_stream);
-	CUDAMemory::memcpy_async(ptr_mesh_transforms,        pinned_mesh_transforms,       scene.meshes.size(), memory_stream);
-	CUDAMemory::memcpy_async(ptr_mesh_transforms_inv,    pinned_mesh_transforms_inv,   scene.meshes.size(), memory_stream);
-	CUDAMemory::memcpy_async(ptr_mesh_transforms_prev,   pinned_mesh_transforms_prev,  scene.meshes.size(), memory_stream);
+	BVHStatistics::write_report(cpu_config.bvh_stats_filename, statistics);
 }
 
 void Integrator::update(float delta, Allocator * frame_allocator) {
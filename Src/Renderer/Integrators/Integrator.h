@@ -8,7 +8,8 @@
 #include "Device/CUDAEvent.h"
 #include "Device/CUDAContext.h"
 
-#include "BVH/Builders/SAHBuilder.h"
+#include "BVH/TLASUpdater.h"
+#include "BVH/Builders/BVHBuilder.h"
 #include "BVH/Converters/BVHConverter.h"
 
 #include "Renderer/Scene.h"
@@ -136,21 +137,20 @@ struct Integrator {
 
 	CUDAMemory::Ptr<CUDATexture> ptr_textures;
 
+	// Vertex indices of a single Triangle reference, in the order of the BVH indices
+	// For a CurveSegment index_0 and index_1 refer to its CurvePoints and index_2 is INVALID
 	struct CUDATriangle {
-		Vector3 position_0;
-		Vector3 position_edge_1;
-		Vector3 position_edge_2;
-
-		Vector3 normal_0;
-		Vector3 normal_edge_1;
-		Vector3 normal_edge_2;
-
-		Vector2 tex_coord_0;
-		Vector2 tex_coord_edge_1;
-		Vector2 tex_coord_edge_2;
+		int index_0;
+		int index_1;
+		int index_2;
 	};
 
+	// Vertex attributes are stored in separate arrays, so that intersection only touches positions
+	CUDAMemory::Ptr<Vector3>      ptr_vertex_positions;
+	CUDAMemory::Ptr<Vector3>      ptr_vertex_normals;
+	CUDAMemory::Ptr<Vector2>      ptr_vertex_tex_coords;
 	CUDAMemory::Ptr<CUDATriangle> ptr_triangles;
+	CUDAMemory::Ptr<CurvePoint>   ptr_curve_points;
 
 	CUDAMemory::Ptr<BVHNode2>  ptr_bvh_nodes_2;
 	CUDAMemory::Ptr<BVHNode4>  ptr_bvh_nodes_4;
@@ -172,8 +172,14 @@ struct Integrator {
 
 	BVH2                 tlas_raw;
 	OwnPtr<BVH>          tlas;
-	OwnPtr<SAHBuilder>   tlas_builder;
+	OwnPtr<BVHBuilder>   tlas_builder;
 	OwnPtr<BVHConverter> tlas_converter;
+	OwnPtr<TLASUpdater>  tlas_updater;
+
+	// Copy of the TLAS Nodes as they were last uploaded, used to only upload Nodes that changed
+	Array<char> tlas_nodes_uploaded;
+	BitArray    tlas_mesh_changed;
+	bool        tlas_uploaded = false;
 
 	Array<int> reverse_indices;
 
@@ -257,6 +263,7 @@ struct Integrator {
 	bool aov_render_gui_checkbox(AOVType aov_type, const char * aov_name);
 
 	void build_tlas();
+	void write_bvh_statistics();
 
 	virtual void update(float delta, Allocator * frame_allocator);
 	virtual void render() = 0;
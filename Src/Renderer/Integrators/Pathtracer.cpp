@@ -392,7 +392,10 @@ void Pathtracer::calc_light_power(Allocator * frame_allocator) {
 		Mesh & mesh = scene.meshes[m];
 		const Material & material = scene.asset_manager.get_material(mesh.material_handle);
 
-		if (material.is_light()) {
+		// NOTE: Curves are not sampled using next event estimation, they only emit light when hit directly
+		bool is_curve = scene.asset_manager.get_mesh_data(mesh.mesh_data_handle).has_curves();
+
+		if (material.is_light() && !is_curve) {
 			Array<Mesh *> & meshes = mesh_data_used_as_lights[mesh.mesh_data_handle];
 			meshes.allocator = frame_allocator;
 			meshes.push_back(&mesh);
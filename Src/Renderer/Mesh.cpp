@@ -11,6 +11,9 @@ void Mesh::calc_aabb(const Scene & scene) {
 	for (int i = 0; i < mesh_data.triangles.size(); i++) {
 		aabb_untransformed.expand(mesh_data.triangles[i].get_aabb());
 	}
+	for (int i = 0; i < mesh_data.curves.size(); i++) {
+		aabb_untransformed.expand(mesh_data.curves[i].get_aabb());
+	}
 }
 
 void Mesh::update() {
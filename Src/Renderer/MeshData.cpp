@@ -0,0 +1,95 @@
+#include "MeshData.h"
+
+#include "Core/HashMap.h"
+
+struct VertexEqual {
+	bool operator()(const Vertex & a, const Vertex & b) const {
+		return memcmp(&a, &b, sizeof(Vertex)) == 0;
+	}
+};
+
+void MeshData::init_vertices() {
+	vertices.clear();
+	vertex_indices.resize(3 * triangles.size());
+
+	HashMap<Vertex, int, Hash<Vertex>, VertexEqual> vertex_map;
+
+	auto add_vertex = [&](const Vector3 & position, const Vector3 & normal, const Vector2 & tex_coord) {
+		Vertex vertex = { position, normal, tex_coord };
+
+		int * index = vertex_map.try_get(vertex);
+		if (index) return *index;
+
+		int new_index = int(vertices.size());
+		vertices.push_back(vertex);
+		vertex_map.insert(vertex, new_index);
+		return new_index;
+	};
+
+	for (size_t i = 0; i < triangles.size(); i++) {
+		const Triangle & triangle = triangles[i];
+
+		vertex_indices[3 * i    ] = add_vertex(triangle.position_0, triangle.normal_0, triangle.tex_coord_0);
+		vertex_indices[3 * i + 1] = add_vertex(triangle.position_1, triangle.normal_1, triangle.tex_coord_1);
+		vertex_indices[3 * i + 2] = add_vertex(triangle.position_2, triangle.normal_2, triangle.tex_coord_2);
+	}
+}
+
+void MeshData::init_triangles() {
+	triangles.resize(vertex_indices.size() / 3);
+
+	for (size_t i = 0; i < triangles.size(); i++) {
+		const Vertex & vertex_0 = vertices[vertex_indices[3 * i    ]];
+		const Vertex & vertex_1 = vertices[vertex_indices[3 * i + 1]];
+		const Vertex & vertex_2 = vertices[vertex_indices[3 * i + 2]];
+
+		// NOTE: Assigned directly instead of through the constructor, the Vertices have already been validated when they were first loaded
+		Triangle & triangle = triangles[i];
+		triangle.position_0  = vertex_0.position;
+		triangle.position_1  = vertex_1.position;
+		triangle.position_2  = vertex_2.position;
+		triangle.normal_0    = vertex_0.normal;
+		triangle.normal_1    = vertex_1.normal;
+		triangle.normal_2    = vertex_2.normal;
+		triangle.tex_coord_0 = vertex_0.tex_coord;
+		triangle.tex_coord_1 = vertex_1.tex_coord;
+		triangle.tex_coord_2 = vertex_2.tex_coord;
+	}
+}
+
+void MeshData::init_curve_points() {
+	curve_points.clear();
+	curve_point_indices.resize(curves.size());
+
+	for (size_t i = 0; i < curves.size(); i++) {
+		const CurveSegment & curve = curves[i];
+
+		// Consecutive segments of a Curve share the end of the previous segment, otherwise a new Curve starts
+		bool continues_previous =
+			i > 0 &&
+			memcmp(&curves[i - 1].position_1, &curve.position_0, sizeof(Vector3)) == 0 &&
+			curves[i - 1].radius_1 == curve.radius_0;
+
+		if (!continues_previous) {
+			curve_points.push_back({ curve.position_0, curve.radius_0 });
+		}
+		curve_point_indices[i] = int(curve_points.size()) - 1;
+
+		curve_points.push_back({ curve.position_1, curve.radius_1 });
+	}
+}
+
+void MeshData::init_curves() {
+	curves.resize(curve_point_indices.size());
+
+	for (size_t i = 0; i < curves.size(); i++) {
+		const CurvePoint & point_0 = curve_points[curve_point_indices[i]];
+		const CurvePoint & point_1 = curve_points[curve_point_indices[i] + 1];
+
+		CurveSegment & curve = curves[i];
+		curve.position_0 = point_0.position;
+		curve.radius_0   = point_0.radius;
+		curve.position_1 = point_1.position;
+		curve.radius_1   = point_1.radius;
+	}
+}
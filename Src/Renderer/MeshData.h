@@ -1,12 +1,57 @@
 #pragma once
 #include "Renderer/Triangle.h"
+#include "Renderer/Curve.h"
 
 #include "BVH/BVH.h"
 
 #include "Core/Array.h"
 #include "Core/OwnPtr.h"
+#include "Core/Allocators/MappedFileAllocator.h"
 
+struct Vertex {
+	Vector3 position;
+	Vector3 normal;
+	Vector2 tex_coord;
+};
+
+// A MeshData contains either Triangles or CurveSegments, never both
 struct MeshData {
-	Array<Triangle> triangles;
-	OwnPtr<BVH>     bvh;
+	// If the MeshData was loaded from an uncompressed BVH file, the indexed representation and BVH refer directly into the mapped file
+	// NOTE: Declared first so that it is destroyed last
+	OwnPtr<MappedFileAllocator> mapping;
+
+	Array<Triangle> triangles; // Fully expanded, used on the CPU for BVH construction, refitting, and light sampling
+
+	// Indexed representation used on the GPU and in the BVH cache, Vertices shared between Triangles are only stored once
+	// NOTE: Needs to be rebuilt using init_vertices() whenever the Triangles change
+	Array<Vertex> vertices;
+	Array<int>    vertex_indices; // Three per Triangle
+
+	Array<CurveSegment> curves; // Fully expanded, used on the CPU for BVH construction and refitting
+
+	// Indexed representation of the CurveSegments, consecutive segments of the same Curve share their CurvePoint
+	// NOTE: Needs to be rebuilt using init_curve_points() whenever the CurveSegments change
+	Array<CurvePoint> curve_points;
+	Array<int>        curve_point_indices; // One per CurveSegment, index of its first CurvePoint. The second CurvePoint directly follows it
+
+	OwnPtr<BVH> bvh;
+
+	float bvh_sah_cost = 0.0f; // SAH cost of the BVH as it was built, determined by the first BVHRefitter::refit_or_rebuild
+
+	// Builds the indexed representation from the Triangles by merging bitwise identical Vertices
+	void init_vertices();
+
+	// Builds the Triangles from the indexed representation
+	void init_triangles();
+
+	// Builds the indexed representation from the CurveSegments by merging the shared CurvePoints of consecutive segments
+	void init_curve_points();
+
+	// Builds the CurveSegments from the indexed representation
+	void init_curves();
+
+	bool has_curves() const { return curves.size() > 0; }
+
+	// Number of Triangles or CurveSegments, which is what the indices of the BVH refer to
+	size_t primitive_count() const { return has_curves() ? curves.size() : triangles.size(); }
 };
@@ -39,6 +39,9 @@ Scene::Scene(Allocator * allocator) : allocator(allocator), asset_manager(alloca
 	}
 
 	sky.load(cpu_config.sky_filename);
+
+	// Fallback loaders may still refer to memory in load_allocator (e.g. SourceLocations), so wait before it goes out of scope
+	asset_manager.wait_until_loaded();
 }
 
 Mesh & Scene::add_mesh(String name, Handle<MeshData> mesh_data_handle, Handle<Material> material_handle) {
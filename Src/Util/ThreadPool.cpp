@@ -2,10 +2,13 @@
 
 #include <thread>
 #include <mutex>
+#include <memory>
 
 #include "Core/Array.h"
 #include "Core/Queue.h"
 
+#include "Math/Math.h"
+
 static Array<std::thread> threads;
 
 static Queue<ThreadPool::Work> work_queue;
@@ -18,7 +21,7 @@ struct Signal {
 static Signal signal_submit;
 static Signal signal_done;
 
-static int              num_submitted = 0;
+static std::atomic<int> num_submitted = 0;
 static std::atomic<int> num_done      = 0;
 
 static std::atomic<bool> is_done;
@@ -80,3 +83,54 @@ void ThreadPool::sync() {
 	std::unique_lock<std::mutex> lock(signal_done.mutex);
 	signal_done.condition.wait(lock, []{ return num_done == num_submitted; });
 }
+
+int ThreadPool::get_thread_count() {
+	return is_done ? 0 : int(threads.size());
+}
+
+void ThreadPool::parallel_for(int count, const IndexedWork & work) {
+	if (count <= 0) return;
+
+	// Shared between the calling thread and the helper threads
+	// Helpers may only get scheduled after all work is already done,
+	// so the Batch needs to outlive this function
+	struct Batch {
+		const IndexedWork * work;
+		int                 count;
+
+		std::atomic<int> next_index = 0;
+		std::atomic<int> num_done   = 0;
+
+		Signal signal_done;
+	};
+	std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+	batch->work  = &work;
+	batch->count = count;
+
+	auto execute = [](Batch & batch) {
+		while (true) {
+			int index = batch.next_index++;
+			if (index >= batch.count) return;
+
+			(*batch.work)(index);
+
+			if (++batch.num_done == batch.count) {
+				std::lock_guard<std::mutex> lock(batch.signal_done.mutex);
+				batch.signal_done.condition.notify_all();
+			}
+		}
+	};
+
+	int num_helpers = Math::min(count - 1, get_thread_count());
+	for (int i = 0; i < num_helpers; i++) {
+		submit([batch, execute]() {
+			execute(*batch);
+		});
+	}
+
+	execute(*batch);
+
+	// Wait for work items that were picked up by helper threads
+	std::unique_lock<std::mutex> lock(batch->signal_done.mutex);
+	batch->signal_done.condition.wait(lock, [&batch]{ return batch->num_done == batch->count; });
+}
@@ -2,7 +2,8 @@
 #include "Core/Function.h"
 
 namespace ThreadPool {
-	using Work = Function<void()>;
+	using Work        = Function<void()>;
+	using IndexedWork = Function<void(int)>;
 
 	void init();
 	void init(int thread_count);
@@ -11,4 +12,11 @@ namespace ThreadPool {
 	void submit(Work && work);
 
 	void sync();
+
+	// Returns the number of worker threads that are currently able to accept work
+	int get_thread_count();
+
+	// Calls work(i) for every i in [0, count) and returns once all calls have completed
+	// The calling thread helps execute the work, so this is safe to call from within a worker thread
+	void parallel_for(int count, const IndexedWork & work);
 };